@@ -0,0 +1,71 @@
+#pragma once
+
+#include "beve_view.hpp"
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only BEVE document served straight from a memory mapping.
+//
+// Opening only maps the file, so startup does not depend on its size, and pages are
+// faulted in as queries touch them (the mapping is advised MADV_RANDOM so the kernel does
+// not read ahead on our behalf). Queries are resolved in place by beve_view, so a BEVE
+// response can be written from the mapping without copying it.
+class beve_dataset {
+public:
+   using slice = beve_view::slice;
+
+   beve_dataset() = default;
+
+   ~beve_dataset() { unmap(); }
+
+   beve_dataset(const beve_dataset&) = delete;
+   beve_dataset& operator=(const beve_dataset&) = delete;
+
+   bool open(const std::string& path, std::string& error) {
+      unmap();
+      const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+         error = "Failed to open " + path + ": " + std::strerror(errno);
+         return false;
+      }
+      struct stat st{};
+      if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+         error = "Dataset is empty or unreadable: " + path;
+         ::close(fd);
+         return false;
+      }
+      void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (addr == MAP_FAILED) {
+         error = "Failed to map " + path + ": " + std::strerror(errno);
+         return false;
+      }
+      madvise(addr, static_cast<size_t>(st.st_size), MADV_RANDOM);
+      view = beve_view({static_cast<const char*>(addr), static_cast<size_t>(st.st_size)});
+      return true;
+   }
+
+   size_t size() const { return view.buffer().size(); }
+
+   // Resolve a JSON pointer ("" or "/" is the whole document) to the bytes of that value
+   std::optional<slice> find(std::string_view pointer) const { return view.find(pointer); }
+
+private:
+   beve_view view{};
+
+   void unmap() {
+      const auto mapped = view.buffer();
+      if (!mapped.empty()) {
+         munmap(const_cast<char*>(mapped.data()), mapped.size());
+         view = {};
+      }
+   }
+};
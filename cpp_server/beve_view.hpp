@@ -0,0 +1,341 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Non-owning reader over a BEVE buffer that resolves JSON pointers without decoding.
+// Strings and typed arrays are skipped by their encoded lengths, and objects and generic
+// arrays are skipped member by member, so only the bytes on the path to the addressed
+// value are inspected. The result is a view into the buffer.
+//
+// Elements of typed arrays have no header byte of their own; a slice that addresses one
+// carries a synthesized header in `prefix`, followed by the element bytes in `data`.
+class beve_view {
+public:
+   struct slice {
+      std::string prefix{};
+      std::string_view data{};
+
+      size_t size() const { return prefix.size() + data.size(); }
+   };
+
+   beve_view() = default;
+   explicit beve_view(std::string_view document) : document(document) {}
+
+   std::string_view buffer() const { return document; }
+
+   // Resolve a JSON pointer ("" or "/" is the whole document) to the bytes of that value
+   std::optional<slice> find(std::string_view pointer) const {
+      size_t pos = 0;
+      while (!pointer.empty()) {
+         if (pointer.front() == '/') {
+            pointer.remove_prefix(1);
+            if (pointer.empty()) {
+               break;
+            }
+         }
+         const auto end = pointer.find('/');
+         std::string segment = unescape(pointer.substr(0, end));
+         pointer = (end == std::string_view::npos) ? std::string_view{} : pointer.substr(end);
+
+         if (!skip_variant_tags(pos)) {
+            return std::nullopt;
+         }
+         const uint8_t header = byte(pos);
+         switch (header & 0b111) {
+         case object: {
+            if (!seek_member(pos, segment)) {
+               return std::nullopt;
+            }
+            break;
+         }
+         case generic_array: {
+            uint64_t index{}, count{};
+            ++pos;
+            if (!parse_index(segment, index) || !read_size(pos, count) || index >= count) {
+               return std::nullopt;
+            }
+            for (uint64_t i = 0; i < index; ++i) {
+               if (!skip_value(pos, 0)) {
+                  return std::nullopt;
+               }
+            }
+            break;
+         }
+         case typed_array: {
+            // An element of a typed array is a leaf, so it must be the last segment
+            if (!pointer.empty()) {
+               return std::nullopt;
+            }
+            return typed_array_element(pos, segment);
+         }
+         default:
+            return std::nullopt; // cannot index into a scalar
+         }
+      }
+
+      const size_t start = pos;
+      if (!skip_value(pos, 0)) {
+         return std::nullopt;
+      }
+      return slice{{}, document.substr(start, pos - start)};
+   }
+
+private:
+   static constexpr uint8_t object = 3;
+   static constexpr uint8_t typed_array = 4;
+   static constexpr uint8_t generic_array = 5;
+   static constexpr uint8_t extension = 6;
+   static constexpr uint8_t variant_tag = (1 << 3) | extension;
+   static constexpr int max_depth = 256;
+
+   std::string_view document{};
+
+   uint8_t byte(size_t pos) const { return static_cast<uint8_t>(document[pos]); }
+
+   bool advance(size_t& pos, uint64_t n) const {
+      if (n > document.size() - pos) {
+         return false;
+      }
+      pos += static_cast<size_t>(n);
+      return true;
+   }
+
+   // BEVE compressed integer: the low two bits of the first byte give its width (1, 2, 4 or 8 bytes)
+   bool read_size(size_t& pos, uint64_t& out) const {
+      if (pos >= document.size()) {
+         return false;
+      }
+      const size_t n = size_t(1) << (byte(pos) & 0b11);
+      if (n > document.size() - pos) {
+         return false;
+      }
+      uint64_t value = 0;
+      std::memcpy(&value, document.data() + pos, n);
+      out = value >> 2;
+      pos += n;
+      return true;
+   }
+
+   static std::string unescape(std::string_view segment) {
+      std::string out;
+      for (size_t i = 0; i < segment.size(); ++i) {
+         if (segment[i] == '~' && i + 1 < segment.size()) {
+            out.push_back(segment[i + 1] == '1' ? '/' : '~');
+            ++i;
+         }
+         else {
+            out.push_back(segment[i]);
+         }
+      }
+      return out;
+   }
+
+   static bool parse_index(std::string_view segment, uint64_t& index) {
+      const auto [ptr, ec] = std::from_chars(segment.data(), segment.data() + segment.size(), index);
+      return ec == std::errc{} && ptr == segment.data() + segment.size();
+   }
+
+   // A variant is transparent to JSON pointers: step over its tag to the held value
+   bool skip_variant_tags(size_t& pos) const {
+      while (pos < document.size() && byte(pos) == variant_tag) {
+         uint64_t index{};
+         ++pos;
+         if (!read_size(pos, index)) {
+            return false;
+         }
+      }
+      return pos < document.size();
+   }
+
+   bool seek_member(size_t& pos, const std::string& key) const {
+      const uint8_t header = byte(pos++);
+      const uint8_t key_type = (header >> 3) & 0b11;
+      const uint64_t key_bytes = uint64_t(1) << (header >> 5);
+
+      int64_t int_key{};
+      if (key_type != 0) {
+         const auto [ptr, ec] = std::from_chars(key.data(), key.data() + key.size(), int_key);
+         if (ec != std::errc{} || ptr != key.data() + key.size()) {
+            return false;
+         }
+      }
+
+      uint64_t count{};
+      if (!read_size(pos, count)) {
+         return false;
+      }
+      for (uint64_t i = 0; i < count; ++i) {
+         bool match = false;
+         if (key_type == 0) {
+            uint64_t length{};
+            if (!read_size(pos, length) || length > document.size() - pos) {
+               return false;
+            }
+            match = document.substr(pos, static_cast<size_t>(length)) == key;
+            pos += static_cast<size_t>(length);
+         }
+         else {
+            if (key_bytes > 8 || key_bytes > document.size() - pos) {
+               return false;
+            }
+            // Integer keys are compared by value, sign-extending signed keys
+            uint64_t raw = 0;
+            std::memcpy(&raw, document.data() + pos, static_cast<size_t>(key_bytes));
+            if (key_type == 1 && key_bytes < 8 && (raw >> (key_bytes * 8 - 1)) & 1) {
+               raw |= ~uint64_t(0) << (key_bytes * 8);
+            }
+            match = static_cast<int64_t>(raw) == int_key;
+            pos += static_cast<size_t>(key_bytes);
+         }
+         if (match) {
+            return true;
+         }
+         if (!skip_value(pos, 0)) {
+            return false;
+         }
+      }
+      return false;
+   }
+
+   std::optional<slice> typed_array_element(size_t pos, const std::string& segment) const {
+      const uint8_t header = byte(pos++);
+      const uint8_t element_type = (header >> 3) & 0b11;
+      uint64_t index{}, count{};
+      if (!parse_index(segment, index) || !read_size(pos, count) || index >= count) {
+         return std::nullopt;
+      }
+
+      if (element_type < 3) {
+         // Numbers: fixed width, so the element is addressed directly
+         const uint64_t width = uint64_t(1) << (header >> 5);
+         if (!advance(pos, index * width) || width > document.size() - pos) {
+            return std::nullopt;
+         }
+         const char number_header = static_cast<char>(1 | (element_type << 3) | (header & 0b11100000));
+         return slice{std::string(1, number_header), document.substr(pos, static_cast<size_t>(width))};
+      }
+      if ((header >> 5) & 1) {
+         // Strings: each is a compressed length followed by its bytes
+         for (uint64_t i = 0;; ++i) {
+            const size_t start = pos;
+            uint64_t length{};
+            if (!read_size(pos, length) || !advance(pos, length)) {
+               return std::nullopt;
+            }
+            if (i == index) {
+               return slice{std::string(1, char(2)), document.substr(start, pos - start)};
+            }
+         }
+      }
+      // Booleans are packed eight to a byte, least significant bit first
+      if (!advance(pos, index / 8) || pos >= document.size()) {
+         return std::nullopt;
+      }
+      const bool value = (byte(pos) >> (index % 8)) & 1;
+      return slice{std::string(1, char(value ? 0b00011000 : 0b00001000)), {}};
+   }
+
+   bool skip_value(size_t& pos, int depth) const {
+      if (pos >= document.size() || depth > max_depth) {
+         return false;
+      }
+      const uint8_t header = byte(pos++);
+      switch (header & 0b111) {
+      case 0: // null or boolean
+         return true;
+      case 1: // number
+         return advance(pos, uint64_t(1) << (header >> 5));
+      case 2: { // string
+         uint64_t length{};
+         return read_size(pos, length) && advance(pos, length);
+      }
+      case object: {
+         const uint8_t key_type = (header >> 3) & 0b11;
+         uint64_t count{};
+         if (!read_size(pos, count)) {
+            return false;
+         }
+         for (uint64_t i = 0; i < count; ++i) {
+            if (key_type == 0) {
+               uint64_t length{};
+               if (!read_size(pos, length) || !advance(pos, length)) {
+                  return false;
+               }
+            }
+            else if (!advance(pos, uint64_t(1) << (header >> 5))) {
+               return false;
+            }
+            if (!skip_value(pos, depth + 1)) {
+               return false;
+            }
+         }
+         return true;
+      }
+      case typed_array: {
+         const uint8_t element_type = (header >> 3) & 0b11;
+         uint64_t count{};
+         if (!read_size(pos, count)) {
+            return false;
+         }
+         if (element_type < 3) {
+            const uint64_t width = uint64_t(1) << (header >> 5);
+            return count <= (document.size() - pos) / width && advance(pos, count * width);
+         }
+         if ((header >> 5) & 1) {
+            for (uint64_t i = 0; i < count; ++i) {
+               uint64_t length{};
+               if (!read_size(pos, length) || !advance(pos, length)) {
+                  return false;
+               }
+            }
+            return true;
+         }
+         return advance(pos, (count + 7) / 8);
+      }
+      case generic_array: {
+         uint64_t count{};
+         if (!read_size(pos, count)) {
+            return false;
+         }
+         for (uint64_t i = 0; i < count; ++i) {
+            if (!skip_value(pos, depth + 1)) {
+               return false;
+            }
+         }
+         return true;
+      }
+      case extension:
+         switch (header >> 3) {
+         case 0: // delimiter
+            return true;
+         case 1: { // variant: type index, then the value
+            uint64_t index{};
+            return read_size(pos, index) && skip_value(pos, depth + 1);
+         }
+         case 2: // matrix: layout byte, extents, then values (both typed arrays)
+            return advance(pos, 1) && skip_value(pos, depth + 1) && skip_value(pos, depth + 1);
+         case 3: { // complex: a single pair, or a count of pairs
+            if (pos >= document.size()) {
+               return false;
+            }
+            const uint8_t complex_header = byte(pos++);
+            const uint64_t pair = uint64_t(2) << (complex_header >> 5);
+            if ((complex_header & 1) == 0) {
+               return advance(pos, pair);
+            }
+            uint64_t count{};
+            return read_size(pos, count) && count <= (document.size() - pos) / pair && advance(pos, count * pair);
+         }
+         default:
+            return false;
+         }
+      default:
+         return false;
+      }
+   }
+};
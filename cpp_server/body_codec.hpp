@@ -0,0 +1,307 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Each codec is optional: the build defines REPE_HAVE_ZSTD / REPE_HAVE_LZ4 when it finds the library
+#ifndef REPE_HAVE_ZSTD
+#define REPE_HAVE_ZSTD 0
+#endif
+#ifndef REPE_HAVE_LZ4
+#define REPE_HAVE_LZ4 0
+#endif
+
+#if REPE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if REPE_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+// Compressed body formats wrap another format: the high byte of the format names the codec
+// and the low byte is the format of the uncompressed body, so 0x1202 is zstd-compressed JSON.
+// Bodies are standard zstd or LZ4 frames, which any implementation of the codec can read.
+// REPE.jl mirrors these codes (BODY_LZ4_BASE, BODY_ZSTD_BASE).
+inline constexpr uint16_t body_lz4_base = 0x1100;
+inline constexpr uint16_t body_zstd_base = 0x1200;
+
+enum class body_codec : uint8_t { none, lz4, zstd };
+
+inline body_codec codec_of(uint16_t format) {
+   switch (format & 0xff00) {
+   case body_lz4_base:
+      return body_codec::lz4;
+   case body_zstd_base:
+      return body_codec::zstd;
+   default:
+      return body_codec::none;
+   }
+}
+
+inline uint16_t inner_format(uint16_t format) {
+   return codec_of(format) == body_codec::none ? format : static_cast<uint16_t>(format & 0xff);
+}
+
+inline uint16_t compressed_format(body_codec codec, uint16_t inner) {
+   switch (codec) {
+   case body_codec::lz4:
+      return static_cast<uint16_t>(body_lz4_base | (inner & 0xff));
+   case body_codec::zstd:
+      return static_cast<uint16_t>(body_zstd_base | (inner & 0xff));
+   default:
+      return inner;
+   }
+}
+
+// Whether this build can encode and decode a codec
+inline bool codec_available(body_codec codec) {
+   switch (codec) {
+   case body_codec::none:
+      return true;
+   case body_codec::lz4:
+      return REPE_HAVE_LZ4;
+   case body_codec::zstd:
+      return REPE_HAVE_ZSTD;
+   }
+   return false;
+}
+
+// Compresses and decompresses bodies. zstd can use trained dictionaries, which make small,
+// repetitive messages (where a codec otherwise has too little data to find the repetition)
+// compress several times better. Compression uses the most recently loaded dictionary;
+// decompression picks the dictionary named in the frame. Load dictionaries before serving:
+// they are not guarded against concurrent use. Codec contexts are per thread.
+class body_compressor {
+public:
+   explicit body_compressor(int level = 3) : level(level) {}
+
+   // Load a dictionary trained with `zstd --train` (or ZDICT_trainFromBuffer)
+   bool load_dictionary(const std::string& path, std::string& error) {
+#if REPE_HAVE_ZSTD
+      std::ifstream file(path, std::ios::binary);
+      if (!file) {
+         error = "Cannot open dictionary " + path;
+         return false;
+      }
+      const std::string content{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+      const unsigned id = ZSTD_getDictID_fromDict(content.data(), content.size());
+      if (id == 0) {
+         error = path + " is not a trained zstd dictionary";
+         return false;
+      }
+      auto& entry = dictionaries[id];
+      entry.compress.reset(ZSTD_createCDict(content.data(), content.size(), level));
+      entry.decompress.reset(ZSTD_createDDict(content.data(), content.size()));
+      if (!entry.compress || !entry.decompress) {
+         dictionaries.erase(id);
+         error = "Cannot load dictionary " + path;
+         return false;
+      }
+      active = &entry;
+      return true;
+#else
+      error = "This server was built without zstd; cannot load " + path;
+      return false;
+#endif
+   }
+
+   size_t dictionary_count() const {
+#if REPE_HAVE_ZSTD
+      return dictionaries.size();
+#else
+      return 0;
+#endif
+   }
+
+   bool compress(body_codec codec, std::string_view in, std::string& out) const {
+      switch (codec) {
+      case body_codec::none:
+         out.assign(in);
+         return true;
+#if REPE_HAVE_ZSTD
+      case body_codec::zstd: {
+         auto* cctx = zstd_compression_context();
+         out.resize(ZSTD_compressBound(in.size()));
+         const size_t n = active ? ZSTD_compress_usingCDict(cctx, out.data(), out.size(), in.data(),
+                                                            in.size(), active->compress.get())
+                                 : ZSTD_compressCCtx(cctx, out.data(), out.size(), in.data(), in.size(),
+                                                     level);
+         if (ZSTD_isError(n)) {
+            return false;
+         }
+         out.resize(n);
+         return true;
+      }
+#endif
+#if REPE_HAVE_LZ4
+      case body_codec::lz4: {
+         LZ4F_preferences_t preferences{};
+         preferences.frameInfo.contentSize = in.size();
+         out.resize(LZ4F_compressFrameBound(in.size(), &preferences));
+         const size_t n = LZ4F_compressFrame(out.data(), out.size(), in.data(), in.size(), &preferences);
+         if (LZ4F_isError(n)) {
+            return false;
+         }
+         out.resize(n);
+         return true;
+      }
+#endif
+      default:
+         return false;
+      }
+   }
+
+   // Decompress a body, refusing to produce more than `max_size` bytes (a small body can
+   // claim to expand to any size)
+   bool decompress(body_codec codec, std::string_view in, std::string& out, size_t max_size) const {
+      switch (codec) {
+      case body_codec::none:
+         out.assign(in);
+         return out.size() <= max_size;
+#if REPE_HAVE_ZSTD
+      case body_codec::zstd:
+         return zstd_decompress(in, out, max_size);
+#endif
+#if REPE_HAVE_LZ4
+      case body_codec::lz4:
+         return lz4_decompress(in, out, max_size);
+#endif
+      default:
+         return false;
+      }
+   }
+
+private:
+   int level;
+
+   // Grow `out` for more output, up to `max_size`; false once it is reached
+   static bool grow(std::string& out, size_t produced, size_t max_size) {
+      if (produced >= max_size) {
+         return false;
+      }
+      out.resize(std::min(max_size, std::max<size_t>(produced * 2, 64 * 1024)));
+      return true;
+   }
+
+#if REPE_HAVE_ZSTD
+   struct cdict_deleter {
+      void operator()(ZSTD_CDict* d) const { ZSTD_freeCDict(d); }
+   };
+   struct ddict_deleter {
+      void operator()(ZSTD_DDict* d) const { ZSTD_freeDDict(d); }
+   };
+   struct dictionary {
+      std::unique_ptr<ZSTD_CDict, cdict_deleter> compress;
+      std::unique_ptr<ZSTD_DDict, ddict_deleter> decompress;
+   };
+
+   std::map<unsigned, dictionary> dictionaries;
+   const dictionary* active = nullptr;
+
+   struct cctx_deleter {
+      void operator()(ZSTD_CCtx* c) const { ZSTD_freeCCtx(c); }
+   };
+   struct dctx_deleter {
+      void operator()(ZSTD_DCtx* d) const { ZSTD_freeDCtx(d); }
+   };
+
+   static ZSTD_CCtx* zstd_compression_context() {
+      thread_local std::unique_ptr<ZSTD_CCtx, cctx_deleter> context{ZSTD_createCCtx()};
+      return context.get();
+   }
+
+   static ZSTD_DCtx* zstd_decompression_context() {
+      thread_local std::unique_ptr<ZSTD_DCtx, dctx_deleter> context{ZSTD_createDCtx()};
+      return context.get();
+   }
+
+   bool zstd_decompress(std::string_view in, std::string& out, size_t max_size) const {
+      auto* dctx = zstd_decompression_context();
+      ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters);
+      if (const unsigned id = ZSTD_getDictID_fromFrame(in.data(), in.size()); id != 0) {
+         auto found = dictionaries.find(id);
+         if (found == dictionaries.end()) {
+            return false; // compressed with a dictionary we do not have
+         }
+         ZSTD_DCtx_refDDict(dctx, found->second.decompress.get());
+      }
+      // Frames compressed in one shot record their size; streamed ones may not
+      const auto declared = ZSTD_getFrameContentSize(in.data(), in.size());
+      out.clear();
+      if (declared != ZSTD_CONTENTSIZE_UNKNOWN && declared != ZSTD_CONTENTSIZE_ERROR) {
+         if (declared > max_size) {
+            return false;
+         }
+         out.resize(static_cast<size_t>(declared));
+      }
+      ZSTD_inBuffer input{in.data(), in.size(), 0};
+      size_t produced = 0;
+      size_t pending = 1;
+      while (input.pos < input.size || pending != 0) {
+         if (produced == out.size() && !grow(out, produced, max_size)) {
+            return false;
+         }
+         ZSTD_outBuffer output{out.data() + produced, out.size() - produced, 0};
+         pending = ZSTD_decompressStream(dctx, &output, &input);
+         if (ZSTD_isError(pending)) {
+            return false;
+         }
+         produced += output.pos;
+         if (input.pos == input.size && pending != 0 && output.pos < output.size) {
+            return false; // truncated frame
+         }
+      }
+      out.resize(produced);
+      return true;
+   }
+#endif
+
+#if REPE_HAVE_LZ4
+   struct lz4_deleter {
+      void operator()(LZ4F_dctx* d) const { LZ4F_freeDecompressionContext(d); }
+   };
+
+   static LZ4F_dctx* lz4_decompression_context() {
+      thread_local std::unique_ptr<LZ4F_dctx, lz4_deleter> context{[] {
+         LZ4F_dctx* d = nullptr;
+         LZ4F_createDecompressionContext(&d, LZ4F_VERSION);
+         return d;
+      }()};
+      return context.get();
+   }
+
+   bool lz4_decompress(std::string_view in, std::string& out, size_t max_size) const {
+      auto* dctx = lz4_decompression_context();
+      LZ4F_resetDecompressionContext(dctx);
+      out.clear();
+      size_t consumed = 0;
+      size_t produced = 0;
+      size_t pending = 1;
+      while (consumed < in.size() || pending != 0) {
+         if (produced == out.size() && !grow(out, produced, max_size)) {
+            return false;
+         }
+         size_t written = out.size() - produced;
+         size_t read = in.size() - consumed;
+         pending = LZ4F_decompress(dctx, out.data() + produced, &written, in.data() + consumed, &read, nullptr);
+         if (LZ4F_isError(pending)) {
+            return false;
+         }
+         consumed += read;
+         produced += written;
+         if (consumed == in.size() && pending != 0 && produced < out.size()) {
+            return false; // truncated frame
+         }
+      }
+      out.resize(produced);
+      return true;
+   }
+#endif
+};
@@ -0,0 +1,235 @@
+#pragma once
+
+#include "client_connection.hpp"
+#include <glaze/glaze.hpp>
+#include <glaze/rpc/repe/repe.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include <sys/socket.h>
+
+// Progress of a streaming request's socket I/O, for telling a stalled client from a handler
+// that is busy computing: `waiting` is set only while blocked on the socket.
+struct io_watch {
+   std::atomic<bool> waiting{false};
+   std::atomic<uint64_t> progress{0};
+};
+
+// Body of a streaming request, read from the socket as the handler asks for it instead of
+// being buffered first. Only one body_reader reads a connection at a time (its reader thread).
+class body_reader {
+public:
+   body_reader(client_connection& connection, uint64_t length, io_watch& watch)
+      : connection(connection), length(length), left(length), watch(watch) {}
+
+   body_reader(const body_reader&) = delete;
+   body_reader& operator=(const body_reader&) = delete;
+
+   uint64_t size() const { return length; }
+   uint64_t remaining() const { return left; }
+   bool failed() const { return broken; }
+
+   // Read up to `size` bytes of the body into `data`. Returns 0 at the end of the body or if
+   // the connection failed (see failed()).
+   size_t read(char* data, size_t size) {
+      if (left == 0 || broken || size == 0) {
+         return 0;
+      }
+      const size_t want = static_cast<size_t>(std::min<uint64_t>(left, size));
+      watch.waiting = true;
+      const ssize_t n = connection.receive(data, want);
+      watch.waiting = false;
+      if (n <= 0) {
+         broken = true;
+         return 0;
+      }
+      left -= static_cast<uint64_t>(n);
+      watch.progress.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+      return static_cast<size_t>(n);
+   }
+
+   // The whole (remaining) body, for handlers whose input is small
+   std::string read_all() {
+      std::string out(static_cast<size_t>(left), '\0');
+      size_t offset = 0;
+      while (offset < out.size()) {
+         const size_t n = read(out.data() + offset, out.size() - offset);
+         if (n == 0) {
+            break;
+         }
+         offset += n;
+      }
+      out.resize(offset);
+      return out;
+   }
+
+   // Discard what the handler did not read, so the next frame can be read. False if the
+   // connection failed.
+   bool drain() {
+      char scratch[64 * 1024];
+      while (left > 0 && read(scratch, sizeof(scratch)) > 0) {
+      }
+      return !broken;
+   }
+
+private:
+   client_connection& connection;
+   uint64_t length;
+   uint64_t left;
+   io_watch& watch;
+   bool broken = false;
+};
+
+// Response of a streaming request, written to the socket as the handler produces it. Either
+//  - begin(length, format) followed by write() calls adding up to exactly `length` bytes,
+//    which sends one ordinary frame (the connection is reserved for it until finished), or
+//  - write_chunk() calls, each sending a complete frame under the request's id with
+//    `more_chunks` set in the header's reserved field; finish() ends the sequence with a frame
+//    without the flag. Other responses may be interleaved between chunks.
+// Nothing is sent for notifications.
+class response_stream {
+public:
+   static constexpr uint32_t more_chunks = 1; // header.reserved flag: more frames follow under this id
+
+   response_stream(client_connection& connection, const glz::repe::message& request, io_watch& watch)
+      : connection(connection), id(request.header.id), query(request.query), notify(request.header.notify),
+        watch(watch) {}
+
+   response_stream(const response_stream&) = delete;
+   response_stream& operator=(const response_stream&) = delete;
+
+   ~response_stream() { finish(); }
+
+   bool started() const { return mode != state::idle; }
+
+   bool begin(uint64_t body_length, uint16_t body_format) {
+      if (notify) {
+         return true;
+      }
+      if (mode != state::idle) {
+         return false;
+      }
+      mode = state::fixed;
+      declared = body_length;
+      lock = std::unique_lock{connection.write_mutex};
+      auto header = make_header(body_length, body_format, glz::error_code::none, 0);
+      return guarded([&] { return connection.send_frame(header, query, {}); });
+   }
+
+   bool write(std::string_view bytes) {
+      if (notify) {
+         return true;
+      }
+      if (mode != state::fixed || written + bytes.size() > declared) {
+         return false;
+      }
+      written += bytes.size();
+      return guarded([&] { return connection.send_bytes(bytes); });
+   }
+
+   // Begin and write a whole body at once
+   bool send(std::string_view body, uint16_t body_format) { return begin(body.size(), body_format) && write(body); }
+
+   bool write_chunk(std::string_view bytes, uint16_t body_format) {
+      if (notify) {
+         return true;
+      }
+      if (mode == state::fixed || mode == state::done) {
+         return false;
+      }
+      mode = state::chunked;
+      chunk_format = body_format;
+      auto header = make_header(bytes.size(), body_format, glz::error_code::none, more_chunks);
+      std::lock_guard guard{connection.write_mutex};
+      return guarded([&] { return connection.send_frame(header, query, bytes); });
+   }
+
+   // Answer with an error. After a fixed-length body has started, the frame cannot be
+   // completed, so the connection is shut down instead.
+   void fail(glz::error_code ec, std::string_view text) {
+      if (notify || mode == state::done) {
+         return;
+      }
+      if (mode == state::fixed) {
+         abort();
+         return;
+      }
+      mode = state::done;
+      auto header = make_header(text.size(), 3, ec, 0); // UTF-8
+      std::lock_guard guard{connection.write_mutex};
+      guarded([&] { return connection.send_frame(header, query, text); });
+   }
+
+   // Complete the response: an empty body if nothing was sent, the final frame of a chunk
+   // sequence, or a check that a fixed-length body was fully written
+   void finish() {
+      if (notify || mode == state::done) {
+         return;
+      }
+      if (mode == state::fixed) {
+         if (written != declared) {
+            abort();
+            return;
+         }
+         mode = state::done;
+         lock.unlock();
+         return;
+      }
+      const uint16_t format = (mode == state::chunked) ? chunk_format : 0;
+      mode = state::done;
+      auto header = make_header(0, format, glz::error_code::none, 0);
+      std::lock_guard guard{connection.write_mutex};
+      guarded([&] { return connection.send_frame(header, query, {}); });
+   }
+
+private:
+   enum class state { idle, fixed, chunked, done };
+
+   client_connection& connection;
+   uint64_t id;
+   std::string query;
+   bool notify;
+   io_watch& watch;
+   state mode = state::idle;
+   std::unique_lock<std::mutex> lock{}; // held from begin() to finish() of a fixed-length body
+   uint64_t declared = 0;
+   uint64_t written = 0;
+   uint16_t chunk_format = 0;
+
+   glz::repe::header make_header(uint64_t body_length, uint16_t body_format, glz::error_code ec, uint32_t flags) {
+      glz::repe::header header{};
+      header.spec = 0x1507;
+      header.version = 1;
+      header.id = id;
+      header.reserved = flags;
+      header.ec = ec;
+      header.body_format = body_format;
+      header.query_length = query.size();
+      header.body_length = body_length;
+      header.length = sizeof(glz::repe::header) + header.query_length + header.body_length;
+      return header;
+   }
+
+   template <class Send>
+   bool guarded(Send&& send) {
+      const uint64_t before = connection.bytes_sent.load(std::memory_order_relaxed);
+      watch.waiting = true;
+      const bool ok = send();
+      watch.waiting = false;
+      watch.progress.fetch_add(connection.bytes_sent.load(std::memory_order_relaxed) - before,
+                               std::memory_order_relaxed);
+      return ok;
+   }
+
+   void abort() {
+      mode = state::done;
+      connection.shutdown();
+      if (lock.owns_lock()) {
+         lock.unlock();
+      }
+   }
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "cpu_placement.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Recycled receive buffers, so steady traffic reuses the same allocations instead of
+// allocating a fresh string per request. Buffers are grouped in power-of-two size classes
+// from 4 KiB to 1 MiB; smaller bodies are cheap to allocate and larger ones are rare, so
+// neither is pooled.
+//
+// Each thread keeps a few buffers of the smaller classes to itself, in front of the shared
+// per-class lists, so a thread that both acquires and releases buffers rarely takes a lock.
+// Buffers are plain strings, released by moving them back in when a request finishes;
+// a buffer that is never released is simply freed.
+//
+// With `nodes` > 1 the shared lists are kept per NUMA node (see cpu_placement.hpp): a buffer
+// goes back to the list of the node its memory is on, and a thread takes from its own node's,
+// so a pinned thread keeps reading into local memory. Only a buffer on the releasing thread's
+// node is kept in that thread's cache.
+class buffer_pool {
+public:
+   static constexpr size_t min_size = 4096;
+   static constexpr size_t classes = 9; // 4 KiB ... 1 MiB
+   static constexpr size_t max_size = min_size << (classes - 1);
+
+   struct stats {
+      uint64_t reused = 0;
+      uint64_t allocated = 0;
+      uint64_t pooled_bytes = 0; // in the shared lists
+   };
+
+   explicit buffer_pool(size_t max_per_class = 64, unsigned nodes = 1)
+      : max_per_class(max_per_class), lists(std::max(nodes, 1u)) {}
+
+   buffer_pool(const buffer_pool&) = delete;
+   buffer_pool& operator=(const buffer_pool&) = delete;
+
+   // A buffer of `size` bytes, with unspecified contents
+   std::string acquire(size_t size) {
+      std::string buffer;
+      if (size >= min_size && size <= max_size) {
+         const size_t c = class_for(size);
+         if (take(c, buffer)) {
+            reused.fetch_add(1, std::memory_order_relaxed);
+         }
+         else {
+            buffer.reserve(class_size(c)); // the full class, so it can serve any request of the class later
+            allocated.fetch_add(1, std::memory_order_relaxed);
+         }
+      }
+      buffer.resize(size);
+      return buffer;
+   }
+
+   void release(std::string buffer) {
+      const size_t capacity = buffer.capacity();
+      if (capacity < min_size || capacity > 2 * max_size) {
+         return;
+      }
+      // The largest class the buffer can serve in full
+      const size_t c = std::min<size_t>(std::bit_width(capacity / min_size) - 1, classes - 1);
+      buffer.clear();
+      const unsigned node = node_of(buffer);
+      auto& local = thread_cache()[c];
+      if (c < thread_cached_classes && local.size() < per_thread && node == thread_node()) {
+         local.emplace_back(std::move(buffer));
+         return;
+      }
+      auto& shared = lists[node][c];
+      std::lock_guard lock{shared.mutex};
+      if (shared.buffers.size() < max_per_class) {
+         shared.buffers.emplace_back(std::move(buffer));
+      }
+   }
+
+   stats snapshot() {
+      stats out{reused.load(std::memory_order_relaxed), allocated.load(std::memory_order_relaxed), 0};
+      for (auto& node : lists) {
+         for (size_t c = 0; c < classes; ++c) {
+            std::lock_guard lock{node[c].mutex};
+            out.pooled_bytes += node[c].buffers.size() * class_size(c);
+         }
+      }
+      return out;
+   }
+
+private:
+   static constexpr size_t per_thread = 4;
+   static constexpr size_t thread_cached_classes = 5; // up to 64 KiB
+
+   struct shared_list {
+      std::mutex mutex;
+      std::vector<std::string> buffers;
+   };
+
+   size_t max_per_class;
+   std::vector<std::array<shared_list, classes>> lists; // per NUMA node
+   std::atomic<uint64_t> reused{0};
+   std::atomic<uint64_t> allocated{0};
+
+   static constexpr size_t class_size(size_t c) { return min_size << c; }
+
+   // Smallest class that holds `size` bytes
+   static size_t class_for(size_t size) { return std::bit_width((size - 1) / min_size); }
+
+   static std::array<std::vector<std::string>, classes>& thread_cache() {
+      thread_local std::array<std::vector<std::string>, classes> cache;
+      return cache;
+   }
+
+   unsigned thread_node() const { return std::min<unsigned>(current_numa_node(), lists.size() - 1); }
+
+   // The node a buffer's memory is on; one system call, so only asked on NUMA machines
+   unsigned node_of(const std::string& buffer) const {
+      if (lists.size() == 1) {
+         return 0;
+      }
+      const int node = numa_node_of_address(buffer.data());
+      return node < 0 ? thread_node() : std::min<unsigned>(node, lists.size() - 1);
+   }
+
+   bool take(size_t c, std::string& buffer) {
+      auto& local = thread_cache()[c];
+      if (!local.empty()) {
+         buffer = std::move(local.back());
+         local.pop_back();
+         return true;
+      }
+      auto& shared = lists[thread_node()][c];
+      std::lock_guard lock{shared.mutex};
+      if (shared.buffers.empty()) {
+         return false;
+      }
+      buffer = std::move(shared.buffers.back());
+      shared.buffers.pop_back();
+      return true;
+   }
+};
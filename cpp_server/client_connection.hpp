@@ -0,0 +1,424 @@
+#pragma once
+
+#include "request_context.hpp"
+#include "shm_channel.hpp"
+#include <glaze/rpc/repe/repe.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Without MSG_NOSIGNAL (macOS) the server sets SO_NOSIGPIPE on each accepted socket instead
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// A frame queued for a socket. The body is reference counted so that one serialized
+// value can be written to many connections without copying it per connection.
+struct outbound_frame {
+   glz::repe::header header{};
+   std::string query{};
+   std::shared_ptr<const std::string> body{};
+   size_t offset = 0; // bytes of header + query + body already written
+
+   size_t size() const { return sizeof(glz::repe::header) + query.size() + (body ? body->size() : 0); }
+};
+
+// Who is on the other end of a connection: the address of a TCP peer, or for a Unix domain
+// socket the credentials of the connecting process as the kernel recorded them at connect
+// time, which the client can neither forge nor has to send
+struct peer_info {
+   std::string address{}; // IP address, or "uid:<uid>" for a local peer
+   bool local = false;    // connected over the Unix domain socket
+   uint32_t pid = 0;
+   uint32_t uid = 0;
+   uint32_t gid = 0;
+};
+
+// A connected client socket (or a client's shared-memory channel, which stands in for one),
+// shared by the thread reading requests from it and by anything else that writes to it
+// (responses from workers, subscription pushes). All writes happen under write_mutex, and the
+// socket is closed under it with `open` cleared, so a late response can never reach a
+// descriptor that has been reused. A non-blocking write may leave a frame half sent; it is
+// kept in `partial` and must be finished before any other frame touches the socket.
+class client_connection {
+public:
+   enum class send_status { done, would_block, closed };
+
+   const int fd;
+   const peer_info peer;
+   const std::shared_ptr<shm_channel> ring{}; // set instead of fd for a shared-memory connection
+   std::mutex write_mutex;
+   std::optional<outbound_frame> partial{};
+   std::atomic<bool> open{true};
+   std::atomic<uint64_t> bytes_sent{0}; // progress of writes, for detecting a client that stopped reading
+   std::atomic<uint64_t> writes_started{0}; // blocking frame writes begun, and whether one is under way,
+   std::atomic<bool> writing{false};        // for the same (both set under write_mutex)
+
+   explicit client_connection(int fd, peer_info peer = {}) : fd(fd), peer(std::move(peer)) {}
+
+   client_connection(std::shared_ptr<shm_channel> ring, peer_info peer)
+      : fd(-1), peer(std::move(peer)), ring(std::move(ring)) {}
+
+   // An in-process exchange (see repe_core.h): reads come from `input` and everything written
+   // is appended to `output`
+   client_connection(std::string_view input, std::string& output) : fd(-1), input(input), output(&output) {}
+
+   ~client_connection() {
+      if (passing >= 0) {
+         ::close(passing);
+      }
+   }
+
+   client_connection(const client_connection&) = delete;
+   client_connection& operator=(const client_connection&) = delete;
+
+   // Name set by the session method; scopes request id deduplication
+   std::string client_key() {
+      std::lock_guard lock{state_mutex};
+      return key;
+   }
+
+   void set_client_key(std::string name) {
+      std::lock_guard lock{state_mutex};
+      key = std::move(name);
+   }
+
+   // The shared-memory connection a client attached through this one. It ends with this
+   // connection, whose socket tells us when the client process goes away.
+   bool attach(const std::shared_ptr<client_connection>& channel) {
+      std::lock_guard lock{state_mutex};
+      if (!attached.expired()) {
+         return false;
+      }
+      attached = channel;
+      return true;
+   }
+
+   std::shared_ptr<client_connection> attached_channel() {
+      std::lock_guard lock{state_mutex};
+      return attached.lock();
+   }
+
+   // As recv(): from the socket, or from the channel's request ring (flags 0 or MSG_WAITALL)
+   ssize_t receive(void* data, size_t size, int flags = 0) {
+      if (output) {
+         const size_t n = std::min(size, input.size());
+         std::memcpy(data, input.data(), n);
+         input.remove_prefix(n);
+         return static_cast<ssize_t>(n);
+      }
+      if (ring) {
+         return static_cast<ssize_t>(ring->receive(static_cast<char*>(data), size, (flags & MSG_WAITALL) != 0));
+      }
+      return recv(fd, data, size, flags);
+   }
+
+   // As receive(), but a socket is first read without blocking, over and over, for up to the
+   // spin budget (--busy-poll); `slept` tells whether it then had to block. With SO_BUSY_POLL
+   // set on the socket each of those reads also polls the device queue, so a frame is picked
+   // up without waiting for its interrupt and the thread's wakeup.
+   ssize_t receive_polling(void* data, size_t size, spin_policy& spin, bool& slept) {
+      slept = false;
+      if (fd < 0 || spin.limit.count() <= 0) {
+         return receive(data, size);
+      }
+      const auto until = std::chrono::steady_clock::now() + spin.budget;
+      do {
+         const ssize_t n = recv(fd, data, size, MSG_DONTWAIT);
+         if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            spin.hit();
+            return n;
+         }
+         cpu_relax();
+      } while (std::chrono::steady_clock::now() < until);
+      spin.miss();
+      slept = true;
+      return recv(fd, data, size, 0);
+   }
+
+   // The shard running this connection's service methods in --shards mode (see shard_set.hpp)
+   size_t shard = 0;
+
+   // Reply format chosen by the hello method, for requests that do not name one
+   std::atomic<reply_format> preferred_reply{reply_format::request};
+
+   // Bound on requests read from this connection but not yet finished. The reader waits here
+   // once the bound is reached, leaving further requests unread in the socket buffers, so
+   // TCP flow control slows the client down. Returns false if the connection closed.
+   bool acquire_slot(size_t limit) {
+      std::unique_lock lock{state_mutex};
+      slot_freed.wait(lock, [&] { return outstanding < limit || !open; });
+      if (!open) {
+         return false;
+      }
+      ++outstanding;
+      return true;
+   }
+
+   // Requests read from this connection and not yet finished
+   size_t in_progress() {
+      std::lock_guard lock{state_mutex};
+      return outstanding;
+   }
+
+   void release_slot() {
+      {
+         std::lock_guard lock{state_mutex};
+         --outstanding;
+      }
+      slot_freed.notify_one();
+   }
+
+   // Requests read from this connection that have not finished, so they can be cancelled by id
+   void track(uint64_t id, const std::stop_source& source) {
+      std::lock_guard lock{state_mutex};
+      in_flight[id] = source;
+   }
+
+   void untrack(uint64_t id, const std::stop_source& source) {
+      std::lock_guard lock{state_mutex};
+      auto it = in_flight.find(id);
+      if (it != in_flight.end() && it->second == source) {
+         in_flight.erase(it);
+      }
+   }
+
+   bool cancel(uint64_t id) {
+      std::lock_guard lock{state_mutex};
+      auto it = in_flight.find(id);
+      if (it == in_flight.end()) {
+         return false;
+      }
+      it->second.request_stop();
+      in_flight.erase(it);
+      return true;
+   }
+
+   void cancel_all() {
+      std::lock_guard lock{state_mutex};
+      for (auto& [id, source] : in_flight) {
+         source.request_stop();
+      }
+      in_flight.clear();
+   }
+
+   // Blocking write of a complete frame. Caller must hold write_mutex.
+   bool send_frame(const glz::repe::header& header, std::string_view query, std::string_view body) {
+      return send_frame(header, query, {}, body);
+   }
+
+   // As above, with the body written in two pieces (e.g. a synthesized header byte followed
+   // by bytes that live elsewhere, such as a memory mapping)
+   bool send_frame(const glz::repe::header& header, std::string_view query, std::string_view body_prefix,
+                   std::string_view body) {
+      if (!open) {
+         return false; // closed while the response was being computed
+      }
+      if (partial && write_frame(*partial, 0) != send_status::done) {
+         return false;
+      }
+      partial.reset();
+
+      size_t offset = 0;
+      const size_t total = sizeof(header) + query.size() + body_prefix.size() + body.size();
+      while (offset < total) {
+         iovec iov[4];
+         const int count = fill_iov(iov, offset, header, query, body_prefix, body);
+         const ssize_t n = transmit(iov, count, 0);
+         if (n < 0) {
+            if (errno == EINTR) {
+               continue;
+            }
+            open = false;
+            return false;
+         }
+         offset += static_cast<size_t>(n);
+         bytes_sent.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+      }
+      return true;
+   }
+
+   // Blocking write of raw bytes, continuing a frame whose header was sent with a longer
+   // body_length than the bytes sent with it. Caller must hold write_mutex throughout.
+   bool send_bytes(std::string_view bytes) {
+      if (!open) {
+         return false;
+      }
+      size_t offset = 0;
+      while (offset < bytes.size()) {
+         iovec iov{const_cast<char*>(bytes.data() + offset), bytes.size() - offset};
+         const ssize_t n = transmit(&iov, 1, 0);
+         if (n < 0) {
+            if (errno == EINTR) {
+               continue;
+            }
+            open = false;
+            return false;
+         }
+         offset += static_cast<size_t>(n);
+         bytes_sent.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+      }
+      return true;
+   }
+
+   // Non-blocking write. Whatever does not fit in the socket buffer is kept in
+   // `partial`. Caller must hold write_mutex and must not call this while a partial
+   // frame is pending (use flush_partial first).
+   send_status try_send(outbound_frame frame) {
+      const auto status = write_frame(frame, MSG_DONTWAIT);
+      if (status == send_status::would_block) {
+         partial = std::move(frame);
+      }
+      return status;
+   }
+
+   // Non-blocking attempt to finish a half written frame. Caller must hold write_mutex.
+   send_status flush_partial() {
+      if (!partial) {
+         return send_status::done;
+      }
+      const auto status = write_frame(*partial, MSG_DONTWAIT);
+      if (status == send_status::done) {
+         partial.reset();
+      }
+      return status;
+   }
+
+   // Hand `descriptor` to the peer with the next bytes written to the socket (SCM_RIGHTS), then
+   // close our copy. Caller must hold write_mutex.
+   void pass_descriptor(int descriptor) {
+      if (passing >= 0) {
+         ::close(passing);
+      }
+      passing = descriptor;
+   }
+
+   void shutdown() {
+      {
+         std::lock_guard lock{state_mutex};
+         open = false;
+      }
+      slot_freed.notify_all();
+      if (ring) {
+         ring->close();
+      } else if (fd >= 0) {
+         ::shutdown(fd, SHUT_RDWR);
+      }
+   }
+
+private:
+   std::mutex state_mutex;
+   std::condition_variable slot_freed;
+   size_t outstanding = 0;
+   std::string key{};
+   std::unordered_map<uint64_t, std::stop_source> in_flight{};
+   std::weak_ptr<client_connection> attached{};
+   std::string_view input{};
+   std::string* output = nullptr;
+   int passing = -1; // descriptor waiting to go out with the next write (pass_descriptor)
+
+   // sendmsg() on the socket, or the same bytes copied into the channel's response ring (or
+   // appended to the in-process output), with the same results: bytes written, or -1 with
+   // errno EAGAIN (nothing fit, MSG_DONTWAIT) or EPIPE (closed)
+   ssize_t transmit(const iovec* iov, int count, int flags) {
+      if (output) {
+         size_t total = 0;
+         for (int i = 0; i < count; ++i) {
+            output->append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+            total += iov[i].iov_len;
+         }
+         return static_cast<ssize_t>(total);
+      }
+      if (!ring) {
+         msghdr msg{};
+         msg.msg_iov = const_cast<iovec*>(iov);
+         msg.msg_iovlen = count;
+         alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+         if (passing >= 0) {
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            cmsghdr* rights = CMSG_FIRSTHDR(&msg);
+            rights->cmsg_level = SOL_SOCKET;
+            rights->cmsg_type = SCM_RIGHTS;
+            rights->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(rights), &passing, sizeof(int));
+         }
+         const ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL | flags);
+         if (n > 0 && passing >= 0) {
+            ::close(std::exchange(passing, -1)); // the peer has its own copy now
+         }
+         return n;
+      }
+      size_t total = 0;
+      for (int i = 0; i < count; ++i) {
+         const std::string_view part{static_cast<const char*>(iov[i].iov_base), iov[i].iov_len};
+         const size_t n = (flags & MSG_DONTWAIT) ? ring->send_some(part) : ring->send(part) ? part.size() : 0;
+         total += n;
+         if (n < part.size()) {
+            break;
+         }
+      }
+      if (total == 0) {
+         errno = ring->closed() ? EPIPE : EAGAIN;
+         return -1;
+      }
+      return static_cast<ssize_t>(total);
+   }
+
+   static int fill_iov(iovec* iov, size_t offset, const glz::repe::header& header, std::string_view query,
+                       std::string_view body_prefix, std::string_view body) {
+      int count = 0;
+      const std::string_view parts[4] = {
+         {reinterpret_cast<const char*>(&header), sizeof(header)}, query, body_prefix, body};
+      for (const auto& part : parts) {
+         if (offset >= part.size()) {
+            offset -= part.size();
+            continue;
+         }
+         iov[count].iov_base = const_cast<char*>(part.data() + offset);
+         iov[count].iov_len = part.size() - offset;
+         offset = 0;
+         ++count;
+      }
+      return count;
+   }
+
+   send_status write_frame(outbound_frame& frame, int flags) {
+      const std::string_view body = frame.body ? std::string_view{*frame.body} : std::string_view{};
+      const size_t total = frame.size();
+      while (frame.offset < total) {
+         iovec iov[4];
+         const int count = fill_iov(iov, frame.offset, frame.header, frame.query, {}, body);
+         const ssize_t n = transmit(iov, count, flags);
+         if (n < 0) {
+            if (errno == EINTR) {
+               continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+               return send_status::would_block;
+            }
+            open = false;
+            return send_status::closed;
+         }
+         frame.offset += static_cast<size_t>(n);
+         bytes_sent.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+      }
+      return send_status::done;
+   }
+};
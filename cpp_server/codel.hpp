@@ -0,0 +1,42 @@
+#pragma once
+
+#include <chrono>
+
+// CoDel-style ("Controlling Queue Delay", RFC 8289) load shedding for a request queue.
+// Each dequeue reports how long the request waited. If the shortest wait over the last
+// `interval` exceeded `target`, the queue never drained in that interval: it is standing,
+// not absorbing a burst. While that holds, requests that waited more than twice the target
+// are shed, which bounds queueing delay for the ones that run instead of letting it grow
+// until clients time out. Unlike packet CoDel, which drops gradually because TCP senders
+// back off, RPC clients keep sending, so shedding is immediate once overloaded.
+//
+// Not thread safe: call under the queue's lock.
+class codel {
+public:
+   using clock = std::chrono::steady_clock;
+
+   explicit codel(clock::duration target = std::chrono::milliseconds(5),
+                  clock::duration interval = std::chrono::milliseconds(100))
+      : target(target), interval(interval) {}
+
+   bool should_drop(clock::duration sojourn, clock::time_point now) {
+      if (now >= interval_end) {
+         overloaded = interval_end != clock::time_point{} && min_sojourn > target;
+         min_sojourn = clock::duration::max();
+         interval_end = now + interval;
+      }
+      if (sojourn < min_sojourn) {
+         min_sojourn = sojourn;
+      }
+      return overloaded && sojourn > 2 * target;
+   }
+
+   bool is_overloaded() const { return overloaded; }
+
+private:
+   clock::duration target;
+   clock::duration interval;
+   clock::time_point interval_end{};
+   clock::duration min_sojourn = clock::duration::max();
+   bool overloaded = false;
+};
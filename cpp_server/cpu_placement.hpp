@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Thread placement for latency-critical deployments: pin threads to listed cores, and keep the
+// memory each pinned thread touches on its core's NUMA node, so requests are not slowed by
+// migrations, cold caches or remote memory. Linux only; elsewhere pinning fails and is
+// reported as such, and every thread counts as node 0.
+//
+// No libnuma: the node of a core comes from sysfs, and the memory policy is set with the
+// set_mempolicy system call directly.
+
+// Parse a cpu list in the kernel's format ("0-3,8,10-11") into `cpus`, in the order given
+inline bool parse_cpu_list(std::string_view text, std::vector<unsigned>& cpus) {
+   cpus.clear();
+   while (!text.empty()) {
+      const auto comma = text.find(',');
+      const auto item = text.substr(0, comma);
+      text = comma == std::string_view::npos ? std::string_view{} : text.substr(comma + 1);
+      const auto dash = item.find('-');
+      unsigned first = 0, last = 0;
+      const auto low = item.substr(0, dash);
+      const auto high = dash == std::string_view::npos ? low : item.substr(dash + 1);
+      if (std::from_chars(low.data(), low.data() + low.size(), first).ptr != low.data() + low.size() ||
+          std::from_chars(high.data(), high.data() + high.size(), last).ptr != high.data() + high.size() ||
+          low.empty() || high.empty() || last < first) {
+         return false;
+      }
+      for (unsigned cpu = first; cpu <= last; ++cpu) {
+         cpus.push_back(cpu);
+      }
+   }
+   return !cpus.empty();
+}
+
+// NUMA nodes the machine may have (1 without NUMA)
+inline unsigned numa_nodes() {
+   std::ifstream possible{"/sys/devices/system/node/possible"};
+   std::string text;
+   std::vector<unsigned> nodes;
+   if (std::getline(possible, text) && parse_cpu_list(text, nodes)) {
+      return nodes.back() + 1;
+   }
+   return 1;
+}
+
+// The NUMA node of `cpu`, from its nodeN entry in sysfs (0 if there is none)
+inline unsigned numa_node_of_cpu(unsigned cpu) {
+   std::error_code ec;
+   const std::filesystem::path dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+   for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+      const auto name = entry.path().filename().string();
+      unsigned node = 0;
+      if (name.starts_with("node") &&
+          std::from_chars(name.data() + 4, name.data() + name.size(), node).ptr == name.data() + name.size()) {
+         return node;
+      }
+   }
+   return 0;
+}
+
+// The node of the calling thread, as set when it was pinned (0 for threads that were not)
+inline unsigned& current_numa_node() {
+   thread_local unsigned node = 0;
+   return node;
+}
+
+// The node holding the page at `address`, or -1 if it is unknown (not yet touched, or not Linux)
+inline int numa_node_of_address(const void* address) {
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+   constexpr unsigned long mpol_f_node = 1, mpol_f_addr = 2;
+   int node = -1;
+   if (syscall(SYS_get_mempolicy, &node, nullptr, 0UL, address, mpol_f_node | mpol_f_addr) == 0) {
+      return node;
+   }
+#else
+   (void)address;
+#endif
+   return -1;
+}
+
+// Pin the calling thread to `cpu`. With `local_memory`, pages it touches first come from the
+// cpu's node from now on (MPOL_LOCAL), even if the process was started under an interleave
+// policy (numactl --interleave).
+inline bool pin_current_thread(unsigned cpu, bool local_memory) {
+#if defined(__linux__)
+   if (cpu >= CPU_SETSIZE) {
+      return false;
+   }
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   CPU_SET(cpu, &set);
+   if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+      return false;
+   }
+   current_numa_node() = numa_node_of_cpu(cpu);
+#if defined(SYS_set_mempolicy)
+   constexpr int mpol_local = 4;
+   if (local_memory && syscall(SYS_set_mempolicy, mpol_local, nullptr, 0UL) != 0) {
+      return false;
+   }
+#else
+   (void)local_memory;
+#endif
+   return true;
+#else
+   (void)cpu;
+   (void)local_memory;
+   return false;
+#endif
+}
+
+// A list of cores handed out round-robin to threads as they start. An empty plan leaves
+// threads where the scheduler puts them.
+class cpu_plan {
+public:
+   cpu_plan() = default;
+   cpu_plan(std::vector<unsigned> cpus, bool local_memory) : cpus(std::move(cpus)), local_memory(local_memory) {}
+
+   cpu_plan(const cpu_plan&) = delete;
+   cpu_plan& operator=(const cpu_plan&) = delete;
+
+   bool empty() const { return cpus.empty(); }
+
+   // Pin the calling thread to the plan's next core
+   void pin_next() {
+      if (cpus.empty()) {
+         return;
+      }
+      const unsigned cpu = cpus[next.fetch_add(1, std::memory_order_relaxed) % cpus.size()];
+      (pin_current_thread(cpu, local_memory) ? pinned : failed).fetch_add(1, std::memory_order_relaxed);
+   }
+
+   uint64_t pinned_threads() const { return pinned.load(std::memory_order_relaxed); }
+   uint64_t failures() const { return failed.load(std::memory_order_relaxed); }
+
+private:
+   std::vector<unsigned> cpus{};
+   bool local_memory = false;
+   std::atomic<size_t> next{0};
+   std::atomic<uint64_t> pinned{0};
+   std::atomic<uint64_t> failed{0};
+};
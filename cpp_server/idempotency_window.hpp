@@ -0,0 +1,110 @@
+#pragma once
+
+#include "response_cache.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+// Recently answered request ids and their serialized responses, so that a retransmitted
+// request (same id, same query and body) is answered again instead of being run twice.
+// Ids are scoped: by default to the connection, or to a client key shared by every
+// connection of one client, so retries survive a reconnect. Entries are kept for `ttl`
+// and each scope keeps at most `max_per_scope` of them.
+class idempotency_window {
+public:
+   using clock = std::chrono::steady_clock;
+
+   struct stats {
+      uint64_t replayed = 0;
+      uint64_t entries = 0;
+   };
+
+   explicit idempotency_window(clock::duration ttl, size_t max_per_scope = 4096)
+      : ttl(ttl), max_per_scope(max_per_scope) {}
+
+   // Fingerprint of what a request asks for, to tell a retransmit from an id reused for something else
+   static uint64_t fingerprint(std::string_view query, std::string_view body) {
+      const uint64_t h = std::hash<std::string_view>{}(query);
+      return h ^ (std::hash<std::string_view>{}(body) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2));
+   }
+
+   std::optional<serialized_response> find(const std::string& scope, uint64_t id, uint64_t print) {
+      std::lock_guard lock{mutex};
+      auto s = scopes.find(scope);
+      if (s == scopes.end()) {
+         return std::nullopt;
+      }
+      auto e = s->second.responses.find(id);
+      if (e == s->second.responses.end() || e->second.fingerprint != print || e->second.expires <= clock::now()) {
+         return std::nullopt;
+      }
+      replayed.fetch_add(1, std::memory_order_relaxed);
+      return e->second.response;
+   }
+
+   void store(const std::string& scope, uint64_t id, uint64_t print, serialized_response response) {
+      std::lock_guard lock{mutex};
+      auto& s = scopes[scope];
+      const auto now = clock::now();
+      const uint64_t sequence = ++s.stored;
+      s.responses[id] = entry{print, std::move(response), now + ttl, sequence};
+      s.order.emplace_back(id, sequence);
+
+      // Expire from the oldest end, skipping ids that were stored again since
+      while (!s.order.empty()) {
+         const auto [oldest_id, oldest_sequence] = s.order.front();
+         auto oldest = s.responses.find(oldest_id);
+         if (oldest != s.responses.end() && oldest->second.sequence == oldest_sequence) {
+            if (oldest->second.expires > now && s.responses.size() <= max_per_scope) {
+               break;
+            }
+            s.responses.erase(oldest);
+         }
+         s.order.pop_front();
+      }
+   }
+
+   // Forget a scope whose ids can no longer be retransmitted (a closed connection)
+   void drop_scope(const std::string& scope) {
+      std::lock_guard lock{mutex};
+      scopes.erase(scope);
+   }
+
+   stats snapshot() {
+      std::lock_guard lock{mutex};
+      stats out{};
+      out.replayed = replayed.load(std::memory_order_relaxed);
+      for (const auto& [name, s] : scopes) {
+         out.entries += s.responses.size();
+      }
+      return out;
+   }
+
+private:
+   struct entry {
+      uint64_t fingerprint = 0;
+      serialized_response response{};
+      clock::time_point expires{};
+      uint64_t sequence = 0;
+   };
+
+   struct scope_entries {
+      std::unordered_map<uint64_t, entry> responses;
+      std::deque<std::pair<uint64_t, uint64_t>> order; // (id, sequence) in insertion order
+      uint64_t stored = 0;
+   };
+
+   clock::duration ttl;
+   size_t max_per_scope;
+   std::mutex mutex;
+   std::unordered_map<std::string, scope_entries> scopes;
+   std::atomic<uint64_t> replayed{0};
+};
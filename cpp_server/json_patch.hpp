@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Custom body formats (above BODY_CUSTOM_BASE = 4096) whose bodies are JSON patches.
+// REPE.jl mirrors these as BODY_MERGE_PATCH and BODY_JSON_PATCH.
+inline constexpr uint16_t body_format_merge_patch = 4097; // RFC 7386 JSON Merge Patch
+inline constexpr uint16_t body_format_json_patch = 4098;  // RFC 6902 JSON Patch
+
+inline bool is_json_space(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+inline bool is_json_object(std::string_view json) {
+   for (char c : json) {
+      if (!is_json_space(c)) {
+         return c == '{';
+      }
+   }
+   return false;
+}
+
+inline void append_json_string(std::string& out, std::string_view str) {
+   static constexpr char hex[] = "0123456789abcdef";
+   out.push_back('"');
+   for (char c : str) {
+      if (c == '"' || c == '\\') {
+         out.push_back('\\');
+         out.push_back(c);
+      }
+      else if (static_cast<unsigned char>(c) < 0x20) {
+         out.append("\\u00");
+         out.push_back(hex[(c >> 4) & 0xF]);
+         out.push_back(hex[c & 0xF]);
+      }
+      else {
+         out.push_back(c);
+      }
+   }
+   out.push_back('"');
+}
+
+// Append `segment` to a JSON pointer, escaping it as RFC 6901 requires ('~' -> ~0, '/' -> ~1)
+inline void append_pointer_segment(std::string& pointer, std::string_view segment) {
+   for (char c : segment) {
+      if (c == '~') {
+         pointer.append("~0");
+      }
+      else if (c == '/') {
+         pointer.append("~1");
+      }
+      else {
+         pointer.push_back(c);
+      }
+   }
+}
+
+// Split a normalized JSON pointer ("/a/b", or "" for the root) into unescaped segments
+inline std::vector<std::string> pointer_segments(std::string_view pointer) {
+   std::vector<std::string> segments;
+   while (!pointer.empty()) {
+      pointer.remove_prefix(1); // leading '/'
+      const auto end = pointer.find('/');
+      const auto raw = pointer.substr(0, end);
+      pointer = (end == std::string_view::npos) ? std::string_view{} : pointer.substr(end);
+
+      auto& segment = segments.emplace_back();
+      for (size_t i = 0; i < raw.size(); ++i) {
+         if (raw[i] == '~' && i + 1 < raw.size()) {
+            segment.push_back(raw[i + 1] == '1' ? '/' : '~');
+            ++i;
+         }
+         else {
+            segment.push_back(raw[i]);
+         }
+      }
+   }
+   return segments;
+}
+
+// Scanning helpers over raw JSON text. `i` is advanced past what was scanned; nothing is decoded.
+inline void skip_json_space(std::string_view json, size_t& i) {
+   while (i < json.size() && is_json_space(json[i])) {
+      ++i;
+   }
+}
+
+// `i` is at the opening quote; returns the contents between the quotes, still escaped
+inline std::string_view skip_json_string(std::string_view json, size_t& i) {
+   const size_t start = ++i;
+   while (i < json.size() && json[i] != '"') {
+      i += (json[i] == '\\') ? 2 : 1;
+   }
+   const auto contents = json.substr(start, std::min(i, json.size()) - start);
+   ++i;
+   return contents;
+}
+
+// Returns the raw text of the value starting at `i`, without trailing whitespace
+inline std::string_view skip_json_value(std::string_view json, size_t& i) {
+   const size_t start = i;
+   int depth = 0;
+   while (i < json.size()) {
+      const char c = json[i];
+      if (c == '"') {
+         skip_json_string(json, i);
+         if (depth == 0) {
+            break;
+         }
+         continue;
+      }
+      if (c == '{' || c == '[') {
+         ++depth;
+      }
+      else if (c == '}' || c == ']') {
+         if (depth == 0) {
+            break;
+         }
+         if (--depth == 0) {
+            ++i;
+            break;
+         }
+      }
+      else if (c == ',' && depth == 0) {
+         break;
+      }
+      ++i;
+   }
+   auto value = json.substr(start, std::min(i, json.size()) - start);
+   while (!value.empty() && is_json_space(value.back())) {
+      value.remove_suffix(1);
+   }
+   return value;
+}
+
+// Returns the raw JSON of `key` in a JSON object, or an empty view if the key is absent
+// or `json` is not an object. Only the top level of `json` is scanned.
+inline std::string_view find_json_member(std::string_view json, std::string_view key) {
+   size_t i = 0;
+   skip_json_space(json, i);
+   if (i >= json.size() || json[i] != '{') {
+      return {};
+   }
+   ++i;
+   while (true) {
+      skip_json_space(json, i);
+      if (i >= json.size() || json[i] != '"') {
+         return {};
+      }
+      // Keys are compared in their escaped form; reflected member names never need escapes
+      const auto name = skip_json_string(json, i);
+      skip_json_space(json, i);
+      if (i >= json.size() || json[i] != ':') {
+         return {};
+      }
+      ++i;
+      skip_json_space(json, i);
+      const auto value = skip_json_value(json, i);
+      if (name == key) {
+         return value;
+      }
+      skip_json_space(json, i);
+      if (i >= json.size() || json[i] != ',') {
+         return {};
+      }
+      ++i;
+   }
+}
+
+// Returns the raw JSON of element `index` of a JSON array, or an empty view if out of range
+inline std::string_view find_json_element(std::string_view json, size_t index) {
+   size_t i = 0;
+   skip_json_space(json, i);
+   if (i >= json.size() || json[i] != '[') {
+      return {};
+   }
+   ++i;
+   for (size_t n = 0;; ++n) {
+      skip_json_space(json, i);
+      if (i >= json.size() || json[i] == ']') {
+         return {};
+      }
+      const auto value = skip_json_value(json, i);
+      if (n == index) {
+         return value;
+      }
+      skip_json_space(json, i);
+      if (i >= json.size() || json[i] != ',') {
+         return {};
+      }
+      ++i;
+   }
+}
+
+// Resolve a normalized JSON pointer against raw JSON, returning the addressed text or an empty view
+inline std::string_view find_json_pointer(std::string_view json, std::string_view pointer) {
+   for (const auto& segment : pointer_segments(pointer)) {
+      size_t i = 0;
+      skip_json_space(json, i);
+      if (i < json.size() && json[i] == '[') {
+         size_t index{};
+         const auto [ptr, ec] = std::from_chars(segment.data(), segment.data() + segment.size(), index);
+         if (ec != std::errc{} || ptr != segment.data() + segment.size()) {
+            return {};
+         }
+         json = find_json_element(json, index);
+      }
+      else {
+         json = find_json_member(json, segment);
+      }
+      if (json.empty()) {
+         return {};
+      }
+   }
+   return json;
+}
+
+enum class delta_kind { unchanged, patch, full };
+
+struct relative_delta {
+   delta_kind kind = delta_kind::full;
+   std::string patch{};
+};
+
+// Re-express a merge patch applied at `written` as a merge patch relative to `subscribed`.
+// Both pointers must be normalized. A subscriber above the write gets the patch wrapped in
+// the intervening keys, a subscriber below it gets the matching part of the patch, and a
+// subscriber whose value the patch does not touch gets `unchanged`.
+inline relative_delta rebase_merge_patch(std::string_view written, std::string_view subscribed,
+                                         std::string_view patch) {
+   relative_delta delta{};
+   const auto written_segments = pointer_segments(written);
+   const auto subscribed_segments = pointer_segments(subscribed);
+
+   if (subscribed_segments.size() <= written_segments.size()) {
+      // The subscription is at or above the write: wrap the patch in the keys between them
+      std::string wrapped(patch);
+      for (size_t i = written_segments.size(); i > subscribed_segments.size(); --i) {
+         std::string outer = "{";
+         append_json_string(outer, written_segments[i - 1]);
+         outer.push_back(':');
+         outer.append(wrapped);
+         outer.push_back('}');
+         wrapped = std::move(outer);
+      }
+      delta.kind = delta_kind::patch;
+      delta.patch = std::move(wrapped);
+      return delta;
+   }
+
+   // The subscription is below the write: descend into the patch
+   std::string_view current = patch;
+   for (size_t i = written_segments.size(); i < subscribed_segments.size(); ++i) {
+      if (!is_json_object(current)) {
+         return delta; // the subtree was replaced wholesale
+      }
+      current = find_json_member(current, subscribed_segments[i]);
+      if (current.empty()) {
+         delta.kind = delta_kind::unchanged;
+         return delta;
+      }
+   }
+   delta.kind = delta_kind::patch;
+   delta.patch = std::string(current);
+   return delta;
+}
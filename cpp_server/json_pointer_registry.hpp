@@ -0,0 +1,673 @@
+#pragma once
+
+#include <glaze/glaze.hpp>
+#include <glaze/rpc/repe/repe.hpp>
+#include <glaze/beve.hpp>
+#include "json_patch.hpp"
+#include "rcu.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Shared mutex that lets a waiting writer go first. glibc's rwlock prefers readers, so
+// a steady stream of reads could keep a writer waiting forever. Here new readers wait
+// while a writer is pending, which means a writer only waits for reads already running.
+class writer_priority_mutex {
+private:
+   std::shared_mutex mutex;
+   std::atomic<uint32_t> writers_waiting{0};
+
+public:
+   void lock() {
+      writers_waiting.fetch_add(1, std::memory_order_acq_rel);
+      mutex.lock();
+      writers_waiting.fetch_sub(1, std::memory_order_acq_rel);
+      writers_waiting.notify_all();
+   }
+
+   void unlock() { mutex.unlock(); }
+
+   void lock_shared() {
+      for (uint32_t waiting = writers_waiting.load(std::memory_order_acquire); waiting != 0;
+           waiting = writers_waiting.load(std::memory_order_acquire)) {
+         writers_waiting.wait(waiting, std::memory_order_acquire);
+      }
+      mutex.lock_shared();
+   }
+
+   void unlock_shared() { mutex.unlock_shared(); }
+};
+
+template <class T>
+struct is_std_function : std::false_type {};
+
+template <class R, class... Args>
+struct is_std_function<std::function<R(Args...)>> : std::true_type {};
+
+// True when T is a std::function or an rcu_cell, or a reflected object that holds one. Such
+// nodes cannot be serialized as a whole, so only their children are readable/writable.
+template <class T>
+constexpr bool contains_function() {
+   if constexpr (is_std_function<T>::value || is_rcu_cell<T>::value) {
+      return true;
+   }
+   else if constexpr (glz::reflectable<T>) {
+      using tie_t = decltype(glz::to_tie(std::declval<T&>()));
+      return []<size_t... I>(std::index_sequence<I...>) {
+         return (contains_function<std::decay_t<decltype(glz::get<I>(std::declval<tie_t&>()))>>() || ...);
+      }(std::make_index_sequence<glz::reflect<T>::size>{});
+   }
+   else {
+      return false;
+   }
+}
+
+// One RFC 6902 operation. `value` keeps its raw JSON so it can be handed to the target member.
+struct json_patch_op {
+   std::string op{};
+   std::string path{};
+   std::string from{};
+   glz::raw_json value{};
+};
+
+// Serves a reflected object tree through JSON pointer queries, following the Glaze REPE
+// registry semantics (and REPE.jl's Registry):
+// - empty body: read the value at the pointer
+// - body on a std::function member: call it with the body as its argument
+// - any other body: write the value at the pointer
+//
+// Every reflected member path is compiled into a trie when the registry is built, so a
+// request only walks string segments. Each top-level member owns a writer-priority
+// lock: traffic on /config never contends with /stats, and a write to a subtree only
+// waits on the reads of that subtree that are already in progress.
+//
+// Bodies in the merge patch / JSON Patch formats (json_patch.hpp) update members in place:
+// the patch is split along the trie and each touched member parses only its own slice, so
+// changing one field of a large config never re-parses or rebuilds the rest. A patch holds
+// the locks of every subtree it touches and is rolled back if any part of it fails.
+//
+// Functions run without any registry lock held; they synchronize their own state.
+//
+// A top-level rcu_cell member (rcu.hpp) is read without any lock: reads serialize its
+// current snapshot under a pinned epoch. Writes and patches edit a draft under the subtree's
+// writer lock, and the draft is published as one new snapshot when they succeed, so readers
+// see a patch entirely or not at all.
+template <class Root>
+class json_pointer_registry {
+private:
+   static constexpr uint32_t no_subtree = ~uint32_t(0);
+
+   struct string_hash {
+      using is_transparent = void;
+      size_t operator()(std::string_view key) const { return std::hash<std::string_view>{}(key); }
+   };
+
+   struct node {
+      std::string pointer{}; // canonical JSON pointer of this node ("" for the root), as on_write reports it
+      std::unordered_map<std::string, uint32_t, string_hash, std::equal_to<>> children{};
+      std::function<glz::error_ctx(std::string&, uint16_t)> read{};
+      std::function<glz::error_ctx(std::string_view, uint16_t)> write{};
+      std::function<void(const glz::repe::message&, glz::repe::message&, uint16_t)> invoke{};
+      uint32_t subtree = no_subtree;
+   };
+
+   std::vector<node> nodes{};
+   std::vector<std::unique_ptr<writer_priority_mutex>> subtree_locks{};
+   // For an rcu_cell subtree, publishes (true) or discards (false) the draft of a write
+   std::vector<std::function<void(bool)>> subtree_commits{};
+   std::atomic<uint64_t> writes{0}; // sequence of successful writes, advanced under their locks
+
+public:
+   // Called after every successful write, outside any lock, with the canonical JSON pointer that
+   // was written (whatever spelling the request used), the body that was applied there (a JSON
+   // value, a merge patch, or BEVE) and the write's sequence number. Calls for concurrent writes
+   // can arrive out of order; the sequence tells which write committed last.
+   std::function<void(std::string_view path, std::string_view body, uint16_t format, uint64_t sequence)> on_write{};
+
+   explicit json_pointer_registry(Root& root) {
+      nodes.emplace_back();
+      build(root, 0, no_subtree);
+   }
+
+   json_pointer_registry(const json_pointer_registry&) = delete;
+   json_pointer_registry& operator=(const json_pointer_registry&) = delete;
+
+   // Returns the trie node for a JSON pointer, or nullptr if no member has that path.
+   // Query parameters (`?...`) are ignored.
+   const node* find(std::string_view pointer) const {
+      pointer = pointer.substr(0, pointer.find('?'));
+      uint32_t index = 0;
+      std::string unescaped;
+      while (!pointer.empty()) {
+         if (pointer.front() == '/') {
+            pointer.remove_prefix(1);
+         }
+         const auto end = pointer.find('/');
+         std::string_view segment = pointer.substr(0, end);
+         pointer = (end == std::string_view::npos) ? std::string_view{} : pointer.substr(end);
+
+         // RFC 6901 escapes: ~1 -> '/', ~0 -> '~'
+         if (segment.find('~') != std::string_view::npos) {
+            unescaped.clear();
+            for (size_t i = 0; i < segment.size(); ++i) {
+               if (segment[i] == '~' && i + 1 < segment.size()) {
+                  unescaped.push_back(segment[i + 1] == '1' ? '/' : '~');
+                  ++i;
+               }
+               else {
+                  unescaped.push_back(segment[i]);
+               }
+            }
+            segment = unescaped;
+         }
+
+         const auto& children = nodes[index].children;
+         auto it = children.find(segment);
+         if (it == children.end()) {
+            return nullptr;
+         }
+         index = it->second;
+      }
+      return &nodes[index];
+   }
+
+   bool contains(std::string_view pointer) const { return find(pointer) != nullptr; }
+
+   // Sequence number of the latest write. A value read before this call includes no write
+   // numbered above it.
+   uint64_t write_sequence() const { return writes.load(std::memory_order_acquire); }
+
+   // Serialize the value at a JSON pointer under its subtree's read lock
+   glz::error_ctx read(std::string_view pointer, uint16_t format, std::string& out) {
+      glz::error_ctx ec{};
+      const node* target = find(pointer);
+      if (!target || !target->read) {
+         ec.ec = glz::error_code::invalid_query;
+         return ec;
+      }
+      with_shared_lock(*target, [&] { ec = target->read(out, format); });
+      return ec;
+   }
+
+   // Process a registry request, filling in the response body, body format and error code.
+   // Values read and function results are encoded in `reply` (BEVE or JSON; 0 answers in the
+   // request's format).
+   void call(const glz::repe::message& request, glz::repe::message& response, uint16_t reply = 0) {
+      const node* target = find(request.query);
+      if (!target) {
+         set_error(response, glz::error_code::method_not_found, "Method not found: " + request.query);
+         return;
+      }
+
+      const uint16_t format = request.header.body_format;
+      if (reply != 1 && reply != 2) {
+         reply = (format == 1) ? 1 : 2; // BEVE or JSON
+      }
+
+      if (target->invoke) {
+         target->invoke(request, response, reply);
+         return;
+      }
+
+      if (format == body_format_merge_patch || format == body_format_json_patch) {
+         apply_patch(*target, request, response);
+         return;
+      }
+      if (format != 1 && format != 2) {
+         set_error(response, glz::error_code::invalid_body, "Registry requires BEVE or JSON body format");
+         return;
+      }
+
+      if (request.body.empty()) {
+         if (!target->read) {
+            set_error(response, glz::error_code::invalid_query, "Path is not readable: " + request.query);
+            return;
+         }
+         glz::error_ctx ec{};
+         with_shared_lock(*target, [&] { ec = target->read(response.body, reply); });
+         if (ec) {
+            set_error(response, ec.ec, "Failed to serialize: " + request.query);
+            return;
+         }
+         response.header.body_format = reply;
+      }
+      else {
+         if (!target->write) {
+            set_error(response, glz::error_code::invalid_query, "Path is not writable: " + request.query);
+            return;
+         }
+         glz::error_ctx ec{};
+         uint64_t sequence = 0;
+         with_unique_locks({target->subtree}, [&] {
+            ec = target->write(request.body, format);
+            if (!ec) {
+               sequence = writes.fetch_add(1, std::memory_order_acq_rel) + 1;
+            }
+            return !ec;
+         });
+         if (ec) {
+            set_error(response, glz::error_code::parse_error, "Invalid value for " + request.query);
+            return;
+         }
+         // Writes answer with an empty body, as in the Glaze registry
+         response.body.clear();
+         response.header.body_format = format;
+         if (on_write) {
+            on_write(target->pointer, request.body, format, sequence);
+         }
+      }
+   }
+
+private:
+   template <class F>
+   void with_shared_lock(const node& target, F&& func) {
+      rcu_guard pinned; // what rcu_cell subtrees need instead of a lock
+      if (target.subtree != no_subtree) {
+         if (subtree_commits[target.subtree]) {
+            func();
+            return;
+         }
+         std::shared_lock lock{*subtree_locks[target.subtree]};
+         func();
+         return;
+      }
+      // The root spans every subtree; take them in index order to avoid deadlock
+      for (size_t i = 0; i < subtree_locks.size(); ++i) {
+         if (!subtree_commits[i]) {
+            subtree_locks[i]->lock_shared();
+         }
+      }
+      func();
+      for (size_t i = subtree_locks.size(); i-- > 0;) {
+         if (!subtree_commits[i]) {
+            subtree_locks[i]->unlock_shared();
+         }
+      }
+   }
+
+   // Exclusively lock a set of subtrees (no_subtree meaning all of them), always in index order.
+   // rcu_cell subtrees publish what `func` drafted, unless it returns false.
+   template <class F>
+   void with_unique_locks(std::vector<uint32_t> subtrees, F&& func) {
+      if (std::find(subtrees.begin(), subtrees.end(), no_subtree) != subtrees.end()) {
+         subtrees.resize(subtree_locks.size());
+         std::iota(subtrees.begin(), subtrees.end(), 0);
+      }
+      else {
+         std::sort(subtrees.begin(), subtrees.end());
+         subtrees.erase(std::unique(subtrees.begin(), subtrees.end()), subtrees.end());
+      }
+      for (auto subtree : subtrees) {
+         subtree_locks[subtree]->lock();
+      }
+      bool succeeded = true;
+      if constexpr (std::is_same_v<std::invoke_result_t<F&>, bool>) {
+         succeeded = func();
+      }
+      else {
+         func();
+      }
+      for (auto subtree : subtrees) {
+         if (subtree_commits[subtree]) {
+            subtree_commits[subtree](succeeded);
+         }
+      }
+      for (auto it = subtrees.rbegin(); it != subtrees.rend(); ++it) {
+         subtree_locks[*it]->unlock();
+      }
+   }
+
+   static void set_error(glz::repe::message& response, glz::error_code ec, std::string message) {
+      response.header.ec = ec;
+      response.body = std::move(message);
+      response.header.body_format = 3; // UTF-8
+   }
+
+   // RFC 6902 `test` compares values rather than text: numbers by value, objects regardless of
+   // member order, strings after unescaping. Both sides are parsed into glz::generic and written
+   // back out, which sorts object keys and gives every value one spelling.
+   static bool json_values_equal(std::string_view a, std::string_view b) {
+      glz::generic left{}, right{};
+      if (glz::read_json(left, a) || glz::read_json(right, b)) {
+         return false;
+      }
+      std::string left_json, right_json;
+      if (glz::write_json(left, left_json) || glz::write_json(right, right_json)) {
+         return false;
+      }
+      return left_json == right_json;
+   }
+
+   // Previous JSON of each member a patch wrote, so a failed patch can be undone
+   using undo_log = std::vector<std::pair<const node*, std::string>>;
+
+   static glz::error_ctx logged_write(const node& target, std::string_view json, undo_log& undo) {
+      if (!target.write) {
+         glz::error_ctx ec{};
+         ec.ec = glz::error_code::invalid_query;
+         return ec;
+      }
+      if (target.read) {
+         auto& [member, previous] = undo.emplace_back(&target, std::string{});
+         if (target.read(previous, 2)) {
+            undo.pop_back();
+         }
+      }
+      return target.write(json, 2);
+   }
+
+   static void rollback(undo_log& undo) {
+      for (auto it = undo.rbegin(); it != undo.rend(); ++it) {
+         it->first->write(it->second, 2);
+      }
+      undo.clear();
+   }
+
+   // RFC 7386: objects recurse into reflected members, anything else replaces the member.
+   // Reflected members cannot be deleted, so `null` is written as a value (resetting optionals).
+   glz::error_ctx merge_patch(const node& target, std::string_view patch, undo_log& undo) {
+      if (target.children.empty() || !is_json_object(patch)) {
+         return logged_write(target, patch, undo);
+      }
+      std::map<std::string, glz::raw_json> members{};
+      if (auto ec = glz::read_json(members, patch)) {
+         return ec;
+      }
+      for (const auto& [key, value] : members) {
+         auto it = target.children.find(key);
+         if (it == target.children.end()) {
+            glz::error_ctx ec{};
+            ec.ec = glz::error_code::unknown_key;
+            return ec;
+         }
+         if (auto ec = merge_patch(nodes[it->second], value.str, undo)) {
+            return ec;
+         }
+      }
+      return {};
+   }
+
+   void apply_patch(const node& target, const glz::repe::message& request, glz::repe::message& response) {
+      // (pointer, merge patch) pairs describing what changed, for on_write
+      std::vector<std::pair<std::string, std::string>> changes;
+      undo_log undo;
+      uint64_t sequence = 0;
+
+      if (request.header.body_format == body_format_merge_patch) {
+         glz::error_ctx ec{};
+         with_unique_locks({target.subtree}, [&] {
+            ec = merge_patch(target, request.body, undo);
+            if (ec) {
+               rollback(undo);
+            }
+            else {
+               sequence = writes.fetch_add(1, std::memory_order_acq_rel) + 1;
+            }
+            return !ec;
+         });
+         if (ec) {
+            set_error(response, ec.ec == glz::error_code::unknown_key ? glz::error_code::invalid_query
+                                                                     : glz::error_code::parse_error,
+                      "Invalid merge patch for " + request.query);
+            return;
+         }
+         changes.emplace_back(target.pointer, request.body);
+      }
+      else {
+         std::vector<json_patch_op> ops{};
+         if (glz::read_json(ops, request.body)) {
+            set_error(response, glz::error_code::parse_error, "Invalid JSON Patch for " + request.query);
+            return;
+         }
+
+         // Resolve every path up front so the locks of all touched subtrees are taken together
+         std::string base = request.query.substr(0, request.query.find('?'));
+         while (!base.empty() && base.back() == '/') {
+            base.pop_back();
+         }
+         std::vector<std::pair<const node*, const node*>> targets; // (path, from)
+         std::vector<uint32_t> subtrees;
+         for (const auto& op : ops) {
+            const node* path_node = find(base + op.path);
+            const node* from_node = op.op == "copy" ? find(base + op.from) : path_node;
+            if (!path_node || !from_node) {
+               set_error(response, glz::error_code::invalid_query, "Unknown path in JSON Patch: " + op.path);
+               return;
+            }
+            if (op.op != "add" && op.op != "replace" && op.op != "copy" && op.op != "test") {
+               // Reflected members have a fixed shape, so remove and move cannot apply
+               set_error(response, glz::error_code::invalid_body, "Unsupported JSON Patch operation: " + op.op);
+               return;
+            }
+            targets.emplace_back(path_node, from_node);
+            subtrees.emplace_back(path_node->subtree);
+            subtrees.emplace_back(from_node->subtree);
+         }
+
+         std::string failure;
+         with_unique_locks(std::move(subtrees), [&] {
+            std::string current;
+            for (size_t i = 0; i < ops.size() && failure.empty(); ++i) {
+               const auto& op = ops[i];
+               const auto& [path_node, from_node] = targets[i];
+               if (op.op == "test") {
+                  current.clear();
+                  if (!path_node->read || path_node->read(current, 2) || !json_values_equal(current, op.value.str)) {
+                     failure = "JSON Patch test failed at " + op.path;
+                  }
+                  continue;
+               }
+               std::string value = op.value.str;
+               if (op.op == "copy") {
+                  value.clear();
+                  if (!from_node->read || from_node->read(value, 2)) {
+                     failure = "Cannot copy from " + op.from;
+                     continue;
+                  }
+               }
+               if (logged_write(*path_node, value, undo)) {
+                  failure = "Invalid value for " + op.path;
+                  continue;
+               }
+               changes.emplace_back(path_node->pointer, std::move(value));
+            }
+            if (!failure.empty()) {
+               rollback(undo);
+            }
+            else {
+               sequence = writes.fetch_add(1, std::memory_order_acq_rel) + 1;
+            }
+            return failure.empty();
+         });
+         if (!failure.empty()) {
+            set_error(response, glz::error_code::invalid_body, std::move(failure));
+            return;
+         }
+      }
+
+      response.body.clear();
+      response.header.body_format = 2; // JSON
+      if (on_write) {
+         for (const auto& [path, patch] : changes) {
+            on_write(path, patch, body_format_merge_patch, sequence);
+         }
+      }
+   }
+
+   template <class T>
+   static glz::error_ctx write_body(const T& value, uint16_t format, std::string& out) {
+      if (format == 1) { // BEVE
+         return glz::write_beve(value, out);
+      }
+      return glz::write_json(value, out);
+   }
+
+   template <class T>
+   static glz::error_ctx read_body(T& value, uint16_t format, std::string_view in) {
+      if (format == 1) { // BEVE
+         return glz::read_beve(value, in);
+      }
+      return glz::read_json(value, in);
+   }
+
+   template <class T>
+   void build(T& value, uint32_t index, uint32_t subtree) {
+      // nodes may reallocate while children are added, so always index rather than hold references
+      nodes[index].subtree = subtree;
+
+      if constexpr (is_std_function<T>::value) {
+         nodes[index].invoke = make_invoke(value);
+      }
+      else {
+         if constexpr (!contains_function<T>()) {
+            nodes[index].read = [&value](std::string& out, uint16_t format) {
+               return write_body(value, format, out);
+            };
+            nodes[index].write = [&value](std::string_view in, uint16_t format) {
+               // Parse into a copy, so a body that fails partway leaves the member as it was
+               if constexpr (std::is_copy_constructible_v<T> && std::is_move_assignable_v<T>) {
+                  T next = value;
+                  auto ec = read_body(next, format, in);
+                  if (!ec) {
+                     value = std::move(next);
+                  }
+                  return ec;
+               }
+               else {
+                  return read_body(value, format, in);
+               }
+            };
+         }
+
+         if constexpr (glz::reflectable<T>) {
+            auto tie = glz::to_tie(value);
+            [&]<size_t... I>(std::index_sequence<I...>) {
+               (add_child(index, subtree, glz::reflect<T>::keys[I], glz::get<I>(tie)), ...);
+            }(std::make_index_sequence<glz::reflect<T>::size>{});
+         }
+      }
+   }
+
+   template <class Member>
+   void add_child(uint32_t parent, uint32_t subtree, std::string_view key, Member& member) {
+      const auto child = static_cast<uint32_t>(nodes.size());
+      nodes.emplace_back();
+      nodes[parent].children.emplace(std::string(key), child);
+      nodes[child].pointer = nodes[parent].pointer + '/';
+      append_pointer_segment(nodes[child].pointer, key);
+
+      // Every top-level member starts its own locking domain
+      if (parent == 0) {
+         subtree = static_cast<uint32_t>(subtree_locks.size());
+         subtree_locks.emplace_back(std::make_unique<writer_priority_mutex>());
+         subtree_commits.emplace_back();
+      }
+      if constexpr (is_rcu_cell<Member>::value) {
+         if (parent != 0) {
+            throw std::logic_error("rcu_cell members must be top-level: " + std::string(key));
+         }
+         subtree_commits[subtree] = [&member](bool keep) { keep ? member.publish() : member.discard(); };
+         build_snapshot(member, child, subtree, [](auto& value) -> auto& { return value; });
+      }
+      else {
+         build(member, child, subtree);
+      }
+   }
+   
+   // Nodes of an rcu_cell member and its reflected members, each reached from the snapshot
+   // through `project`. Reads serialize the current snapshot (or, for the thread writing, its
+   // draft); writes parse into the draft that with_unique_locks publishes.
+   template <class T, class Project>
+   void build_snapshot(rcu_cell<T>& cell, uint32_t index, uint32_t subtree, Project project) {
+      using V = std::remove_reference_t<decltype(project(std::declval<T&>()))>;
+      static_assert(!contains_function<V>(), "rcu_cell values hold data only");
+      nodes[index].subtree = subtree;
+      nodes[index].read = [&cell, project](std::string& out, uint16_t format) {
+         // A snapshot is never modified; `project` only picks the member to serialize
+         return write_body(project(const_cast<T&>(cell.view())), format, out);
+      };
+      nodes[index].write = [&cell, project](std::string_view in, uint16_t format) {
+         return read_body(project(cell.draft()), format, in);
+      };
+      if constexpr (glz::reflectable<V>) {
+         [&]<size_t... I>(std::index_sequence<I...>) {
+            (add_snapshot_child<I>(cell, index, subtree, glz::reflect<V>::keys[I], project), ...);
+         }(std::make_index_sequence<glz::reflect<V>::size>{});
+      }
+   }
+   
+   template <size_t I, class T, class Project>
+   void add_snapshot_child(rcu_cell<T>& cell, uint32_t parent, uint32_t subtree, std::string_view key,
+                           Project project) {
+      const auto child = static_cast<uint32_t>(nodes.size());
+      nodes.emplace_back();
+      nodes[parent].children.emplace(std::string(key), child);
+      nodes[child].pointer = nodes[parent].pointer + '/';
+      append_pointer_segment(nodes[child].pointer, key);
+      build_snapshot(cell, child, subtree, [project](T& root) -> auto& {
+         auto tie = glz::to_tie(project(root));
+         return glz::get<I>(tie);
+      });
+   }
+
+   template <class R, class... Args>
+   static auto make_invoke(std::function<R(Args...)>& func) {
+      static_assert(sizeof...(Args) <= 1, "Registry functions take at most one parameter");
+
+      return [&func](const glz::repe::message& request, glz::repe::message& response, uint16_t reply) {
+         const uint16_t format = (request.header.body_format == 1) ? 1 : 2; // BEVE or JSON
+         try {
+            if constexpr (sizeof...(Args) == 0) {
+               if constexpr (std::is_void_v<R>) {
+                  func();
+               }
+               else {
+                  write_body(func(), reply, response.body);
+               }
+            }
+            else {
+               using params_t = std::decay_t<std::tuple_element_t<0, std::tuple<Args...>>>;
+               if (request.body.empty()) {
+                  response.header.ec = glz::error_code::invalid_body;
+                  response.body = "Function requires parameters: " + request.query;
+                  response.header.body_format = 3; // UTF-8
+                  return;
+               }
+               params_t params{};
+               if (read_body(params, format, request.body)) {
+                  response.header.ec = glz::error_code::parse_error;
+                  response.body = "Invalid parameters for " + request.query;
+                  response.header.body_format = 3; // UTF-8
+                  return;
+               }
+               if constexpr (std::is_void_v<R>) {
+                  func(params);
+               }
+               else {
+                  write_body(func(params), reply, response.body);
+               }
+            }
+            response.header.body_format = reply;
+         }
+         catch (const std::exception& e) {
+            response.header.ec = glz::error_code::invalid_body;
+            response.body = e.what();
+            response.header.body_format = 3; // UTF-8
+         }
+      };
+   }
+};
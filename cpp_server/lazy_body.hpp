@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glaze/glaze.hpp>
+#include <glaze/rpc/repe/repe.hpp>
+#include "beve_view.hpp"
+#include "json_patch.hpp"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Request body whose members are decoded on demand. Finding a member only scans the
+// encoded body (JSON text or BEVE) without building anything; a value is parsed only when
+// get<T>() asks for it, and then only from that value's own bytes. Handlers that decide
+// from a small field whether a large payload is needed never materialize the payload.
+//
+// Members are addressed by JSON pointer ("/route", "/payload/3"); a bare key is shorthand
+// for a top-level member.
+class lazy_body {
+public:
+   explicit lazy_body(const glz::repe::message& request)
+      : format(request.header.body_format), body(request.body) {}
+
+   // Only JSON and BEVE bodies can be read lazily
+   bool supported() const { return format == 1 || format == 2; }
+
+   bool contains(std::string_view pointer) const { return !encoded(pointer).empty(); }
+
+   // Decode the value at `pointer`; nullopt if it is absent or does not parse as T
+   template <class T>
+   std::optional<T> get(std::string_view pointer) const {
+      const std::string bytes = encoded(pointer);
+      if (bytes.empty()) {
+         return std::nullopt;
+      }
+      T value{};
+      const auto ec = (format == 1) ? glz::read_beve(value, bytes) : glz::read_json(value, bytes);
+      if (ec) {
+         return std::nullopt;
+      }
+      return value;
+   }
+
+   // Encoded bytes of the value at `pointer`, in the body's format (empty if absent).
+   // Copied so the slice is self-contained; the rest of the body is not touched.
+   std::string encoded(std::string_view pointer) const {
+      std::string normalized;
+      if (!pointer.empty() && pointer.front() != '/') {
+         normalized = "/";
+      }
+      normalized.append(pointer);
+
+      if (format == 1) {
+         const auto slice = beve_view(body).find(normalized);
+         if (!slice) {
+            return {};
+         }
+         std::string bytes = slice->prefix;
+         bytes.append(slice->data);
+         return bytes;
+      }
+      if (format == 2) {
+         return std::string(find_json_pointer(body, normalized));
+      }
+      return {};
+   }
+
+private:
+   uint16_t format{};
+   std::string_view body{};
+};
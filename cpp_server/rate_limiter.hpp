@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Rates a client may use; 0 leaves that rate unlimited
+struct rate_limits {
+   double requests_per_second = 0.0;
+   double bytes_per_second = 0.0;
+};
+
+// Limits applied to every connection, and to all connections from one source address together
+struct rate_limit_config {
+   rate_limits per_connection{};
+   rate_limits per_address{};
+   double burst = 1.0;         // seconds of traffic a bucket saves up while a client is idle
+   std::string mode = "delay"; // "delay": stop reading until tokens refill; "reject": answer EC_RATE_LIMITED
+};
+
+// Token buckets for requests and bytes, per connection and per source address. Every frame
+// read from a connection is charged to both of its buckets. In delay mode the charge is
+// always taken, possibly leaving the buckets in debt, and the reader sleeps until the debt
+// is repaid; the client's requests pile up in its socket buffers and TCP slows it down. In
+// reject mode a frame is only admitted if the buckets can pay for it now.
+//
+// The configuration can be replaced at any time; buckets pick up new rates on their next
+// refill.
+class rate_limiter {
+public:
+   using clock = std::chrono::steady_clock;
+
+   struct admission {
+      bool allowed = true;
+      clock::duration delay = clock::duration::zero(); // how long to wait before handling it
+   };
+
+   struct stats {
+      uint64_t delayed = 0;
+      uint64_t rejected = 0;
+      uint64_t addresses = 0;
+   };
+
+   class client;
+
+   explicit rate_limiter(rate_limit_config config = {}) : config(std::move(config)) {}
+
+   rate_limit_config limits() {
+      std::lock_guard lock{mutex};
+      return config;
+   }
+
+   void set_limits(rate_limit_config next) {
+      std::lock_guard lock{mutex};
+      config = std::move(next);
+   }
+
+   // Buckets for a new connection from `address`
+   std::unique_ptr<client> connect(const std::string& address) {
+      std::lock_guard lock{mutex};
+      std::erase_if(addresses, [](const auto& entry) { return entry.second.expired(); });
+      auto shared = addresses[address].lock();
+      if (!shared) {
+         shared = std::make_shared<buckets>();
+         addresses[address] = shared;
+      }
+      return std::unique_ptr<client>(new client(std::move(shared)));
+   }
+
+   // Charge one frame of `bytes` to a client's connection and address
+   admission admit(client& c, size_t bytes) {
+      std::lock_guard lock{mutex};
+      const auto now = clock::now();
+      const double cost = static_cast<double>(bytes);
+      c.connection.refill(config.per_connection, config.burst, now);
+      c.address->refill(config.per_address, config.burst, now);
+
+      if (config.mode == "reject") {
+         if (!c.connection.can_pay(config.per_connection, config.burst, cost) ||
+             !c.address->can_pay(config.per_address, config.burst, cost)) {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            return {false, clock::duration::zero()};
+         }
+      }
+      c.connection.pay(config.per_connection, cost);
+      c.address->pay(config.per_address, cost);
+
+      const double wait = std::max(c.connection.debt_seconds(config.per_connection),
+                                   c.address->debt_seconds(config.per_address));
+      if (wait <= 0.0) {
+         return {};
+      }
+      delayed.fetch_add(1, std::memory_order_relaxed);
+      return {true, std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(wait))};
+   }
+
+   stats snapshot() {
+      std::lock_guard lock{mutex};
+      stats out{delayed.load(std::memory_order_relaxed), rejected.load(std::memory_order_relaxed), 0};
+      for (const auto& [address, entry] : addresses) {
+         out.addresses += entry.expired() ? 0 : 1;
+      }
+      return out;
+   }
+
+private:
+   struct bucket {
+      double tokens = 0.0; // filled by the first refill after a rate is set
+      clock::time_point updated{};
+
+      void refill(double rate, double burst, clock::time_point now) {
+         if (rate <= 0.0) {
+            updated = {}; // unlimited: start full if a limit is set later
+            return;
+         }
+         const double capacity = rate * burst;
+         if (updated == clock::time_point{}) {
+            tokens = capacity;
+         }
+         else {
+            tokens += rate * std::chrono::duration<double>(now - updated).count();
+         }
+         tokens = std::min(tokens, capacity);
+         updated = now;
+      }
+
+      // A charge larger than the bucket holds is allowed once it is full, so it still gets through
+      bool can_pay(double rate, double burst, double cost) const {
+         return rate <= 0.0 || tokens >= std::min(cost, rate * burst);
+      }
+
+      double debt_seconds(double rate) const { return (rate <= 0.0 || tokens >= 0.0) ? 0.0 : -tokens / rate; }
+   };
+
+   struct buckets {
+      bucket requests;
+      bucket bytes;
+
+      void refill(const rate_limits& limits, double burst, clock::time_point now) {
+         requests.refill(limits.requests_per_second, burst, now);
+         bytes.refill(limits.bytes_per_second, burst, now);
+      }
+
+      bool can_pay(const rate_limits& limits, double burst, double cost) const {
+         return requests.can_pay(limits.requests_per_second, burst, 1.0) &&
+                bytes.can_pay(limits.bytes_per_second, burst, cost);
+      }
+
+      void pay(const rate_limits& limits, double cost) {
+         if (limits.requests_per_second > 0.0) {
+            requests.tokens -= 1.0;
+         }
+         if (limits.bytes_per_second > 0.0) {
+            bytes.tokens -= cost;
+         }
+      }
+
+      double debt_seconds(const rate_limits& limits) const {
+         return std::max(requests.debt_seconds(limits.requests_per_second),
+                         bytes.debt_seconds(limits.bytes_per_second));
+      }
+   };
+
+   std::mutex mutex;
+   rate_limit_config config;
+   std::unordered_map<std::string, std::weak_ptr<buckets>> addresses;
+   std::atomic<uint64_t> delayed{0};
+   std::atomic<uint64_t> rejected{0};
+
+public:
+   // The buckets of one connection; the address buckets live as long as a connection uses them
+   class client {
+   public:
+      client(const client&) = delete;
+      client& operator=(const client&) = delete;
+
+   private:
+      friend class rate_limiter;
+      explicit client(std::shared_ptr<buckets> address) : address(std::move(address)) {}
+
+      buckets connection{};
+      std::shared_ptr<buckets> address;
+   };
+};
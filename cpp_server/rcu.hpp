@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Read-copy-update for read-mostly state (lookup tables, models) that handlers read on every
+// request. Readers never lock or write shared memory other than their own slot: they pin
+// the current epoch, load a pointer and read an immutable snapshot. A writer builds a new
+// snapshot, swaps the pointer and retires the old one, which is deleted once every reader
+// that could still see it has unpinned.
+//
+// Epoch-based reclamation: each thread announces the epoch it pinned in a slot of its own
+// (one cache line, so readers on different cores never share a line). Retiring advances the
+// epoch; a snapshot retired in epoch e is freed when no slot holds an epoch at or below e.
+// A reader pinned for a long time only delays reclamation, never a writer.
+//
+// Readers never reclaim: unpinning is a single store. Snapshots are freed by the writer that
+// retires the next one, or by collect() once the last readers of a retired snapshot have
+// moved on (the server runs it on its timer wheel while pending() is nonzero).
+class rcu_domain {
+public:
+   static rcu_domain& instance() {
+      static rcu_domain domain;
+      return domain;
+   }
+
+   struct stats {
+      uint64_t epoch = 0;
+      uint64_t retired = 0;   // snapshots waiting for readers to move on
+      uint64_t reclaimed = 0;
+      uint64_t readers = 0;   // threads that have pinned at some point and still exist
+   };
+
+   // Pin the current epoch for this thread; nests
+   void enter() {
+      auto& local = thread_state();
+      if (local.depth++ == 0) {
+         local.slot->epoch.store(epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+         // Orders the announcement before the reader's pointer loads (paired with the fence in retire)
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+      }
+   }
+
+   void exit() {
+      auto& local = thread_state();
+      if (--local.depth == 0) {
+         local.slot->epoch.store(idle, std::memory_order_release);
+      }
+   }
+
+   bool pinned() { return thread_state().depth != 0; }
+
+   // Run `reclaim` once no reader can still hold what was unlinked before this call
+   void retire(std::function<void()> reclaim) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      std::lock_guard lock{retire_mutex};
+      retired.push_back({epoch.fetch_add(1, std::memory_order_seq_cst), std::move(reclaim)});
+      waiting.store(retired.size(), std::memory_order_relaxed);
+      collect_locked();
+   }
+
+   // Snapshots retired but not yet freed
+   size_t pending() const { return waiting.load(std::memory_order_relaxed); }
+
+   // Free whatever no pinned reader can still see; cheap when nothing is waiting
+   void collect() {
+      if (waiting.load(std::memory_order_relaxed) == 0) {
+         return;
+      }
+      std::lock_guard lock{retire_mutex};
+      collect_locked();
+   }
+
+   stats snapshot() {
+      std::lock_guard lock{retire_mutex};
+      std::lock_guard slots_lock{slots_mutex};
+      uint64_t readers = 0;
+      for (const auto& s : slots) {
+         readers += s.used.load(std::memory_order_relaxed);
+      }
+      return {epoch.load(std::memory_order_relaxed), retired.size(), reclaimed, readers};
+   }
+
+private:
+   static constexpr uint64_t idle = std::numeric_limits<uint64_t>::max();
+
+   struct alignas(64) slot {
+      std::atomic<uint64_t> epoch{idle};
+      std::atomic<bool> used{false};
+   };
+
+   // A thread's slot, handed back for reuse when the thread exits
+   struct thread_slot {
+      struct slot* slot = nullptr;
+      uint32_t depth = 0;
+      ~thread_slot() {
+         if (slot) {
+            slot->epoch.store(idle, std::memory_order_release);
+            slot->used.store(false, std::memory_order_release);
+         }
+      }
+   };
+
+   struct retired_item {
+      uint64_t epoch;
+      std::function<void()> reclaim;
+   };
+
+   std::atomic<uint64_t> epoch{1};
+   std::mutex slots_mutex;
+   std::deque<slot> slots; // a deque, so slots keep their address as threads arrive
+   std::mutex retire_mutex;
+   std::vector<retired_item> retired;
+   std::atomic<size_t> waiting{0};
+   uint64_t reclaimed = 0;
+
+   rcu_domain() = default;
+
+   thread_slot& thread_state() {
+      thread_local thread_slot local;
+      if (!local.slot) {
+         local.slot = acquire_slot();
+      }
+      return local;
+   }
+
+   slot* acquire_slot() {
+      std::lock_guard lock{slots_mutex};
+      for (auto& s : slots) {
+         bool expected = false;
+         if (s.used.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+            return &s;
+         }
+      }
+      auto& s = slots.emplace_back();
+      s.used.store(true, std::memory_order_relaxed);
+      return &s;
+   }
+
+   // Caller holds retire_mutex
+   void collect_locked() {
+      if (retired.empty()) {
+         return;
+      }
+      uint64_t oldest = idle;
+      {
+         std::lock_guard lock{slots_mutex};
+         for (const auto& s : slots) {
+            oldest = std::min(oldest, s.epoch.load(std::memory_order_acquire));
+         }
+      }
+      std::vector<std::function<void()>> ready;
+      std::erase_if(retired, [&](retired_item& item) {
+         if (item.epoch < oldest) {
+            ready.push_back(std::move(item.reclaim));
+            return true;
+         }
+         return false;
+      });
+      waiting.store(retired.size(), std::memory_order_relaxed);
+      reclaimed += ready.size();
+      for (auto& reclaim : ready) {
+         reclaim();
+      }
+   }
+};
+
+// Pins the calling thread's epoch for its lifetime; the server holds one per request, so
+// handlers can read rcu_cell snapshots without pinning themselves
+class rcu_guard {
+public:
+   rcu_guard() { rcu_domain::instance().enter(); }
+   ~rcu_guard() { rcu_domain::instance().exit(); }
+   rcu_guard(const rcu_guard&) = delete;
+   rcu_guard& operator=(const rcu_guard&) = delete;
+};
+
+// A value read through immutable snapshots and replaced by publishing new ones.
+//
+// read() is valid while the calling thread holds an rcu_guard. Writers either replace the
+// value with store()/update(), or, under a lock of their own (as json_pointer_registry
+// does), edit draft() in several steps and then publish() or discard() it. The thread
+// holding a draft sees it through view(), so later steps read earlier ones.
+template <class T>
+class rcu_cell {
+public:
+   rcu_cell() : current(new T{}) {}
+   explicit rcu_cell(T initial) : current(new T(std::move(initial))) {}
+
+   ~rcu_cell() {
+      delete current.load(std::memory_order_relaxed);
+      delete pending;
+   }
+
+   rcu_cell(const rcu_cell&) = delete;
+   rcu_cell& operator=(const rcu_cell&) = delete;
+
+   // The current snapshot; hold an rcu_guard for as long as it is used
+   const T& read() const { return *current.load(std::memory_order_acquire); }
+
+   // The draft for the thread editing one, the current snapshot for everyone else
+   const T& view() const {
+      // Only the drafting thread ever finds its own id here, and only it touches `pending`
+      if (drafter.load(std::memory_order_relaxed) == std::this_thread::get_id()) {
+         return *pending;
+      }
+      return read();
+   }
+
+   // A copy of the current snapshot to edit, made on first use (writers only)
+   T& draft() {
+      if (!pending) {
+         pending = new T(read());
+         drafter.store(std::this_thread::get_id(), std::memory_order_relaxed);
+      }
+      return *pending;
+   }
+
+   // Make the draft the current snapshot (writers only)
+   void publish() {
+      if (!pending) {
+         return;
+      }
+      drafter.store(std::thread::id{}, std::memory_order_relaxed);
+      replace(std::exchange(pending, nullptr));
+   }
+
+   void discard() {
+      drafter.store(std::thread::id{}, std::memory_order_relaxed);
+      delete std::exchange(pending, nullptr);
+   }
+
+   void store(T value) {
+      std::lock_guard lock{writer};
+      replace(new T(std::move(value)));
+   }
+
+   // Publish `f` applied to a copy of the current snapshot
+   template <class F>
+   void update(F&& f) {
+      std::lock_guard lock{writer};
+      auto next = new T(read());
+      f(*next);
+      replace(next);
+   }
+
+private:
+   std::atomic<T*> current;
+   T* pending = nullptr;
+   std::atomic<std::thread::id> drafter{};
+   std::mutex writer; // for store() and update(); draft() writers bring their own lock
+
+   void replace(T* next) {
+      T* previous = current.exchange(next, std::memory_order_seq_cst);
+      rcu_domain::instance().retire([previous] { delete previous; });
+   }
+};
+
+template <class T>
+struct is_rcu_cell : std::false_type {};
+
+template <class T>
+struct is_rcu_cell<rcu_cell<T>> : std::true_type {};
@@ -0,0 +1,119 @@
+#include <glaze/glaze.hpp>
+#include <glaze/beve.hpp>
+#include "repe_codec.h"
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The C ABI of repe_codec.h. Every call writes its result to a thread-local string, which is
+// copied to the caller's buffer, or held for repe_codec_take when the buffer is too small.
+
+// Inputs are slices of a Julia vector, with no terminating null
+static constexpr glz::opts json_slice{.null_terminated = false};
+
+static thread_local std::string result; // keeps its capacity from call to call
+static thread_local std::string held;   // a result that did not fit, for repe_codec_take
+static thread_local std::string error;
+
+static std::string_view as_view(const uint8_t* in, size_t n) { return {reinterpret_cast<const char*>(in), n}; }
+
+static int deliver(const void* data, size_t n, repe_buffer* out) {
+   out->size = n;
+   if (n > out->capacity) {
+      held.assign(static_cast<const char*>(data), n);
+      return REPE_BUFFER_TOO_SMALL;
+   }
+   std::memcpy(out->data, data, n);
+   return REPE_OK;
+}
+
+static int deliver(std::string& bytes, repe_buffer* out) {
+   out->size = bytes.size();
+   if (bytes.size() > out->capacity) {
+      held.swap(bytes);
+      return REPE_BUFFER_TOO_SMALL;
+   }
+   std::memcpy(out->data, bytes.data(), bytes.size());
+   return REPE_OK;
+}
+
+static int fail(std::string message) {
+   error = std::move(message);
+   return REPE_FAILED;
+}
+
+// Common checks; a new call drops any result left untaken
+static bool begin(const void* in, size_t n, const repe_buffer* out) {
+   held.clear();
+   result.clear();
+   if (!out || (!in && n > 0)) {
+      error = "null argument";
+      return false;
+   }
+   return true;
+}
+
+extern "C" int repe_json_to_beve(const uint8_t* in, size_t n, repe_buffer* out) {
+   if (!begin(in, n, out)) {
+      return REPE_FAILED;
+   }
+   const auto json = as_view(in, n);
+   glz::generic value{};
+   if (auto ec = glz::read<json_slice>(value, json)) {
+      return fail(glz::format_error(ec, json));
+   }
+   if (auto ec = glz::write_beve(value, result)) {
+      return fail("BEVE write failed");
+   }
+   return deliver(result, out);
+}
+
+extern "C" int repe_beve_to_json(const uint8_t* in, size_t n, repe_buffer* out) {
+   if (!begin(in, n, out)) {
+      return REPE_FAILED;
+   }
+   if (auto ec = glz::beve_to_json(as_view(in, n), result)) {
+      return fail("Invalid BEVE");
+   }
+   return deliver(result, out);
+}
+
+extern "C" int repe_json_to_f64(const uint8_t* in, size_t n, repe_buffer* out) {
+   if (!begin(in, n, out)) {
+      return REPE_FAILED;
+   }
+   thread_local std::vector<double> values;
+   values.clear();
+   const auto json = as_view(in, n);
+   if (auto ec = glz::read<json_slice>(values, json)) {
+      return fail(glz::format_error(ec, json));
+   }
+   return deliver(values.data(), values.size() * sizeof(double), out);
+}
+
+extern "C" int repe_f64_to_json(const double* values, size_t count, repe_buffer* out) {
+   if (!begin(values, count, out)) {
+      return REPE_FAILED;
+   }
+   if (auto ec = glz::write_json(std::span<const double>(values, count), result)) {
+      return fail("JSON write failed");
+   }
+   return deliver(result, out);
+}
+
+extern "C" int repe_codec_take(repe_buffer* out) {
+   if (!out) {
+      return REPE_FAILED;
+   }
+   out->size = held.size();
+   if (held.size() > out->capacity) {
+      return REPE_BUFFER_TOO_SMALL;
+   }
+   std::memcpy(out->data, held.data(), held.size());
+   held.clear();
+   return REPE_OK;
+}
+
+extern "C" const char* repe_codec_error(void) { return error.c_str(); }
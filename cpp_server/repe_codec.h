@@ -0,0 +1,41 @@
+#pragma once
+
+#include "repe_core.h"
+
+// C interface to glaze's JSON and BEVE codecs, built as the repe_codec shared library so that
+// REPE.jl can encode and decode large bodies natively (see src/native_codec.jl). Results are
+// returned the way repe_handle returns responses: into a caller-owned repe_buffer, or held for
+// the calling thread until repe_codec_take when they do not fit.
+
+#if defined(_WIN32)
+#ifdef REPE_CODEC_BUILD
+#define REPE_CODEC_API __declspec(dllexport)
+#else
+#define REPE_CODEC_API __declspec(dllimport)
+#endif
+#else
+#define REPE_CODEC_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Transcode a JSON document of `n` bytes to BEVE, or a BEVE value to JSON
+REPE_CODEC_API int repe_json_to_beve(const uint8_t* in, size_t n, repe_buffer* out);
+REPE_CODEC_API int repe_beve_to_json(const uint8_t* in, size_t n, repe_buffer* out);
+
+// Read a JSON array of numbers as native doubles (out->size is in bytes), and write `count`
+// doubles as a JSON array
+REPE_CODEC_API int repe_json_to_f64(const uint8_t* in, size_t n, repe_buffer* out);
+REPE_CODEC_API int repe_f64_to_json(const double* values, size_t count, repe_buffer* out);
+
+// Copy out the result the last call on this thread could not fit
+REPE_CODEC_API int repe_codec_take(repe_buffer* out);
+
+// Why the last call on this thread returned REPE_FAILED (valid until the next call)
+REPE_CODEC_API const char* repe_codec_error(void);
+
+#ifdef __cplusplus
+}
+#endif
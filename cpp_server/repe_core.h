@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// C interface to the server core, for hosting it inside another process (REPE.jl's
+// EmbeddedServer) instead of talking to repe_server over a socket. Built as the repe_core
+// shared library from the same source as repe_server. A request goes in as a complete REPE
+// frame and its response comes back as one: the same methods, registry, dataset, cache and
+// body formats as the server, with no socket, framing round trip or second process.
+
+#if defined(_WIN32)
+#ifdef REPE_EMBEDDED
+#define REPE_CORE_API __declspec(dllexport)
+#else
+#define REPE_CORE_API __declspec(dllimport)
+#endif
+#else
+#define REPE_CORE_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct repe_core repe_core;
+
+// Caller-owned memory for a response
+typedef struct repe_buffer {
+   uint8_t* data;
+   size_t capacity; // bytes available at data
+   size_t size;     // set by the call: bytes of the response, or bytes needed
+} repe_buffer;
+
+enum {
+   REPE_OK = 0,
+   REPE_BUFFER_TOO_SMALL = 1, // out->size is the size needed; see repe_take_response
+   REPE_FAILED = -1
+};
+
+// Create a core configured with repe_server's command line options (argv[0] is ignored, as
+// for main; argc may be 0). Unlike repe_server it logs nothing and starts no worker pools
+// unless asked to. Returns NULL if the options are invalid or a file they name cannot be loaded.
+REPE_CORE_API repe_core* repe_core_create(int argc, const char* const* argv);
+
+REPE_CORE_API void repe_core_destroy(repe_core* core);
+
+// Answer one complete request frame of `n` bytes. On REPE_OK, `out` holds out->size bytes of
+// response: one frame, several for a response sent in chunks, or none for a notification.
+// On REPE_BUFFER_TOO_SMALL, nothing was copied and out->size is the size needed. The response
+// is kept for the calling thread until it calls repe_take_response or repe_handle again, so a
+// request is never run twice. May be called from many threads at once.
+REPE_CORE_API int repe_handle(repe_core* core, const uint8_t* in, size_t n, repe_buffer* out);
+
+// Copy out the response the last repe_handle on this thread could not fit
+REPE_CORE_API int repe_take_response(repe_core* core, repe_buffer* out);
+
+#ifdef __cplusplus
+}
+#endif
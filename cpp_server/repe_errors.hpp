@@ -0,0 +1,10 @@
+#pragma once
+
+#include <glaze/rpc/repe/repe.hpp>
+
+// Application error codes used by this server (REPE reserves 0-4095 for the protocol).
+// REPE.jl mirrors them in its ErrorCode enum.
+inline constexpr auto error_cancelled = static_cast<glz::error_code>(4097); // EC_CANCELLED
+inline constexpr auto error_busy = static_cast<glz::error_code>(4098);      // EC_BUSY
+inline constexpr auto error_rate_limited = static_cast<glz::error_code>(4099); // EC_RATE_LIMITED
+inline constexpr auto error_too_large = static_cast<glz::error_code>(4100);    // EC_MESSAGE_TOO_LARGE
@@ -1,26 +1,59 @@
 #include <glaze/glaze.hpp>
 #include <glaze/rpc/repe/repe.hpp>
 #include <glaze/beve.hpp>
+#include "json_pointer_registry.hpp"
+#include "subscription_hub.hpp"
+#include "beve_dataset.hpp"
+#include "lazy_body.hpp"
+#include "response_cache.hpp"
+#include "singleflight.hpp"
+#include "idempotency_window.hpp"
+#include "request_context.hpp"
+#include "repe_errors.hpp"
+#include "worker_pool.hpp"
+#include "rate_limiter.hpp"
+#include "timer_wheel.hpp"
+#include "buffer_pool.hpp"
+#include "body_stream.hpp"
+#include "body_codec.hpp"
+#include "repe_core.h"
+#include "shard_set.hpp"
+#include "cpu_placement.hpp"
+#include <atomic>
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <cstring>
 #include <vector>
 #include <map>
+#include <functional>
+#include <numeric>
+#include <set>
+#include <utility>
 
-#ifdef _WIN32
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
-#else
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
+
+// Busy polling (--busy-poll) on Linux headers that predate the options
+#if defined(__linux__) && !defined(SO_BUSY_POLL)
+#define SO_BUSY_POLL 46
+#endif
+#if defined(__linux__) && !defined(SO_PREFER_BUSY_POLL)
+#define SO_PREFER_BUSY_POLL 69
 #endif
 
-// Service with methods to expose via RPC
+// Service with methods to expose via RPC. An instance is not synchronized: the server
+// either guards its one instance with a mutex or, with --shards, gives each shard its own.
 struct math_service {
+   // Executions of these methods counted against this instance. The server counts a request
+   // only when it runs the handler, so answers from the response cache, from a joined
+   // execution or from the idempotency window are not counted again.
+   uint64_t calls = 0;
+   
    double add(double a, double b) {
       return a + b;
    }
@@ -40,39 +73,682 @@ struct math_service {
       return "Echo: " + message;
    }
    
-   std::map<std::string, std::variant<std::string, double, int>> status() {
+   // Status of the whole server, from the totals of its instances
+   static std::map<std::string, std::variant<std::string, double, uint64_t>> status(uint64_t calls, double uptime,
+                                                                                   uint64_t connections,
+                                                                                   uint64_t shards) {
       return {
          {"status", "online"},
          {"version", "1.0.0"},
-         {"uptime", 100.0},
-         {"connections", 1}
+         {"uptime", uptime},
+         {"connections", connections},
+         {"calls", calls},
+         {"shards", shards}
       };
    }
 };
 
+// Reflected state served through JSON pointer queries (e.g. /config/timeout)
+struct server_config {
+   double timeout = 30.0;
+   int32_t retries = 3;
+   std::string log_level = "info";
+};
+
+// Read-mostly tables that handlers consult on every request (see the rate method). They
+// are replaced by whole snapshots (rcu.hpp), so reads take no lock, even during an update.
+struct lookup_tables {
+   std::map<std::string, double> rates{};
+   std::vector<double> weights{};
+};
+
+struct registry_root {
+   server_config config{};
+   rcu_cell<lookup_tables> tables{};
+   std::vector<double> samples{};
+   std::function<double(const std::vector<double>&)> sum = [](const std::vector<double>& values) {
+      return std::accumulate(values.begin(), values.end(), 0.0);
+   };
+   std::function<std::string()> version = [] { return std::string("1.0.0"); };
+};
+
+// Parameters of the subscribe method; delta subscribers receive merge patches after the first value
+struct subscribe_params {
+   std::string path{};
+   bool delta = false;
+};
+
+// Parameters of the shm_attach method: bytes per ring, a power of two
+struct shm_attach_params {
+   uint32_t capacity = 1u << 20;
+};
+
+// Reply of the hello method
+struct hello_reply {
+   std::string reply_format{};                                  // for this connection's requests
+   std::vector<std::string> reply_formats{"request", "json", "beve", "auto"};
+   std::vector<std::string> codecs{};                           // body compression this build supports
+   uint64_t auto_beve_bytes = 0;
+};
+
+// Command line: repe_server [port] [--dataset file.beve] [--dataset-prefix /dataset]
+//                           [--dedup-window seconds] [--workers n] [--max-queued n]
+//                           [--max-in-flight n] [--max-connections n]
+//                           [--codel-target ms] [--codel-interval ms]
+//                           [--pool name=threads] [--route method=pool] [--priority method=high|normal]
+//                           [--connection-rate req/s] [--connection-bytes bytes/s]
+//                           [--address-rate req/s] [--address-bytes bytes/s]
+//                           [--rate-burst seconds] [--rate-mode delay|reject]
+//                           [--idle-timeout seconds] [--read-timeout seconds] [--write-timeout seconds]
+//                           [--max-query-bytes n] [--max-body-bytes n]
+//                           [--compression-threshold bytes] [--compression-level n] [--zstd-dictionary file]
+//                           [--auto-beve-bytes n] [--unix-socket path] [--shm-spin-us microseconds]
+//                           [--log-requests on|off] [--shards n]
+//                           [--io-cpus list] [--worker-cpus list] [--numa local|off] [--busy-poll microseconds]
+struct server_options {
+   int port = 8081;
+   std::string unix_socket{}; // also listen on this Unix domain socket path, for clients on the same host
+   double shm_spin_us = 50.0;  // longest a shared-memory channel spins for data before sleeping on its futex
+   std::string dataset_path{}; // BEVE file served read-only under dataset_prefix
+   std::string dataset_prefix = "/dataset";
+   double dedup_window = 0.0; // seconds a request id is remembered for retransmits (0 disables)
+   size_t workers = std::thread::hardware_concurrency(); // threads running requests
+   size_t shards = 0; // single-threaded shards with a service instance each, which run the service methods (0: off)
+   size_t max_queued = 1024;      // requests waiting for a worker before new ones are refused as busy
+   size_t max_in_flight = 64;     // unfinished requests per connection before we stop reading it
+   size_t max_connections = 1024; // connections served at once before we stop accepting
+   double codel_target_ms = 5.0;  // queueing delay CoDel tolerates...
+   double codel_interval_ms = 100.0; // ...for this long before shedding
+   double idle_timeout = 300.0; // seconds a connection may send nothing while it has no requests or subscriptions
+   double read_timeout = 30.0;  // seconds a frame may take to arrive once it has started
+   double write_timeout = 30.0; // seconds a response write may make no progress
+   uint64_t max_query_bytes = 64 * 1024;        // longer queries are a broken client; the connection is closed
+   uint64_t max_body_bytes = 64 * 1024 * 1024;  // longer bodies are discarded and answered EC_MESSAGE_TOO_LARGE
+   bool log_requests = true; // print a line for every request and response
+   
+   // A client that sends a compressed body (see body_codec.hpp) gets replies of at least
+   // compression_threshold bytes compressed with the same codec
+   size_t compression_threshold = 4096;
+   int compression_level = 3;      // zstd level
+   std::string zstd_dictionary{};  // trained dictionary, for small repetitive messages
+   
+   // Replies in the automatic format are BEVE from this size up, JSON below it
+   size_t auto_beve_bytes = 16 * 1024;
+   
+   // Bulkheads: extra worker pools by name, and the methods routed to each. Other methods run
+   // on the shared pool. By default health checks and metrics get a pool of their own, so a
+   // burst of heavy requests cannot make a healthy server look dead.
+   std::map<std::string, size_t, std::less<>> pools{{"control", 1}};
+   std::map<std::string, std::string, std::less<>> routes{
+      {"status", "control"}, {"metrics", "control"}, {"rate_limit", "control"}};
+   // Methods taken ahead of queued normal requests of their pool (and never shed by CoDel)
+   std::set<std::string, std::less<>> high_priority{"status", "metrics"};
+   
+   // Token buckets per connection and per source address (unlimited by default); can be
+   // changed while running through the rate_limit method
+   rate_limit_config rate_limits{};
+   
+   // Latency tuning, trading cores for tail latency (cpu_placement.hpp). Connection readers
+   // are pinned to io_cpus and pool workers and shards to worker_cpus, a core each in turn
+   // (lists as "0-3,8"; empty leaves placement to the scheduler). With numa_local a pinned
+   // thread allocates from its core's node and request buffers are pooled per node.
+   std::vector<unsigned> io_cpus{};
+   std::vector<unsigned> worker_cpus{};
+   bool numa_local = false;
+   // Microseconds a connection's reader spins on its socket before blocking, also set as
+   // SO_BUSY_POLL on TCP connections (0: off)
+   double busy_poll_us = 0.0;
+};
+
+// Split "key=value"; false if there is no '=' or either side is empty
+inline bool split_assignment(std::string_view text, std::string& key, std::string& value) {
+   const auto eq = text.find('=');
+   if (eq == std::string_view::npos || eq == 0 || eq + 1 == text.size()) {
+      return false;
+   }
+   key = text.substr(0, eq);
+   value = text.substr(eq + 1);
+   return true;
+}
+
+inline bool parse_options(int argc, char* argv[], server_options& options) {
+   for (int i = 1; i < argc; ++i) {
+      const std::string_view arg = argv[i];
+      if (arg.substr(0, 2) != "--") {
+         options.port = std::atoi(argv[i]); // positional port
+         continue;
+      }
+      if (i + 1 >= argc) {
+         std::cerr << "Missing value for " << arg << "\n";
+         return false;
+      }
+      const std::string value = argv[++i];
+      if (arg == "--port") {
+         options.port = std::atoi(value.c_str());
+      }
+      else if (arg == "--unix-socket") {
+         options.unix_socket = value;
+      }
+      else if (arg == "--log-requests") {
+         if (value != "on" && value != "off") {
+            std::cerr << "--log-requests must be on or off, got " << value << "\n";
+            return false;
+         }
+         options.log_requests = value == "on";
+      }
+      else if (arg == "--io-cpus" || arg == "--worker-cpus") {
+         if (!parse_cpu_list(value, arg == "--io-cpus" ? options.io_cpus : options.worker_cpus)) {
+            std::cerr << "Expected a cpu list such as 0-3,8 for " << arg << ", got " << value << "\n";
+            return false;
+         }
+      }
+      else if (arg == "--numa") {
+         if (value != "local" && value != "off") {
+            std::cerr << "--numa must be local or off, got " << value << "\n";
+            return false;
+         }
+         options.numa_local = value == "local";
+      }
+      else if (arg == "--busy-poll") {
+         options.busy_poll_us = std::max(0.0, std::atof(value.c_str()));
+      }
+      else if (arg == "--shm-spin-us") {
+         options.shm_spin_us = std::max(0.0, std::atof(value.c_str()));
+      }
+      else if (arg == "--dataset") {
+         options.dataset_path = value;
+      }
+      else if (arg == "--dataset-prefix") {
+         options.dataset_prefix = value;
+      }
+      else if (arg == "--dedup-window") {
+         options.dedup_window = std::atof(value.c_str());
+      }
+      else if (arg == "--workers") {
+         options.workers = static_cast<size_t>(std::atoi(value.c_str()));
+      }
+      else if (arg == "--shards") {
+         options.shards = value == "cores" ? std::max(1u, std::thread::hardware_concurrency())
+                                           : static_cast<size_t>(std::max(0, std::atoi(value.c_str())));
+      }
+      else if (arg == "--max-queued") {
+         options.max_queued = static_cast<size_t>(std::atoi(value.c_str()));
+      }
+      else if (arg == "--max-in-flight") {
+         options.max_in_flight = static_cast<size_t>(std::max(1, std::atoi(value.c_str())));
+      }
+      else if (arg == "--max-connections") {
+         options.max_connections = static_cast<size_t>(std::max(1, std::atoi(value.c_str())));
+      }
+      else if (arg == "--codel-target") {
+         options.codel_target_ms = std::atof(value.c_str());
+      }
+      else if (arg == "--codel-interval") {
+         options.codel_interval_ms = std::atof(value.c_str());
+      }
+      else if (arg == "--idle-timeout") {
+         options.idle_timeout = std::atof(value.c_str());
+      }
+      else if (arg == "--read-timeout") {
+         options.read_timeout = std::atof(value.c_str());
+      }
+      else if (arg == "--write-timeout") {
+         options.write_timeout = std::atof(value.c_str());
+      }
+      else if (arg == "--max-query-bytes") {
+         options.max_query_bytes = std::strtoull(value.c_str(), nullptr, 10);
+      }
+      else if (arg == "--max-body-bytes") {
+         options.max_body_bytes = std::strtoull(value.c_str(), nullptr, 10);
+      }
+      else if (arg == "--compression-threshold") {
+         options.compression_threshold = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+      }
+      else if (arg == "--compression-level") {
+         options.compression_level = std::atoi(value.c_str());
+      }
+      else if (arg == "--zstd-dictionary") {
+         options.zstd_dictionary = value;
+      }
+      else if (arg == "--auto-beve-bytes") {
+         options.auto_beve_bytes = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+      }
+      else if (arg == "--connection-rate") {
+         options.rate_limits.per_connection.requests_per_second = std::atof(value.c_str());
+      }
+      else if (arg == "--connection-bytes") {
+         options.rate_limits.per_connection.bytes_per_second = std::atof(value.c_str());
+      }
+      else if (arg == "--address-rate") {
+         options.rate_limits.per_address.requests_per_second = std::atof(value.c_str());
+      }
+      else if (arg == "--address-bytes") {
+         options.rate_limits.per_address.bytes_per_second = std::atof(value.c_str());
+      }
+      else if (arg == "--rate-burst") {
+         options.rate_limits.burst = std::atof(value.c_str());
+      }
+      else if (arg == "--rate-mode") {
+         if (value != "delay" && value != "reject") {
+            std::cerr << "Rate mode must be delay or reject, got " << value << "\n";
+            return false;
+         }
+         options.rate_limits.mode = value;
+      }
+      else if (arg == "--pool" || arg == "--route" || arg == "--priority") {
+         std::string name, setting;
+         if (!split_assignment(value, name, setting)) {
+            std::cerr << "Expected name=value for " << arg << ", got " << value << "\n";
+            return false;
+         }
+         if (arg == "--pool") {
+            options.pools[name] = static_cast<size_t>(std::max(1, std::atoi(setting.c_str())));
+         }
+         else if (arg == "--route") {
+            options.routes[name] = setting;
+         }
+         else if (setting == "high") {
+            options.high_priority.insert(name);
+         }
+         else if (setting == "normal") {
+            options.high_priority.erase(name);
+         }
+         else {
+            std::cerr << "Priority must be high or normal, got " << setting << "\n";
+            return false;
+         }
+      }
+      else {
+         std::cerr << "Unknown option: " << arg << "\n";
+         return false;
+      }
+   }
+   return true;
+}
+
+inline std::chrono::steady_clock::duration from_milliseconds(double ms) {
+   return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double, std::milli>(ms));
+}
+
+inline std::chrono::steady_clock::duration from_seconds(double seconds) {
+   return from_milliseconds(seconds * 1000.0);
+}
+
 // Simple TCP server using REPE protocol
 class repe_tcp_server {
 private:
    int server_fd;
+   int unix_fd = -1;
    int port;
-   bool running;
+   std::atomic<bool> running; // cleared by stop(), read by the accept and connection threads
+   server_options options;
+   beve_dataset dataset;
+   const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+   
+   // The service outside --shards mode: one instance, its calls serialized by service_mutex.
+   // With --shards, `shards` (declared with the pools) owns an instance per shard instead, and
+   // service_methods run on the shard of the connection that sent them.
    math_service service;
+   std::mutex service_mutex;
+   std::set<std::string, std::less<>> service_methods{"add", "multiply", "divide", "echo"};
+   registry_root state;
+   json_pointer_registry<registry_root> registry{state};
+   subscription_hub<json_pointer_registry<registry_root>> subscriptions{registry};
+   
+   // Methods that read their parameters through lazy_body instead of decode_params
+   using lazy_method = std::function<void(const lazy_body&, glz::repe::message&, uint16_t)>;
+   std::map<std::string, lazy_method, std::less<>> lazy_methods;
+   
+   // Methods that consume their body as it arrives and write their response as they go.
+   // They run on the connection's reading thread, which is busy with the body anyway, and
+   // are not bound by max_body_bytes.
+   using streaming_method = std::function<void(const glz::repe::message&, body_reader&, response_stream&)>;
+   std::map<std::string, streaming_method, std::less<>> streaming_methods;
+   
+   // Pure methods and how long their serialized responses may be reused
+   std::map<std::string, std::chrono::steady_clock::duration, std::less<>> pure_methods;
+   response_cache cache;
+   
+   // Methods whose identical concurrent requests share one execution (pure methods always do)
+   std::set<std::string, std::less<>> coalesced_methods;
+   singleflight<serialized_response> flights;
+   
+   // Responses by request id, for answering retransmits (enabled by --dedup-window)
+   std::optional<idempotency_window> dedup;
+   singleflight<serialized_response> retries;
+   
+   // Requests dropped because their deadline passed before dispatch, and requests that
+   // finished after it (work the client never saw)
+   std::atomic<uint64_t> deadline_expired{0};
+   std::atomic<uint64_t> deadline_missed{0};
+   
+   // Connections being served, bounded by options.max_connections
+   std::mutex connections_mutex;
+   std::condition_variable connection_closed;
+   size_t connections = 0;
+   
+   size_t local_connections = 0; // of `connections`, those over the Unix domain socket or shared memory
+   size_t shm_connections = 0;   // of those, shared-memory channels
+   
+   uint64_t active_connections() {
+      std::lock_guard lock{connections_mutex};
+      return connections;
+   }
+   
+   uint64_t local_connections_count() {
+      std::lock_guard lock{connections_mutex};
+      return local_connections;
+   }
+   
+   uint64_t shm_connections_count() {
+      std::lock_guard lock{connections_mutex};
+      return shm_connections;
+   }
+   
+   // Requests cancelled before a worker picked them up, and while they were running
+   std::atomic<uint64_t> cancelled_queued{0};
+   std::atomic<uint64_t> cancelled_running{0};
+   
+   rate_limiter limiter;
+   
+   // A request read from a connection and waiting for, or running on, a worker
+   struct queued_request {
+      glz::repe::message request{};
+      std::shared_ptr<client_connection> connection{};
+      request_context context{};
+      std::stop_source stop{};
+      timer_wheel::timer_id deadline_timer = 0; // signals `stop` when the deadline passes
+   };
+   
+   // Connections shut down for sending nothing, for trickling a frame, and for not reading responses
+   std::atomic<uint64_t> timeouts_idle{0};
+   std::atomic<uint64_t> timeouts_read{0};
+   std::atomic<uint64_t> timeouts_write{0};
+   
+   // Request bodies, recycled once a request finishes; and frames refused for their size
+   buffer_pool buffers;
+   cpu_plan io_cpus;     // cores for connection readers
+   cpu_plan worker_cpus; // cores for pool workers and shards
+   std::atomic<uint64_t> busy_poll_hits{0};   // frames that arrived while a reader spun
+   std::atomic<uint64_t> busy_poll_sleeps{0}; // reads that spun out and blocked
+   std::atomic<uint64_t> busy_poll_unsupported{0}; // TCP sockets that refused SO_BUSY_POLL
+   std::atomic<uint64_t> oversized{0};
+   std::atomic<uint64_t> streamed{0};
+   std::atomic<uint64_t> in_process{0}; // requests answered through the C ABI (handle_frame)
+   // Every in-process caller is one client: its requests share these buckets, and a cancel
+   // frame from any thread can name a request running on another
+   std::unique_ptr<rate_limiter::client> in_process_buckets = limiter.connect("in-process");
+   client_connection in_process_requests{-1};
+   
+   // Compressed request bodies, compressed replies and the bytes compression saved on them
+   body_compressor compressor;
+   std::atomic<uint64_t> compressed_in{0};
+   std::atomic<uint64_t> compressed_out{0};
+   std::atomic<uint64_t> compression_saved{0};
+   
+   // How often the timer wheel frees rcu_cell snapshots that readers have finished with, while
+   // any are waiting. The timer is only armed then, so an idle server is not woken for it.
+   static constexpr std::chrono::steady_clock::duration rcu_collect_interval = std::chrono::milliseconds(100);
+   std::atomic<bool> rcu_collect_armed{false};
+   
+   // Declared last so that they are destroyed (and their threads joined) before anything the
+   // running requests use. `timers` drives connection timeouts and request deadlines.
+   // `workers` is the shared pool; `pools` are the bulkheads of options.pools, which methods
+   // are routed to by options.routes.
+   timer_wheel timers;
+   worker_pool workers;
+   std::map<std::string, std::unique_ptr<worker_pool>, std::less<>> pools;
+   std::unique_ptr<shard_set<math_service>> shards;
+   
+   // The pool a method runs on, and how urgently
+   worker_pool& pool_for(std::string_view method) {
+      if (auto route = options.routes.find(method); route != options.routes.end()) {
+         if (auto pool = pools.find(route->second); pool != pools.end()) {
+            return *pool->second;
+         }
+      }
+      return workers;
+   }
+   
+   worker_pool::priority priority_of(std::string_view method) const {
+      return options.high_priority.contains(method) ? worker_pool::priority::high : worker_pool::priority::normal;
+   }
+   
+   // Whether a method runs on its connection's shard; a route to a bulkhead takes precedence
+   bool sharded(std::string_view method) const {
+      return shards && service_methods.contains(method) && !options.routes.contains(method);
+   }
+   
+   // Call `f` with the service instance for a request from `connection`: on a shard thread its
+   // own, elsewhere in --shards mode the connection's shard's by a message to that shard, and
+   // otherwise the one instance under its mutex
+   template <class F>
+   auto with_service(const client_connection& connection, F f) {
+      if (auto* local = shard_set<math_service>::local()) {
+         return f(*local);
+      }
+      if (shards) {
+         return shards->call(connection.shard, std::move(f)).get();
+      }
+      std::lock_guard lock{service_mutex};
+      return f(service);
+   }
+   
+   // Count a service method request against the instance that serves it: on a shard thread
+   // the shard's own, elsewhere the shared one under its mutex
+   void count_call(std::string_view method) {
+      if (!service_methods.contains(method)) {
+         return;
+      }
+      if (auto* local = shard_set<math_service>::local()) {
+         ++local->calls;
+         return;
+      }
+      std::lock_guard lock{service_mutex};
+      ++service.calls;
+   }
+   
+   // Status folded on demand over every service instance: each shard reports its own count
+   // through its queue, so no shard's state is read by another thread
+   auto status() {
+      uint64_t calls = 0;
+      {
+         std::lock_guard lock{service_mutex};
+         calls = service.calls; // in --shards mode, service methods routed off the shards
+      }
+      if (shards) {
+         for (const uint64_t part : shards->gather([](math_service& instance) { return instance.calls; })) {
+            calls += part;
+         }
+      }
+      const std::chrono::duration<double> uptime = std::chrono::steady_clock::now() - started;
+      return math_service::status(calls, uptime.count(), active_connections(), shards ? shards->size() : 0);
+   }
    
 public:
-   repe_tcp_server(int port) : port(port), running(false), server_fd(-1) {}
+   repe_tcp_server(const server_options& options)
+      : server_fd(-1), port(options.port), running(false), options(options), limiter(options.rate_limits),
+        buffers(64, options.numa_local ? numa_nodes() : 1), io_cpus(options.io_cpus, options.numa_local),
+        worker_cpus(options.worker_cpus, options.numa_local), compressor(options.compression_level),
+        workers(options.workers, options.max_queued,
+                codel{from_milliseconds(options.codel_target_ms), from_milliseconds(options.codel_interval_ms)},
+                [this] { worker_cpus.pin_next(); }) {
+      const codel controller{from_milliseconds(options.codel_target_ms), from_milliseconds(options.codel_interval_ms)};
+      const auto pin = [this] { worker_cpus.pin_next(); };
+      for (const auto& [name, threads] : options.pools) {
+         pools.emplace(name, std::make_unique<worker_pool>(threads, options.max_queued, controller, pin));
+      }
+      if (options.shards > 0) {
+         shards = std::make_unique<shard_set<math_service>>(options.shards, options.max_queued, controller, pin);
+      }
+      for (const auto& [method, pool] : options.routes) {
+         if (!pools.contains(pool)) {
+            std::cerr << "Method " << method << " is routed to unknown pool " << pool << "; using the shared pool\n";
+         }
+      }
+      if (options.dedup_window > 0.0) {
+         dedup.emplace(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(options.dedup_window)));
+      }
+      registry.on_write = [this](std::string_view path, std::string_view body, uint16_t format, uint64_t sequence) {
+         subscriptions.publish(path, body, format, sequence);
+         collect_retired();
+      };
+      
+      // ingest: {"kind": "sum" | ..., "payload": [...]}. The payload is only parsed for kinds
+      // that use it, so discarded messages cost a scan of the body rather than a decode.
+      lazy_methods["ingest"] = [this](const lazy_body& body, glz::repe::message& response, uint16_t format) {
+         const auto kind = body.get<std::string>("kind");
+         if (!kind) {
+            response.header.ec = glz::error_code::parse_error;
+            response.body = "Missing kind for ingest";
+            response.header.body_format = 3; // UTF-8
+            return;
+         }
+         if (*kind != "sum") {
+            encode_response(std::map<std::string, bool>{{"accepted", false}}, response, format);
+            return;
+         }
+         // Decoding the payload is the expensive part; skip it if the client has already given up
+         if (const auto* context = request_context::current(); context && context->abandoned()) {
+            response.header.ec = context->expired() ? glz::error_code::timeout : error_cancelled;
+            response.body = context->expired() ? "Deadline exceeded" : "Request cancelled";
+            response.header.body_format = 3; // UTF-8
+            return;
+         }
+         const auto payload = body.get<std::vector<double>>("payload");
+         if (!payload) {
+            response.header.ec = glz::error_code::parse_error;
+            response.body = "Invalid payload for ingest";
+            response.header.body_format = 3; // UTF-8
+            return;
+         }
+         const double result = std::accumulate(payload->begin(), payload->end(), 0.0);
+         encode_response(std::map<std::string, double>{{"result", result}}, response, format);
+      };
+      
+      mark_pure("add", std::chrono::minutes(1));
+      mark_pure("multiply", std::chrono::minutes(1));
+      mark_coalesced("divide");
+      
+      // digest: FNV-1a hash of a body of any size, computed while it arrives
+      streaming_methods["digest"] = [this](const glz::repe::message& request, body_reader& body,
+                                           response_stream& out) {
+         uint64_t hash = 0xcbf29ce484222325ull;
+         char buffer[64 * 1024];
+         while (const size_t n = body.read(buffer, sizeof(buffer))) {
+            for (size_t i = 0; i < n; ++i) {
+               hash = (hash ^ static_cast<unsigned char>(buffer[i])) * 0x100000001b3ull;
+            }
+         }
+         if (body.failed()) {
+            return;
+         }
+         glz::repe::message response{};
+         encode_response(std::map<std::string, uint64_t>{{"bytes", body.size()}, {"fnv1a", hash}}, response,
+                         request.header.body_format);
+         out.send(response.body, response.header.body_format);
+      };
+      
+      // generate: {"bytes": n} answered with n bytes sent as a sequence of 1 MiB chunk frames
+      streaming_methods["generate"] = [this](const glz::repe::message& request, body_reader& body,
+                                             response_stream& out) {
+         glz::repe::message params{};
+         params.header = request.header;
+         params.body = body.read_all();
+         auto size = decode_params<std::map<std::string, uint64_t>>(params);
+         if (!size || !size->contains("bytes")) {
+            out.fail(glz::error_code::invalid_body, "generate requires bytes");
+            return;
+         }
+         std::string chunk(1024 * 1024, '\0');
+         for (uint64_t sent = 0, total = (*size)["bytes"]; sent < total;) {
+            const size_t n = static_cast<size_t>(std::min<uint64_t>(chunk.size(), total - sent));
+            for (size_t i = 0; i < n; ++i) {
+               chunk[i] = static_cast<char>((sent + i) & 0xff);
+            }
+            if (!out.write_chunk(std::string_view{chunk}.substr(0, n), 0)) {
+               return;
+            }
+            sent += n;
+         }
+      };
+   }
+   
+   // Readers only unpin, so snapshots retired while they were pinned are freed by a timer that
+   // runs while any are waiting, or by the next write, rather than on a request's path. Called
+   // after every registry write.
+   void collect_retired() {
+      if (rcu_domain::instance().pending() == 0 || rcu_collect_armed.exchange(true)) {
+         return;
+      }
+      timers.schedule_repeating(rcu_collect_interval, [this] {
+         auto& domain = rcu_domain::instance();
+         domain.collect();
+         if (domain.pending() == 0) {
+            rcu_collect_armed.store(false);
+            // A write that retired a snapshot just now saw the timer armed and left it to us
+            if (domain.pending() == 0 || rcu_collect_armed.exchange(true)) {
+               return std::chrono::steady_clock::duration::zero();
+            }
+         }
+         return rcu_collect_interval;
+      });
+   }
+   
+   // Responses of a pure method depend only on its body, so they are served from the cache
+   // for `ttl` after being computed
+   void mark_pure(const std::string& name, std::chrono::steady_clock::duration ttl) {
+      pure_methods[name] = ttl;
+   }
+   
+   // Identical requests (same method, body format and body) that arrive while one is running
+   // wait for it and receive its serialized response. Only for methods without side effects
+   // that callers rely on happening once per request.
+   void mark_coalesced(const std::string& name) {
+      coalesced_methods.insert(name);
+   }
+   
+   void register_lazy_method(const std::string& name, lazy_method handler) {
+      lazy_methods[name] = std::move(handler);
+   }
+   
+   void register_streaming_method(const std::string& name, streaming_method handler) {
+      streaming_methods[name] = std::move(handler);
+   }
    
    ~repe_tcp_server() {
       stop();
    }
    
+   // Load what the server serves from files. start() does this first; an in-process core
+   // (repe_core.h) does only this.
+   bool prepare() {
+      if (!options.dataset_path.empty()) {
+         std::string error;
+         if (!dataset.open(options.dataset_path, error)) {
+            std::cerr << error << "\n";
+            return false;
+         }
+         std::cout << "Serving " << options.dataset_path << " (" << dataset.size() << " bytes) under "
+                   << options.dataset_prefix << "\n";
+      }
+      
+      if (!options.zstd_dictionary.empty()) {
+         std::string error;
+         if (!compressor.load_dictionary(options.zstd_dictionary, error)) {
+            std::cerr << error << "\n";
+            return false;
+         }
+      }
+      return true;
+   }
+   
    bool start() {
-#ifdef _WIN32
-      WSADATA wsaData;
-      if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-         std::cerr << "WSAStartup failed\n";
+      if (!prepare()) {
          return false;
       }
-#endif
       
       server_fd = socket(AF_INET, SOCK_STREAM, 0);
       if (server_fd < 0) {
@@ -104,17 +780,138 @@ public:
          return false;
       }
       
+      if (!options.unix_socket.empty() && !listen_local(options.unix_socket)) {
+         close_socket(server_fd);
+         return false;
+      }
+      
       running = true;
       std::cout << "REPE C++ Server (Glaze) listening on port " << port << "\n";
       return true;
    }
    
    void run() {
+      // The Unix domain socket gets an accept loop of its own; both share the connection cap
+      std::thread local;
+      if (unix_fd >= 0) {
+         local = std::thread([this, fd = unix_fd] { accept_loop(fd); });
+      }
+      accept_loop(server_fd);
+      if (local.joinable()) {
+         local.join();
+      }
+   }
+   
+   void stop() {
+      {
+         std::lock_guard lock{connections_mutex};
+         running = false;
+      }
+      connection_closed.notify_all();
+      if (server_fd >= 0) {
+         close_socket(server_fd);
+         server_fd = -1;
+      }
+      if (unix_fd >= 0) {
+         shutdown(unix_fd, SHUT_RDWR); // wakes its accept loop
+         close_socket(unix_fd);
+         unix_fd = -1;
+         unlink(options.unix_socket.c_str());
+      }
+   }
+   
+   // Answer one complete request frame on the calling thread, appending the response frame
+   // (nothing for a notification; several for a response sent in chunks) to `out`. This is the
+   // in-process entry point behind repe_core.h: the same path as a request read from a socket,
+   // through the cache, coalescing, compression, reply formats, rate limits, deadlines and
+   // cancel, without the socket or the worker pools.
+   void handle_frame(std::string_view frame, std::string& out) {
+      glz::repe::message request{};
+      if (frame.size() >= sizeof(glz::repe::header)) {
+         std::memcpy(&request.header, frame.data(), sizeof(glz::repe::header));
+      }
+      const auto& h = request.header;
+      const bool valid = frame.size() >= sizeof(glz::repe::header) && h.spec == 0x1507 && h.version == 1 &&
+                         h.length == frame.size() && h.query_length <= h.length - sizeof(glz::repe::header) &&
+                         h.body_length == h.length - sizeof(glz::repe::header) - h.query_length;
+      const std::string_view body = valid ? frame.substr(sizeof(glz::repe::header) + h.query_length) : std::string_view{};
+      auto connection = std::make_shared<client_connection>(body, out);
+      in_process.fetch_add(1, std::memory_order_relaxed);
+      if (!valid) {
+         send_error(*connection, request, glz::error_code::invalid_header, "Not a complete REPE request frame");
+         return;
+      }
+      request.query.assign(frame.substr(sizeof(glz::repe::header), h.query_length));
+      const auto received = std::chrono::steady_clock::now();
+      
+      if (auto streaming = streaming_methods.find(method_name(request.query)); streaming != streaming_methods.end()) {
+         serve_stream(connection, *in_process_buckets, request, received, streaming->second);
+         return;
+      }
+      if (h.body_length > options.max_body_bytes) {
+         oversized.fetch_add(1, std::memory_order_relaxed);
+         if (!h.notify) {
+            send_error(*connection, request, error_too_large,
+                       "Body exceeds " + std::to_string(options.max_body_bytes) + " bytes");
+         }
+         return;
+      }
+      request.body = buffers.acquire(h.body_length);
+      std::memcpy(request.body.data(), body.data(), body.size());
+      
+      if (method_name(request.query) == "cancel") {
+         handle_cancel(*connection, request, &in_process_requests);
+         buffers.release(std::move(request.body));
+         return;
+      }
+      const auto admitted = limiter.admit(*in_process_buckets, frame.size());
+      if (!admitted.allowed) {
+         if (!h.notify) {
+            send_error(*connection, request, error_rate_limited, "Rate limit exceeded");
+         }
+         buffers.release(std::move(request.body));
+         return;
+      }
+      if (admitted.delay > std::chrono::steady_clock::duration::zero()) {
+         std::this_thread::sleep_for(admitted.delay);
+      }
+      
+      queued_request job{};
+      job.context = request_context::from_budget(received, h.reserved);
+      job.context.stop = job.stop.get_token();
+      job.request = std::move(request);
+      job.connection = connection;
+      connection->acquire_slot(1);
+      const uint64_t id = job.request.header.id;
+      const bool tracked = !job.request.header.notify;
+      if (tracked) {
+         connection->track(id, job.stop);
+         in_process_requests.track(id, job.stop);
+      }
+      if (job.context.has_deadline()) {
+         job.deadline_timer = timers.schedule(job.context.remaining(), [stop = job.stop]() mutable {
+            stop.request_stop();
+         });
+      }
+      run(job);
+      if (tracked) {
+         in_process_requests.untrack(id, job.stop);
+      }
+   }
+   
+private:
+   void accept_loop(int listen_fd) {
       while (running) {
-         sockaddr_in client_addr{};
+         // At the connection cap, leave further connections in the listen backlog
+         {
+            std::unique_lock lock{connections_mutex};
+            connection_closed.wait(lock, [this] { return connections < options.max_connections || !running; });
+         }
+         
+         sockaddr_storage client_addr{};
          socklen_t client_len = sizeof(client_addr);
          
-         int client_fd = accept(server_fd, reinterpret_cast<sockaddr*>(&client_addr), &client_len);
+         int client_fd = accept(listen_fd, reinterpret_cast<sockaddr*>(&client_addr), &client_len);
          if (client_fd < 0) {
             if (running) {
                std::cerr << "Failed to accept connection\n";
@@ -122,27 +919,195 @@ public:
             continue;
          }
          
-         std::cout << "Client connected\n";
-         std::thread client_thread([this, client_fd]() {
-            handle_client(client_fd);
+         peer_info peer{};
+         if (client_addr.ss_family == AF_INET) {
+            char address[INET_ADDRSTRLEN] = {};
+            inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in&>(client_addr).sin_addr, address, sizeof(address));
+            peer.address = address;
+         }
+         else if (client_addr.ss_family == AF_UNIX) {
+            identify_local_peer(client_fd, peer);
+         }
+#ifdef SO_NOSIGPIPE
+         // No MSG_NOSIGNAL here (macOS): a write to a closed peer must fail rather than raise SIGPIPE
+         int no_sigpipe = 1;
+         setsockopt(client_fd, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe, sizeof(no_sigpipe));
+#endif
+         std::cout << "Client connected from " << peer.address << "\n";
+         {
+            std::lock_guard lock{connections_mutex};
+            ++connections;
+            local_connections += peer.local;
+         }
+         // Local peers share rate limits per user rather than per address
+         auto buckets = limiter.connect(peer.address);
+         auto connection = std::make_shared<client_connection>(client_fd, std::move(peer));
+         if (shards) {
+            connection->shard = shards->assign();
+         }
+         if (client_addr.ss_family != AF_UNIX && options.busy_poll_us > 0.0) {
+            enable_busy_poll(client_fd);
+         }
+         std::thread client_thread([this, connection = std::move(connection), buckets = std::move(buckets)] {
+            io_cpus.pin_next();
+            handle_client(connection, *buckets);
          });
          client_thread.detach();
       }
    }
    
-   void stop() {
-      running = false;
-      if (server_fd >= 0) {
-         close_socket(server_fd);
-         server_fd = -1;
+   // Have the kernel busy-poll the device queue for reads on a TCP connection, and keep its
+   // interrupts deferred while we do (SO_PREFER_BUSY_POLL, Linux 5.11). Raising SO_BUSY_POLL
+   // above net.core.busy_read needs CAP_NET_ADMIN; without it the reader still spins in user
+   // space (receive_polling).
+   void enable_busy_poll(int fd) {
+#if defined(__linux__)
+      const int usec = static_cast<int>(options.busy_poll_us);
+      const int prefer = 1;
+      if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0 ||
+          setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) != 0) {
+         if (busy_poll_unsupported.fetch_add(1, std::memory_order_relaxed) == 0) {
+            std::cerr << "Socket busy polling not enabled (" << std::strerror(errno)
+                      << "); spinning in user space only\n";
+         }
       }
-#ifdef _WIN32
-      WSACleanup();
+#else
+      (void)fd;
+      busy_poll_unsupported.fetch_add(1, std::memory_order_relaxed);
 #endif
    }
    
-private:
-   void handle_client(int client_fd) {
+   // Listen on a Unix domain socket at `path`, replacing a socket file left by an earlier run
+   bool listen_local(const std::string& path) {
+      sockaddr_un address{};
+      if (path.size() >= sizeof(address.sun_path)) {
+         std::cerr << "Unix socket path is too long: " << path << "\n";
+         return false;
+      }
+      struct stat existing{};
+      if (lstat(path.c_str(), &existing) == 0) {
+         if (!S_ISSOCK(existing.st_mode)) {
+            std::cerr << path << " exists and is not a socket\n";
+            return false;
+         }
+         unlink(path.c_str());
+      }
+      unix_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (unix_fd < 0) {
+         std::cerr << "Failed to create Unix socket\n";
+         return false;
+      }
+      address.sun_family = AF_UNIX;
+      std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+      if (bind(unix_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(unix_fd, SOMAXCONN) < 0) {
+         std::cerr << "Failed to listen on " << path << ": " << std::strerror(errno) << "\n";
+         close_socket(unix_fd);
+         unix_fd = -1;
+         return false;
+      }
+      std::cout << "Listening on Unix socket " << path << "\n";
+      return true;
+   }
+   
+   // The connecting process's credentials, which the kernel recorded at connect (SO_PEERCRED
+   // reports the same ucred as SCM_CREDENTIALS, without the client sending a message)
+   static void identify_local_peer(int fd, peer_info& peer) {
+      peer.local = true;
+#ifdef SO_PEERCRED
+      ucred credentials{};
+      socklen_t length = sizeof(credentials);
+      if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0) {
+         peer.pid = static_cast<uint32_t>(credentials.pid);
+         peer.uid = static_cast<uint32_t>(credentials.uid);
+         peer.gid = static_cast<uint32_t>(credentials.gid);
+      }
+#else
+      uid_t uid = 0;
+      gid_t gid = 0;
+      if (getpeereid(fd, &uid, &gid) == 0) {
+         peer.uid = static_cast<uint32_t>(uid);
+         peer.gid = static_cast<uint32_t>(gid);
+      }
+#endif
+      peer.address = "uid:" + std::to_string(peer.uid);
+   }
+   
+   // Serve a local client over a new shared-memory channel (see shm_channel.hpp), as a second
+   // connection of the same peer on a thread of its own. Only clients on the Unix domain socket
+   // can attach: the channel's descriptor goes to them with the reply on that socket. The
+   // channel ends with the socket it was attached through. The channel counts against
+   // --max-connections like any other connection; at the limit the attach fails with EC_BUSY.
+   bool attach_channel(const std::shared_ptr<client_connection>& control, uint32_t capacity, std::string& error,
+                       glz::error_code& ec) {
+      if (!control->peer.local || control->fd < 0) {
+         error = "Shared memory is only offered on the Unix domain socket";
+         return false;
+      }
+      {
+         std::lock_guard lock{connections_mutex};
+         if (connections >= options.max_connections) {
+            ec = error_busy;
+            error = "Connection limit reached";
+            return false;
+         }
+         ++connections;
+         ++local_connections;
+         ++shm_connections;
+      }
+      auto release = [this] {
+         {
+            std::lock_guard lock{connections_mutex};
+            --connections;
+            --local_connections;
+            --shm_connections;
+         }
+         connection_closed.notify_one();
+      };
+      const auto spin = std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::duration<double, std::micro>(options.shm_spin_us));
+      int memory_fd = -1;
+      auto channel = shm_channel::create(capacity, spin, memory_fd, error);
+      if (!channel) {
+         release();
+         return false;
+      }
+      auto connection = std::make_shared<client_connection>(std::move(channel), control->peer);
+      if (!control->attach(connection)) {
+         ::close(memory_fd);
+         release();
+         error = "This connection already has a shared-memory channel";
+         return false;
+      }
+      if (!control->open) {
+         ::close(memory_fd);
+         release();
+         error = "Connection closed"; // after its reader looked for a channel to end
+         return false;
+      }
+      {
+         std::lock_guard lock{control->write_mutex};
+         control->pass_descriptor(memory_fd); // goes out with the reply
+      }
+      if (shards) {
+         connection->shard = shards->assign(); // only now, so a failed attach holds no shard
+      }
+      std::cout << "Shared-memory channel attached for " << control->peer.address << " (" << capacity
+                << " bytes per ring)\n";
+      auto buckets = limiter.connect(control->peer.address);
+      std::thread([this, connection = std::move(connection), buckets = std::move(buckets)] {
+         io_cpus.pin_next();
+         handle_client(connection, *buckets);
+      }).detach();
+      return true;
+   }
+   
+   // Serve one connection until it closes: a socket, or a shared-memory channel (attach_channel)
+   void handle_client(const std::shared_ptr<client_connection>& connection, rate_limiter::client& buckets) {
+      timer_wheel::timer_id read_timer = 0;
+      const timer_wheel::timer_id write_timer = watch_writes(connection);
+      const auto spin_limit = std::chrono::duration_cast<std::chrono::nanoseconds>(
+         std::chrono::duration<double, std::micro>(options.busy_poll_us));
+      spin_policy spin{spin_limit, spin_limit};
       while (running) {
          // Create REPE messages for request and response
          glz::repe::message request{};
@@ -150,7 +1115,25 @@ private:
          
          // Read header first (48 bytes)
          std::vector<uint8_t> header_buffer(sizeof(glz::repe::header));
-         ssize_t bytes_read = recv(client_fd, header_buffer.data(), sizeof(glz::repe::header), MSG_WAITALL);
+         
+         // The idle timeout covers the wait for a frame to start. Once it has, the read timeout
+         // covers the rest of it, so a client trickling a partial frame cannot hold this thread.
+         read_timer = watch_idle(connection);
+         bool slept = false;
+         ssize_t bytes_read = connection->receive_polling(header_buffer.data(), sizeof(glz::repe::header), spin, slept);
+         if (spin_limit.count() > 0 && connection->fd >= 0 && bytes_read > 0) {
+            (slept ? busy_poll_sleeps : busy_poll_hits).fetch_add(1, std::memory_order_relaxed);
+         }
+         timers.cancel(read_timer);
+         read_timer = 0;
+         if (bytes_read > 0) {
+            read_timer = watch_read(connection);
+         }
+         if (bytes_read > 0 && bytes_read < static_cast<ssize_t>(sizeof(glz::repe::header))) {
+            const ssize_t rest = connection->receive(header_buffer.data() + bytes_read,
+                                                     sizeof(glz::repe::header) - bytes_read, MSG_WAITALL);
+            bytes_read = rest > 0 ? bytes_read + rest : rest;
+         }
          
          if (bytes_read <= 0) {
             break;
@@ -163,6 +1146,7 @@ private:
          
          // Copy header data
          std::memcpy(&request.header, header_buffer.data(), sizeof(glz::repe::header));
+         const auto received = std::chrono::steady_clock::now();
          
          // Validate REPE spec
          if (request.header.spec != 0x1507) {
@@ -176,51 +1160,166 @@ private:
             response.header = request.header;
             response.header.ec = glz::error_code::version_mismatch;
             response.body = "Version mismatch";
-            send_response(client_fd, response);
+            send_response(*connection, response);
+            break;
+         }
+         
+         // The lengths come straight off the wire: check them before allocating anything
+         const auto& h = request.header;
+         if (h.length < sizeof(glz::repe::header) || h.query_length > h.length - sizeof(glz::repe::header) ||
+             h.body_length != h.length - sizeof(glz::repe::header) - h.query_length) {
+            std::cerr << "Inconsistent frame lengths\n";
+            send_error(*connection, request, glz::error_code::invalid_header,
+                       "Frame length does not match query and body lengths");
+            break; // the stream cannot be resynchronized
+         }
+         if (h.query_length > options.max_query_bytes) {
+            std::cerr << "Query of " << h.query_length << " bytes exceeds the limit\n";
+            oversized.fetch_add(1, std::memory_order_relaxed);
+            send_error(*connection, request, error_too_large, "Query too large");
             break;
          }
          
          // Read query if present
          if (request.header.query_length > 0) {
             request.query.resize(request.header.query_length);
-            bytes_read = recv(client_fd, request.query.data(), request.header.query_length, MSG_WAITALL);
+            bytes_read = connection->receive(request.query.data(), request.header.query_length, MSG_WAITALL);
             if (bytes_read != static_cast<ssize_t>(request.header.query_length)) {
                std::cerr << "Failed to read query\n";
                break;
             }
          }
          
+         // Streaming methods read the body themselves, under their own stall watch
+         if (auto streaming = streaming_methods.find(method_name(request.query)); streaming != streaming_methods.end()) {
+            timers.cancel(read_timer);
+            read_timer = 0;
+            if (!serve_stream(connection, buckets, request, received, streaming->second)) {
+               break;
+            }
+            continue;
+         }
+         
+         // An oversized body is read and dropped in small pieces, keeping the connection usable
+         if (h.body_length > options.max_body_bytes) {
+            oversized.fetch_add(1, std::memory_order_relaxed);
+            if (!discard(*connection, h.body_length)) {
+               std::cerr << "Failed to read body\n";
+               break;
+            }
+            timers.cancel(read_timer);
+            read_timer = 0;
+            if (!request.header.notify) {
+               send_error(*connection, request, error_too_large,
+                          "Body exceeds " + std::to_string(options.max_body_bytes) + " bytes");
+            }
+            continue;
+         }
+         
          // Read body if present
          if (request.header.body_length > 0) {
-            request.body.resize(request.header.body_length);
-            bytes_read = recv(client_fd, request.body.data(), request.header.body_length, MSG_WAITALL);
+            request.body = buffers.acquire(request.header.body_length);
+            bytes_read = connection->receive(request.body.data(), request.header.body_length, MSG_WAITALL);
             if (bytes_read != static_cast<ssize_t>(request.header.body_length)) {
                std::cerr << "Failed to read body\n";
                break;
             }
          }
+         timers.cancel(read_timer);
+         read_timer = 0;
          
-         std::string format_name = (request.header.body_format == 1) ? "BEVE" : 
-                                   (request.header.body_format == 2) ? "JSON" : 
-                                   (request.header.body_format == 3) ? "UTF8" : "BINARY";
-         std::cout << "Request ID " << request.header.id << ", Query: " << request.query 
-                   << ", Format: " << format_name << " (" << request.header.body_format << ")\n";
+         if (options.log_requests) {
+            std::string format_name = (request.header.body_format == 1) ? "BEVE" : 
+                                      (request.header.body_format == 2) ? "JSON" : 
+                                      (request.header.body_format == 3) ? "UTF8" : "BINARY";
+            std::cout << "Request ID " << request.header.id << ", Query: " << request.query 
+                      << ", Format: " << format_name << " (" << request.header.body_format << ")\n";
+         }
          
-         // Process the request
-         process_request(request, response);
+         // Cancellation is handled here rather than queued, so it can overtake the request it names
+         if (method_name(request.query) == "cancel") {
+            handle_cancel(*connection, request);
+            continue;
+         }
          
-         // Don't send response for notify requests
-         if (request.header.notify) {
-            std::cout << "Notification received, no response sent\n";
+         // Charge the frame to this client's token buckets. Delaying leaves later requests unread,
+         // so a client over its rate is slowed by TCP rather than taking over the workers.
+         const auto admitted = limiter.admit(
+            buckets, sizeof(glz::repe::header) + request.query.size() + request.body.size());
+         if (!admitted.allowed) {
+            if (!request.header.notify) {
+               send_error(*connection, request, error_rate_limited, "Rate limit exceeded");
+            }
             continue;
          }
+         if (admitted.delay > std::chrono::steady_clock::duration::zero()) {
+            std::this_thread::sleep_for(admitted.delay);
+         }
+         
+         // Bound what this connection has outstanding; while we wait, TCP pushes back on the client
+         if (!connection->acquire_slot(options.max_in_flight)) {
+            break;
+         }
          
-         // Send response
-         send_response(client_fd, response);
-         std::cout << "Response sent for request ID: " << request.header.id << "\n";
+         // Hand the request to its pool; this thread goes back to reading the socket
+         const auto method = method_name(request.query);
+         auto& pool = pool_for(method);
+         const auto level = priority_of(method);
+         auto job = std::make_shared<queued_request>();
+         job->context = request_context::from_budget(received, request.header.reserved);
+         job->context.stop = job->stop.get_token();
+         job->request = std::move(request);
+         job->connection = connection;
+         if (!job->request.header.notify) {
+            connection->track(job->request.header.id, job->stop);
+         }
+         if (job->context.has_deadline()) {
+            // Wake handlers waiting on the stop token when the client gives up
+            job->deadline_timer = timers.schedule(job->context.remaining(), [stop = job->stop]() mutable {
+               stop.request_stop();
+            });
+         }
+         auto execute = [this, job] { run(*job); };
+         auto refuse = [this, job] { shed(*job); };
+         const bool queued = sharded(method) ? shards->submit(connection->shard, execute, refuse, level)
+                                             : pool.submit(execute, refuse, level);
+         if (!queued) {
+            shed(*job); // queue full: answer busy now rather than queue without bound
+         }
       }
       
-      close_socket(client_fd);
+      // Nobody can read the answers any more: stop queued and running requests, and drop
+      // subscriptions, which hold the connection, before the descriptor can be reused.
+      // Cancelling the timer also waits out a timeout that is shutting the socket down.
+      timers.cancel(read_timer);
+      timers.cancel(write_timer);
+      connection->cancel_all();
+      subscriptions.remove_connection(connection.get());
+      if (dedup) {
+         dedup->drop_scope("connection:" + std::to_string(reinterpret_cast<uintptr_t>(connection.get())));
+      }
+      {
+         std::lock_guard lock{connection->write_mutex};
+         connection->open = false;
+         if (connection->ring) {
+            connection->ring->close();
+         } else {
+            close_socket(connection->fd);
+         }
+      }
+      if (auto channel = connection->attached_channel()) {
+         channel->shutdown(); // the client process is gone, or has dropped the channel with its socket
+      }
+      {
+         std::lock_guard lock{connections_mutex};
+         --connections;
+         local_connections -= connection->peer.local;
+         shm_connections -= connection->ring != nullptr;
+      }
+      if (shards) {
+         shards->release(connection->shard);
+      }
+      connection_closed.notify_one();
       std::cout << "Client disconnected\n";
    }
    
@@ -253,7 +1352,8 @@ private:
       }
    }
 
-   void process_request(const glz::repe::message& request, glz::repe::message& response) {
+   void process_request(const glz::repe::message& request, glz::repe::message& response,
+                        const std::shared_ptr<client_connection>& connection) {
       // Copy request ID and query
       response.header.id = request.header.id;
       response.query = request.query;
@@ -266,14 +1366,16 @@ private:
          method = method.substr(1);
       }
       
-      // Default to same format as request for response
-      uint16_t response_format = request.header.body_format;
+      // The request's format unless the client asked for another (see negotiate)
+      const uint16_t response_format = reply_format_for(request);
       
       // Process based on method
       if (method == "add") {
          auto params = decode_params<std::map<std::string, double>>(request);
          if (params) {
-            double result = service.add(params.value()["a"], params.value()["b"]);
+            double result = with_service(*connection, [&](math_service& s) {
+               return s.add(params.value()["a"], params.value()["b"]);
+            });
             auto res_map = std::map<std::string, double>{{"result", result}};
             encode_response(res_map, response, response_format);
          } else {
@@ -285,7 +1387,9 @@ private:
       else if (method == "multiply") {
          auto params = decode_params<std::map<std::string, double>>(request);
          if (params) {
-            double result = service.multiply(params.value()["x"], params.value()["y"]);
+            double result = with_service(*connection, [&](math_service& s) {
+               return s.multiply(params.value()["x"], params.value()["y"]);
+            });
             auto res_map = std::map<std::string, double>{{"result", result}};
             encode_response(res_map, response, response_format);
          } else {
@@ -298,7 +1402,9 @@ private:
          auto params = decode_params<std::map<std::string, double>>(request);
          if (params) {
             try {
-               double result = service.divide(params.value()["numerator"], params.value()["denominator"]);
+               double result = with_service(*connection, [&](math_service& s) {
+                  return s.divide(params.value()["numerator"], params.value()["denominator"]);
+               });
                auto res_map = std::map<std::string, double>{{"result", result}};
                encode_response(res_map, response, response_format);
             } catch (const std::invalid_argument& e) {
@@ -315,7 +1421,9 @@ private:
       else if (method == "echo") {
          auto params = decode_params<std::map<std::string, std::string>>(request);
          if (params) {
-            std::string result = service.echo(params.value()["message"]);
+            std::string result = with_service(*connection, [&](math_service& s) {
+               return s.echo(params.value()["message"]);
+            });
             auto res_map = std::map<std::string, std::string>{{"result", result}};
             encode_response(res_map, response, response_format);
          } else {
@@ -324,15 +1432,184 @@ private:
             response.header.body_format = 3; // UTF-8
          }
       }
+      else if (method == "sleep") {
+         // Holds a worker for `ms` milliseconds, as a slow handler would, and stops early if
+         // the client gives up. For exercising load shedding, bulkheads and cancellation.
+         auto params = decode_params<std::map<std::string, double>>(request);
+         if (params) {
+            const auto until = std::chrono::steady_clock::now() + from_milliseconds(params.value()["ms"]);
+            const auto* context = request_context::current();
+            while (std::chrono::steady_clock::now() < until && !(context && context->abandoned())) {
+               std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if (context && context->abandoned()) {
+               response.header.ec = context->expired() ? glz::error_code::timeout : error_cancelled;
+               response.body = context->expired() ? "Deadline exceeded" : "Request cancelled";
+               response.header.body_format = 3; // UTF-8
+            }
+            else {
+               encode_response(std::map<std::string, bool>{{"slept", true}}, response, response_format);
+            }
+         } else {
+            response.header.ec = glz::error_code::parse_error;
+            response.body = "Invalid parameters for sleep";
+            response.header.body_format = 3; // UTF-8
+         }
+      }
+      else if (method == "rate") {
+         // A lookup in the read-mostly tables: the snapshot is read under the request's pin
+         auto params = decode_params<std::map<std::string, std::string>>(request);
+         const auto& rates = state.tables.read().rates;
+         if (!params) {
+            response.header.ec = glz::error_code::parse_error;
+            response.body = "Invalid parameters for rate";
+            response.header.body_format = 3; // UTF-8
+         }
+         else if (auto rate = rates.find(params.value()["name"]); rate != rates.end()) {
+            encode_response(std::map<std::string, double>{{"rate", rate->second}}, response, response_format);
+         }
+         else {
+            response.header.ec = glz::error_code::invalid_query;
+            response.body = "No rate named " + params.value()["name"];
+            response.header.body_format = 3; // UTF-8
+         }
+      }
       else if (method == "status") {
-         auto result = service.status();
-         encode_response(result, response, response_format);
+         encode_response(status(), response, response_format);
       }
-      else {
-         response.header.ec = glz::error_code::method_not_found;
-         response.body = "Method not found: " + method;
+      else if (method == "metrics") {
+         encode_response(metrics(), response, response_format);
+      }
+      else if (method == "rate_limit") {
+         // Read the rate limits, or change the fields given in the body
+         auto limits = limiter.limits();
+         bool valid = true;
+         if (!request.body.empty()) {
+            const auto ec = (request.header.body_format == 1) ? glz::read_beve(limits, request.body)
+                                                                : glz::read_json(limits, request.body);
+            valid = !ec && (limits.mode == "delay" || limits.mode == "reject") && limits.burst > 0.0;
+         }
+         if (valid) {
+            if (!request.body.empty()) {
+               limiter.set_limits(limits);
+            }
+            encode_response(limits, response, response_format);
+         } else {
+            response.header.ec = glz::error_code::invalid_body;
+            response.body = "Invalid rate limits";
+            response.header.body_format = 3; // UTF-8
+         }
+      }
+      else if (method == "hello") {
+         // Handshake: choose this connection's reply format and learn what the server speaks
+         auto params = decode_params<std::map<std::string, std::string>>(request);
+         reply_format chosen = connection ? connection->preferred_reply.load() : reply_format::request;
+         bool valid = connection && (request.body.empty() || params);
+         if (valid && params && params->contains("reply_format")) {
+            valid = parse_reply_format(params.value()["reply_format"], chosen);
+         }
+         if (valid) {
+            connection->preferred_reply = chosen;
+            hello_reply result{};
+            result.reply_format = reply_format_name(chosen);
+            result.auto_beve_bytes = options.auto_beve_bytes;
+            for (auto codec : {body_codec::zstd, body_codec::lz4}) {
+               if (codec_available(codec)) {
+                  result.codecs.emplace_back(codec == body_codec::zstd ? "zstd" : "lz4");
+               }
+            }
+            encode_response(result, response, request.header.body_format == 1 ? 1 : 2);
+         } else {
+            response.header.ec = glz::error_code::invalid_body;
+            response.body = "Invalid reply_format for hello; expected request, json, beve or auto";
+            response.header.body_format = 3; // UTF-8
+         }
+      }
+      else if (method == "peer") {
+         // Who this connection is: its address, or the credentials of a local process
+         if (connection) {
+            encode_response(connection->peer, response, response_format);
+         } else {
+            response.header.ec = glz::error_code::invalid_query;
+            response.body = "No connection";
+            response.header.body_format = 3; // UTF-8
+         }
+      }
+      else if (method == "shm_attach") {
+         // Carry this client's traffic over a new shared-memory channel, passed with the reply
+         auto params = request.body.empty() ? shm_attach_params{} : decode_params<shm_attach_params>(request);
+         std::string error = "Invalid shm_attach parameters";
+         glz::error_code ec = glz::error_code::invalid_body;
+         if (params && connection && attach_channel(connection, params->capacity, error, ec)) {
+            auto res_map = std::map<std::string, uint32_t>{{"capacity", params->capacity}};
+            encode_response(res_map, response, response_format);
+         } else {
+            response.header.ec = ec;
+            response.body = error;
+            response.header.body_format = 3; // UTF-8
+         }
+      }
+      else if (method == "session") {
+         // Name this client so request ids are deduplicated across its connections
+         auto params = decode_params<std::map<std::string, std::string>>(request);
+         if (params && connection && !params.value()["client_key"].empty()) {
+            connection->set_client_key(params.value()["client_key"]);
+            auto res_map = std::map<std::string, std::string>{{"client_key", params.value()["client_key"]}};
+            encode_response(res_map, response, response_format);
+         } else {
+            response.header.ec = glz::error_code::invalid_body;
+            response.body = "Invalid client_key for session";
+            response.header.body_format = 3; // UTF-8
+         }
+      }
+      else if (method == "subscribe") {
+         // Push the value at a registry path whenever it changes; the request id names the subscription
+         auto params = decode_params<subscribe_params>(request);
+         const uint16_t format = (response_format == 1) ? 1 : 2; // BEVE or JSON
+         if (params && connection &&
+             subscriptions.subscribe(connection, request.header.id, params->path, format, params->delta)) {
+            if (!connection->open) {
+               subscriptions.remove_connection(connection.get()); // disconnected while we subscribed
+            }
+            auto res_map = std::map<std::string, uint64_t>{{"subscription", request.header.id}};
+            encode_response(res_map, response, format);
+         } else {
+            response.header.ec = glz::error_code::invalid_query;
+            response.body = "Invalid subscription";
+            response.header.body_format = 3; // UTF-8
+         }
+      }
+      else if (method == "unsubscribe") {
+         auto params = decode_params<std::map<std::string, uint64_t>>(request);
+         if (params && connection && subscriptions.unsubscribe(connection.get(), params.value()["subscription"])) {
+            auto res_map = std::map<std::string, bool>{{"result", true}};
+            encode_response(res_map, response, response_format);
+         } else {
+            response.header.ec = glz::error_code::invalid_query;
+            response.body = "Unknown subscription";
+            response.header.body_format = 3; // UTF-8
+         }
+      }
+      else if (auto lazy = lazy_methods.find(method); lazy != lazy_methods.end()) {
+         const lazy_body body{request};
+         if (body.supported()) {
+            lazy->second(body, response, response_format);
+         } else {
+            response.header.ec = glz::error_code::invalid_body;
+            response.body = "Method " + method + " requires a JSON or BEVE body";
+            response.header.body_format = 3; // UTF-8
+         }
+      }
+      else if (request.header.query_format != 1) {
+         response.header.ec = glz::error_code::invalid_query;
+         response.body = "Registry paths need the JSON pointer query format: " + request.query;
          response.header.body_format = 3; // UTF-8
       }
+      else {
+         // Anything else is a JSON pointer into the registry: read, write or call
+         registry.call(request, response, response_format);
+      }
+      settle_reply(response);
       
       // Update header lengths
       response.header.query_length = response.query.size();
@@ -340,45 +1617,719 @@ private:
       response.header.length = sizeof(glz::repe::header) + response.header.query_length + response.header.body_length;
    }
    
-   void send_response(int client_fd, const glz::repe::message& response) {
-      // Create buffer for entire response
-      std::vector<uint8_t> buffer(response.header.length);
+   static std::string_view method_name(std::string_view query) {
+      if (!query.empty() && query.front() == '/') {
+         query.remove_prefix(1);
+      }
+      return query.substr(0, query.find('?')); // without query parameters
+   }
+   
+   // Worker side of a request: skip it if it was abandoned while queued, otherwise dispatch it
+   void run(queued_request& job) {
+      negotiate(job);
+      const auto& request = job.request;
+      auto& connection = *job.connection;
+      // Expiry is checked first: the deadline timer also signals the stop token
+      if (job.context.expired()) {
+         // The deadline passed while the request was being read or queued
+         deadline_expired.fetch_add(1, std::memory_order_relaxed);
+         if (!request.header.notify) {
+            send_error(connection, request, glz::error_code::timeout, "Deadline exceeded before dispatch");
+         }
+      }
+      else if (job.context.cancelled()) {
+         cancelled_queued.fetch_add(1, std::memory_order_relaxed);
+         if (!request.header.notify) {
+            send_error(connection, request, error_cancelled, "Request cancelled");
+         }
+      }
+      else if (!decompress(job)) {
+         if (!request.header.notify) {
+            send_error(connection, request, glz::error_code::invalid_body,
+                       codec_available(job.context.codec) ? "Cannot decompress body"
+                                                          : "Body compression not supported by this server");
+         }
+      }
+      else {
+         {
+            request_scope scope{job.context};
+            dispatch(job.connection, request);
+         }
+         if (job.context.expired()) {
+            deadline_missed.fetch_add(1, std::memory_order_relaxed); // finished after the client gave up
+         }
+         else if (job.context.cancelled()) {
+            cancelled_running.fetch_add(1, std::memory_order_relaxed);
+         }
+         if (options.log_requests) {
+            if (request.header.notify) {
+               std::cout << "Notification received, no response sent\n";
+            } else {
+               std::cout << "Response sent for request ID: " << request.header.id << "\n";
+            }
+         }
+      }
+      finish(job);
+   }
+   
+   // Choose the reply format: a `format` query parameter (`/sum?format=beve`), else what the
+   // connection chose with the hello method. Parameters are removed from the query, so
+   // handlers and the registry see the bare path.
+   void negotiate(queued_request& job) {
+      auto& request = job.request;
+      job.context.reply = job.connection->preferred_reply.load(std::memory_order_relaxed);
+      const auto mark = request.query.find('?');
+      if (mark == std::string::npos) {
+         return;
+      }
+      std::string_view params = std::string_view(request.query).substr(mark + 1);
+      while (!params.empty()) {
+         const auto end = params.find('&');
+         std::string name, value;
+         if (split_assignment(params.substr(0, end), name, value) && name == "format") {
+            parse_reply_format(value, job.context.reply); // unknown formats are ignored
+         }
+         params = (end == std::string_view::npos) ? std::string_view{} : params.substr(end + 1);
+      }
+      request.query.resize(mark);
+      request.header.query_length = request.query.size();
+      request.header.length = sizeof(glz::repe::header) + request.header.query_length + request.header.body_length;
+   }
+   
+   // Format to encode a reply to `request` in. Automatic replies are encoded as BEVE, and
+   // settle_reply turns the small ones into JSON.
+   static uint16_t reply_format_for(const glz::repe::message& request) {
+      const auto* context = request_context::current();
+      switch (context ? context->reply : reply_format::request) {
+      case reply_format::json:
+         return 2;
+      case reply_format::beve:
+      case reply_format::automatic:
+         return 1;
+      default:
+         return request.header.body_format;
+      }
+   }
+   
+   void settle_reply(glz::repe::message& response) {
+      const auto* context = request_context::current();
+      if (!context || context->reply != reply_format::automatic || response.header.ec != glz::error_code::none ||
+          response.header.body_format != 1 || response.body.size() >= options.auto_beve_bytes) {
+         return;
+      }
+      std::string json;
+      if (!glz::beve_to_json(response.body, json)) {
+         response.body = std::move(json);
+         response.header.body_format = 2;
+      }
+   }
+   
+   // Replace a compressed request body by its content, so that handlers, the cache and the
+   // dedup window only ever see the inner format. The codec is remembered for the reply.
+   bool decompress(queued_request& job) {
+      auto& header = job.request.header;
+      job.context.codec = codec_of(header.body_format);
+      if (job.context.codec == body_codec::none) {
+         return true;
+      }
+      std::string body;
+      if (!job.request.body.empty() &&
+          !compressor.decompress(job.context.codec, job.request.body, body, options.max_body_bytes)) {
+         return false;
+      }
+      compressed_in.fetch_add(1, std::memory_order_relaxed);
+      buffers.release(std::exchange(job.request.body, std::move(body)));
+      header.body_format = inner_format(header.body_format);
+      header.body_length = job.request.body.size();
+      header.length = sizeof(glz::repe::header) + header.query_length + header.body_length;
+      return true;
+   }
+   
+   // Answer a request the server has no capacity for, without running it
+   void shed(queued_request& job) {
+      if (!job.request.header.notify) {
+         send_error(*job.connection, job.request, error_busy, "Server busy");
+      }
+      finish(job);
+   }
+   
+   void finish(queued_request& job) {
+      timers.cancel(job.deadline_timer);
+      buffers.release(std::move(job.request.body));
+      if (!job.request.header.notify) {
+         job.connection->untrack(job.request.header.id, job.stop);
+      }
+      job.connection->release_slot();
+   }
+   
+   // cancel: {"id": N} names an earlier request on this connection (or among `requests`, for
+   // in-process calls). A queued request is dropped; a running one has its stop token
+   // signalled for the handler to notice.
+   void handle_cancel(client_connection& connection, const glz::repe::message& request,
+                      client_connection* requests = nullptr) {
+      auto params = decode_params<std::map<std::string, uint64_t>>(request);
+      if (!params || !params->contains("id")) {
+         if (!request.header.notify) {
+            send_error(connection, request, glz::error_code::invalid_body, "cancel requires an id");
+         }
+         return;
+      }
+      const bool found = (requests ? *requests : connection).cancel(params.value()["id"]);
+      if (!request.header.notify) {
+         glz::repe::message response{};
+         response.header.id = request.header.id;
+         response.query = request.query;
+         encode_response(std::map<std::string, bool>{{"cancelled", found}}, response,
+                         request.header.body_format);
+         send_response(connection, response);
+      }
+   }
+   
+   void send_error(client_connection& connection, const glz::repe::message& request, glz::error_code ec,
+                   std::string_view text) {
+      glz::repe::message response{};
+      response.header.id = request.header.id;
+      response.query = request.query;
+      response.header.ec = ec;
+      response.body = text;
+      response.header.body_format = 3; // UTF-8
+      send_response(connection, response);
+   }
+   
+   // Answer one request: from the dataset, from the idempotency window, or by executing it
+   void dispatch(const std::shared_ptr<client_connection>& connection, const glz::repe::message& request) {
+      // Method names may be sent as raw binary or JSON pointer queries; no other format can be resolved
+      if (request.header.query_format > 1) {
+         if (!request.header.notify) {
+            send_error(*connection, request, glz::error_code::invalid_query,
+                       "Unsupported query format " + std::to_string(request.header.query_format));
+         }
+         return;
+      }
+      if (serve_dataset(*connection, request)) {
+         return;
+      }
+      
+      if (!dedup || request.header.notify) {
+         const auto result = execute(connection, request);
+         if (!request.header.notify) {
+            send_serialized(*connection, request, result);
+         }
+         return;
+      }
+      
+      // A retransmitted id is answered from the window; one that arrives while the original
+      // is still running joins it
+      const std::string client_key = connection->client_key();
+      const std::string scope = client_key.empty()
+                                   ? "connection:" + std::to_string(reinterpret_cast<uintptr_t>(connection.get()))
+                                   : "key:" + client_key;
+      const uint64_t print = idempotency_window::fingerprint(request.query, request.body);
+      auto result = dedup->find(scope, request.header.id, print);
+      if (!result) {
+         std::string key = scope;
+         key.push_back('\0');
+         key.append(std::to_string(request.header.id));
+         key.push_back('\0');
+         key.append(std::to_string(print));
+         auto original = [&] {
+            if (auto replay = dedup->find(scope, request.header.id, print)) {
+               return *replay; // finished between the lookup above and joining
+            }
+            auto fresh = execute(connection, request);
+            if (fresh.ec != error_cancelled && fresh.ec != glz::error_code::timeout) {
+               dedup->store(scope, request.header.id, print, fresh); // a retry of an abandoned call runs again
+            }
+            return fresh;
+         };
+         // A shard thread must not wait on a retry running on another shard (shard_set.hpp)
+         result = shard_set<math_service>::local() ? original() : retries.run(key, original).first;
+      }
+      send_serialized(*connection, request, *result);
+   }
+   
+   // The formats a request's result depends on: its body format and the reply format asked for
+   static uint32_t format_key(const glz::repe::message& request) {
+      const auto* context = request_context::current();
+      const auto reply = context ? context->reply : reply_format::request;
+      return request.header.body_format | (static_cast<uint32_t>(reply) << 16);
+   }
+   
+   // Run a request through the response cache and request coalescing, returning its serialized response
+   serialized_response execute(const std::shared_ptr<client_connection>& connection,
+                               const glz::repe::message& request) {
+      const auto method = method_name(request.query);
+      const auto pure = pure_methods.find(method);
+      if (pure != pure_methods.end()) {
+         if (auto hit = cache.find(method, format_key(request), request.body)) {
+            return *hit;
+         }
+      }
+      
+      auto run = [&] {
+         count_call(method); // only a cache miss, or the leader of a coalesced group, gets here
+         glz::repe::message response{};
+         rcu_guard pinned; // handlers read rcu_cell snapshots without pinning them themselves
+         try {
+            process_request(request, response, connection);
+         }
+         catch (const shard_busy&) {
+            // A message to a shard (see with_service and status) found its queue full
+            response.header.ec = error_busy;
+            response.body = "Shard busy";
+            response.header.body_format = 3; // UTF-8
+         }
+         serialized_response result{std::make_shared<const std::string>(std::move(response.body)),
+                                    response.header.body_format, response.header.ec};
+         if (pure != pure_methods.end() && result.ec == glz::error_code::none) {
+            cache.insert(method, format_key(request), request.body, result, pure->second);
+         }
+         return result;
+      };
+      
+      // On a shard thread, joining could wait on another shard (shard_set.hpp forbids it), and
+      // requests of the shard's own connections run one at a time there anyway
+      if ((pure != pure_methods.end() || coalesced_methods.contains(method)) && !shard_set<math_service>::local()) {
+         // Concurrent identical requests join one execution; each gets the result under its own id
+         std::string key{method};
+         key.push_back('\0');
+         const uint32_t formats = format_key(request);
+         key.append(reinterpret_cast<const char*>(&formats), sizeof(formats));
+         key.append(request.body);
+         return flights.run(key, run).first;
+      }
+      return run();
+   }
+   
+   // Write an already serialized response body under a header carrying this request's id.
+   // Large replies to a client that compressed its request are compressed here rather than
+   // when encoded, since cached and coalesced results are shared by clients with different codecs.
+   void send_serialized(client_connection& connection, const glz::repe::message& request,
+                        const serialized_response& serialized) {
+      glz::repe::header header{};
+      header.spec = 0x1507;
+      header.version = 1;
+      header.id = request.header.id;
+      header.body_format = serialized.body_format;
+      header.ec = serialized.ec;
+      std::string_view body = *serialized.body;
+      std::string compressed;
+      const auto* context = request_context::current();
+      if (context && context->codec != body_codec::none && serialized.ec == glz::error_code::none &&
+          body.size() >= options.compression_threshold && serialized.body_format <= 0xff &&
+          compressor.compress(context->codec, body, compressed) && compressed.size() < body.size()) {
+         compressed_out.fetch_add(1, std::memory_order_relaxed);
+         compression_saved.fetch_add(body.size() - compressed.size(), std::memory_order_relaxed);
+         header.body_format = compressed_format(context->codec, serialized.body_format);
+         body = compressed;
+      }
+      header.query_length = request.query.size();
+      header.body_length = body.size();
+      header.length = sizeof(glz::repe::header) + header.query_length + header.body_length;
+      write_frame(connection, header, request.query, {}, body);
+   }
+   
+   // Counters for the /metrics method
+   std::map<std::string, uint64_t> metrics() {
+      const auto cached = cache.snapshot();
+      const auto pushed = subscriptions.snapshot();
+      const auto coalesced = flights.snapshot();
+      const auto limited = limiter.snapshot();
+      const auto reused = buffers.snapshot();
+      const auto snapshots = rcu_domain::instance().snapshot();
+      std::map<std::string, uint64_t> out{
+         {"cache_hits", cached.hits},
+         {"cache_misses", cached.misses},
+         {"cache_evictions", cached.evictions},
+         {"cache_entries", cached.entries},
+         {"cache_bytes", cached.bytes},
+         {"coalesced_executions", coalesced.executions},
+         {"coalesced_joined", coalesced.joined},
+         {"dedup_replayed", dedup ? dedup->snapshot().replayed : 0},
+         {"dedup_joined", retries.snapshot().joined},
+         {"deadline_expired", deadline_expired.load(std::memory_order_relaxed)},
+         {"deadline_missed", deadline_missed.load(std::memory_order_relaxed)},
+         {"cancelled_queued", cancelled_queued.load(std::memory_order_relaxed)},
+         {"cancelled_running", cancelled_running.load(std::memory_order_relaxed)},
+         {"connections", active_connections()},
+         {"connections_local", local_connections_count()},
+         {"connections_shm", shm_connections_count()},
+         {"timeouts_idle", timeouts_idle.load(std::memory_order_relaxed)},
+         {"timeouts_read", timeouts_read.load(std::memory_order_relaxed)},
+         {"timeouts_write", timeouts_write.load(std::memory_order_relaxed)},
+         {"timers", timers.size()},
+         {"oversized", oversized.load(std::memory_order_relaxed)},
+         {"streamed", streamed.load(std::memory_order_relaxed)},
+         {"requests_in_process", in_process.load(std::memory_order_relaxed)},
+         {"compressed_in", compressed_in.load(std::memory_order_relaxed)},
+         {"compressed_out", compressed_out.load(std::memory_order_relaxed)},
+         {"compression_saved_bytes", compression_saved.load(std::memory_order_relaxed)},
+         {"buffers_reused", reused.reused},
+         {"buffers_allocated", reused.allocated},
+         {"buffers_pooled_bytes", reused.pooled_bytes},
+         {"threads_pinned", io_cpus.pinned_threads() + worker_cpus.pinned_threads()},
+         {"pin_failures", io_cpus.failures() + worker_cpus.failures()},
+         {"busy_poll_hits", busy_poll_hits.load(std::memory_order_relaxed)},
+         {"busy_poll_sleeps", busy_poll_sleeps.load(std::memory_order_relaxed)},
+         {"busy_poll_unsupported", busy_poll_unsupported.load(std::memory_order_relaxed)},
+         {"rcu_epoch", snapshots.epoch},
+         {"rcu_retired", snapshots.retired},
+         {"rcu_reclaimed", snapshots.reclaimed},
+         {"rate_delayed", limited.delayed},
+         {"rate_rejected", limited.rejected},
+         {"rate_addresses", limited.addresses},
+         {"subscription_published", pushed.published},
+         {"subscription_delivered", pushed.delivered},
+         {"subscription_coalesced", pushed.coalesced},
+         {"subscription_slow_consumers", pushed.slow_consumers},
+      };
+      // Load totals over all pools, then each bulkhead on its own
+      auto add_load = [&out](const std::string& prefix, const worker_pool::stats& load) {
+         out[prefix + "queue_depth"] += load.queued;
+         out[prefix + "shed_queue_full"] += load.refused;
+         out[prefix + "shed_codel"] += load.shed;
+      };
+      add_load("", workers.snapshot());
+      for (const auto& [name, pool] : pools) {
+         const auto load = pool->snapshot();
+         add_load("", load);
+         add_load("pool_" + name + "_", load);
+      }
+      if (shards) {
+         out["shards"] = shards->size();
+         for (size_t i = 0; i < shards->size(); ++i) {
+            const auto load = shards->snapshot(i);
+            add_load("", load);
+            add_load("shard_" + std::to_string(i) + "_", load);
+            out["shard_" + std::to_string(i) + "_connections"] = shards->connections(i);
+         }
+      }
+      return out;
+   }
+   
+   // Answer a read under the dataset prefix. BEVE requests get the addressed slice written
+   // from the mapping without a copy; JSON requests get only that slice transcoded.
+   // Returns false if the query is not a dataset path.
+   bool serve_dataset(client_connection& connection, const glz::repe::message& request) {
+      if (options.dataset_path.empty()) {
+         return false;
+      }
+      const std::string_view query = request.query;
+      const std::string_view prefix = options.dataset_prefix;
+      if (query.substr(0, prefix.size()) != prefix ||
+          (query.size() > prefix.size() && query[prefix.size()] != '/')) {
+         return false;
+      }
+      
+      glz::repe::message response{};
+      response.header.id = request.header.id;
+      response.query = request.query;
+      
+      const auto slice = dataset.find(query.substr(prefix.size()));
+      // Values are stored as BEVE and transcoded for clients reading JSON
+      const auto* context = request_context::current();
+      const bool json = (context && context->reply == reply_format::automatic)
+                           ? slice && slice->prefix.size() + slice->data.size() < options.auto_beve_bytes
+                           : reply_format_for(request) == 2;
+      if (request.header.query_format != 1) {
+         response.header.ec = glz::error_code::invalid_query;
+         response.body = "Dataset paths need the JSON pointer query format: " + request.query;
+         response.header.body_format = 3; // UTF-8
+      }
+      else if (!request.body.empty()) {
+         response.header.ec = glz::error_code::invalid_body;
+         response.body = "Dataset is read-only";
+         response.header.body_format = 3; // UTF-8
+      }
+      else if (!slice) {
+         response.header.ec = glz::error_code::invalid_query;
+         response.body = "Path not found in dataset: " + request.query;
+         response.header.body_format = 3; // UTF-8
+      }
+      else if (json) {
+         std::string beve = slice->prefix;
+         beve.append(slice->data);
+         if (glz::beve_to_json(beve, response.body)) {
+            response.body = "Failed to transcode dataset value";
+            response.header.ec = glz::error_code::parse_error;
+            response.header.body_format = 3; // UTF-8
+         }
+         else {
+            response.header.body_format = 2;
+         }
+      }
+      else {
+         if (request.header.notify) {
+            return true;
+         }
+         glz::repe::header header = response.header;
+         header.body_format = 1; // BEVE
+         header.query_length = response.query.size();
+         header.body_length = slice->prefix.size() + slice->data.size();
+         header.length = sizeof(glz::repe::header) + header.query_length + header.body_length;
+         write_frame(connection, header, response.query, slice->prefix, slice->data);
+         return true;
+      }
       
-      // Copy header
-      std::memcpy(buffer.data(), &response.header, sizeof(glz::repe::header));
+      if (!request.header.notify) {
+         send_response(connection, response);
+      }
+      return true;
+   }
+   
+   void send_response(client_connection& connection, const glz::repe::message& response) {
+      glz::repe::header header = response.header;
+      header.query_length = response.query.size();
+      header.body_length = response.body.size();
+      header.length = sizeof(glz::repe::header) + header.query_length + header.body_length;
       
-      // Copy query
-      if (!response.query.empty()) {
-         std::memcpy(buffer.data() + sizeof(glz::repe::header), 
-                     response.query.data(), response.query.size());
+      // Header, query and body go out in one gathered write, without copying into a frame buffer
+      write_frame(connection, header, response.query, {}, response.body);
+   }
+   
+   // Run a streaming method on this thread while its body arrives. Returns false if the
+   // connection can no longer be used.
+   bool serve_stream(const std::shared_ptr<client_connection>& connection, rate_limiter::client& buckets,
+                     const glz::repe::message& request, std::chrono::steady_clock::time_point received,
+                     const streaming_method& handler) {
+      io_watch watch;
+      body_reader body{*connection, request.header.body_length, watch};
+      const auto admitted = limiter.admit(buckets, request.header.length);
+      if (!admitted.allowed) {
+         if (!request.header.notify) {
+            send_error(*connection, request, error_rate_limited, "Rate limit exceeded");
+         }
+         return body.drain();
+      }
+      if (admitted.delay > std::chrono::steady_clock::duration::zero()) {
+         std::this_thread::sleep_for(admitted.delay);
       }
       
-      // Copy body
-      if (!response.body.empty()) {
-         std::memcpy(buffer.data() + sizeof(glz::repe::header) + response.query.size(),
-                     response.body.data(), response.body.size());
+      // Shut the connection down if the handler sits blocked on the socket with no bytes moving
+      timer_wheel::timer_id stall = 0;
+      if (options.read_timeout > 0.0) {
+         const auto interval = from_seconds(options.read_timeout);
+         stall = timers.schedule_repeating(interval, [this, &watch, connection = connection.get(), interval,
+                                                      last = uint64_t{0}]() mutable {
+            const auto progress = watch.progress.load(std::memory_order_relaxed);
+            if (!watch.waiting || progress != last) {
+               last = progress;
+               return interval;
+            }
+            timeouts_read.fetch_add(1, std::memory_order_relaxed);
+            std::cerr << "Closing connection that stalled a streaming request\n";
+            connection->shutdown();
+            return std::chrono::steady_clock::duration::zero();
+         });
       }
       
-      // Send entire response
-      send(client_fd, buffer.data(), buffer.size(), 0);
+      streamed.fetch_add(1, std::memory_order_relaxed);
+      bool intact = true;
+      {
+         response_stream out{*connection, request, watch};
+         const auto context = request_context::from_budget(received, request.header.reserved);
+         request_scope scope{context};
+         try {
+            handler(request, body, out);
+         }
+         catch (const std::exception& e) {
+            out.fail(glz::error_code::invalid_body, e.what());
+         }
+         intact = body.drain();
+         out.finish();
+      }
+      timers.cancel(stall); // waits for the callback if it is running, so `watch` outlives it
+      return intact && connection->open;
+   }
+   
+   // Read and drop `length` bytes
+   bool discard(client_connection& connection, uint64_t length) {
+      char scratch[64 * 1024];
+      while (length > 0) {
+         const size_t want = static_cast<size_t>(std::min<uint64_t>(length, sizeof(scratch)));
+         const ssize_t n = connection.receive(scratch, want);
+         if (n <= 0) {
+            return false;
+         }
+         length -= static_cast<uint64_t>(n);
+      }
+      return true;
+   }
+   
+   // Blocking write of one frame. If the client stops reading and nothing goes out for the
+   // write timeout, the connection's write watch (watch_writes) shuts it down, which fails the write.
+   void write_frame(client_connection& connection, const glz::repe::header& header, std::string_view query,
+                    std::string_view body_prefix, std::string_view body) {
+      std::lock_guard lock{connection.write_mutex};
+      connection.writes_started.fetch_add(1, std::memory_order_relaxed);
+      connection.writing.store(true, std::memory_order_relaxed);
+      connection.send_frame(header, query, body_prefix, body);
+      connection.writing.store(false, std::memory_order_relaxed);
+   }
+   
+   // Shut down a connection whose response writes make no progress for the write timeout. One
+   // timer for the life of the connection, reading counters that write_frame keeps, so writing a
+   // frame costs no timer operations. A write is given up on once it has been seen in progress,
+   // with no bytes going out, at two checks in a row: after one to two timeouts.
+   timer_wheel::timer_id watch_writes(const std::shared_ptr<client_connection>& connection) {
+      if (options.write_timeout <= 0.0) {
+         return 0;
+      }
+      const auto interval = from_seconds(options.write_timeout);
+      return timers.schedule_repeating(interval, [this, connection = connection.get(), interval, last_sent = uint64_t{0},
+                                                  last_write = uint64_t{0}, was_writing = false]() mutable {
+         const auto sent = connection->bytes_sent.load(std::memory_order_relaxed);
+         const auto write = connection->writes_started.load(std::memory_order_relaxed);
+         const bool writing = connection->writing.load(std::memory_order_relaxed);
+         const bool stalled = writing && was_writing && sent == last_sent && write == last_write;
+         last_sent = sent;
+         last_write = write;
+         was_writing = writing;
+         if (!stalled) {
+            return interval; // idle, slow but still moving, or a write that has only just begun
+         }
+         timeouts_write.fetch_add(1, std::memory_order_relaxed);
+         std::cerr << "Closing connection that stopped reading responses\n";
+         connection->shutdown();
+         return std::chrono::steady_clock::duration::zero();
+      });
+   }
+   
+   // Shut down a connection that sends nothing for the idle timeout. Connections waiting on
+   // their requests or holding subscriptions are quiet for good reason and are checked again later.
+   timer_wheel::timer_id watch_idle(const std::shared_ptr<client_connection>& connection) {
+      if (options.idle_timeout <= 0.0) {
+         return 0;
+      }
+      const auto interval = from_seconds(options.idle_timeout);
+      return timers.schedule_repeating(interval, [this, connection = connection.get(), interval] {
+         if (connection->in_progress() > 0 || subscriptions.has_subscriptions(connection)) {
+            return interval;
+         }
+         timeouts_idle.fetch_add(1, std::memory_order_relaxed);
+         std::cerr << "Closing idle connection\n";
+         connection->shutdown();
+         return std::chrono::steady_clock::duration::zero();
+      });
+   }
+   
+   // Shut down a connection whose frame has not fully arrived within the read timeout
+   timer_wheel::timer_id watch_read(const std::shared_ptr<client_connection>& connection) {
+      if (options.read_timeout <= 0.0) {
+         return 0;
+      }
+      return timers.schedule(from_seconds(options.read_timeout), [this, connection = connection.get()] {
+         timeouts_read.fetch_add(1, std::memory_order_relaxed);
+         std::cerr << "Closing connection that did not finish sending a frame\n";
+         connection->shutdown();
+      });
    }
    
    void close_socket(int fd) {
-#ifdef _WIN32
-      closesocket(fd);
-#else
       close(fd);
-#endif
    }
 };
 
+#ifdef REPE_EMBEDDED
+
+// The C ABI of repe_core.h: a repe_tcp_server that is never started, driven through handle_frame
+
+struct repe_core {
+   explicit repe_core(const server_options& options) : server(options) {}
+   repe_tcp_server server;
+};
+
+// A response that did not fit the caller's buffer, kept for repe_take_response. Per thread,
+// so concurrent callers cannot take each other's responses.
+static thread_local const repe_core* pending_core = nullptr;
+static thread_local std::string pending_response;
+
+static int copy_response(std::string& response, repe_buffer* out) {
+   out->size = response.size();
+   if (response.size() > out->capacity) {
+      return REPE_BUFFER_TOO_SMALL;
+   }
+   std::memcpy(out->data, response.data(), response.size());
+   return REPE_OK;
+}
+
+extern "C" repe_core* repe_core_create(int argc, const char* const* argv) {
+   // Requests run on the caller's threads, so by default no pools sit idle, and nothing is logged
+   server_options options{};
+   options.workers = 1;
+   options.pools.clear();
+   options.routes.clear();
+   options.log_requests = false;
+   try {
+      if (!parse_options(argc, const_cast<char**>(argv), options)) {
+         return nullptr;
+      }
+      auto core = std::make_unique<repe_core>(options);
+      if (!core->server.prepare()) {
+         return nullptr;
+      }
+      return core.release();
+   }
+   catch (const std::exception& e) {
+      std::cerr << "repe_core_create: " << e.what() << "\n";
+      return nullptr;
+   }
+}
+
+extern "C" void repe_core_destroy(repe_core* core) {
+   if (pending_core == core) {
+      pending_core = nullptr;
+      pending_response.clear();
+   }
+   delete core;
+}
+
+extern "C" int repe_handle(repe_core* core, const uint8_t* in, size_t n, repe_buffer* out) {
+   if (!core || !out || (!in && n > 0)) {
+      return REPE_FAILED;
+   }
+   if (pending_core == core) {
+      pending_core = nullptr; // not taken: the caller has moved on
+      pending_response.clear();
+   }
+   thread_local std::string response; // keeps its capacity from call to call
+   response.clear();
+   try {
+      core->server.handle_frame({reinterpret_cast<const char*>(in), n}, response);
+   }
+   catch (const std::exception& e) {
+      std::cerr << "repe_handle: " << e.what() << "\n";
+      return REPE_FAILED;
+   }
+   const int status = copy_response(response, out);
+   if (status == REPE_BUFFER_TOO_SMALL) {
+      pending_core = core;
+      pending_response.swap(response);
+   }
+   return status;
+}
+
+extern "C" int repe_take_response(repe_core* core, repe_buffer* out) {
+   if (!core || !out || pending_core != core) {
+      return REPE_FAILED;
+   }
+   const int status = copy_response(pending_response, out);
+   if (status == REPE_OK) {
+      pending_core = nullptr;
+      pending_response.clear();
+   }
+   return status;
+}
+
+#else
+
 int main(int argc, char* argv[]) {
-   int port = 8081;
-   if (argc > 1) {
-      port = std::atoi(argv[1]);
+   server_options options{};
+   if (!parse_options(argc, argv, options)) {
+      return 1;
    }
    
-   repe_tcp_server server(port);
+   repe_tcp_server server(options);
    
    if (!server.start()) {
       std::cerr << "Failed to start server\n";
@@ -389,4 +2340,6 @@ int main(int argc, char* argv[]) {
    server.run();
    
    return 0;
-}
\ No newline at end of file
+}
+
+#endif
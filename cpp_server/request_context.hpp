@@ -0,0 +1,99 @@
+#pragma once
+
+#include "body_codec.hpp"
+#include <chrono>
+#include <cstdint>
+#include <stop_token>
+#include <string_view>
+
+// Body format a client wants replies in. `request` answers in the request's own format;
+// `automatic` answers large replies in BEVE (compact, fast to parse for numeric data) and
+// small ones in JSON.
+enum class reply_format : uint8_t { request, json, beve, automatic };
+
+inline std::string_view reply_format_name(reply_format format) {
+   switch (format) {
+   case reply_format::json:
+      return "json";
+   case reply_format::beve:
+      return "beve";
+   case reply_format::automatic:
+      return "auto";
+   default:
+      return "request";
+   }
+}
+
+inline bool parse_reply_format(std::string_view name, reply_format& out) {
+   for (auto format : {reply_format::request, reply_format::json, reply_format::beve, reply_format::automatic}) {
+      if (name == reply_format_name(format)) {
+         out = format;
+         return true;
+      }
+   }
+   return false;
+}
+
+// State of the request the current thread is running, visible to handlers through
+// request_context::current(). The deadline comes from the header's `reserved` field, which
+// carries the client's remaining time budget in milliseconds (0 means no deadline); it is
+// measured from when the header arrived, so client and server clocks need not agree.
+//
+// `stop` is signalled when the client cancels the request or disconnects. Long-running
+// handlers should poll cancelled() and give up early; nothing is interrupted for them.
+struct request_context {
+   using clock = std::chrono::steady_clock;
+
+   clock::time_point deadline = clock::time_point::max();
+   std::stop_token stop{};
+   body_codec codec = body_codec::none; // compression of the request body, which the reply may use too
+   reply_format reply = reply_format::request;
+
+   static request_context from_budget(clock::time_point received, uint32_t budget_ms) {
+      request_context context{};
+      if (budget_ms != 0) {
+         context.deadline = received + std::chrono::milliseconds(budget_ms);
+      }
+      return context;
+   }
+
+   bool has_deadline() const { return deadline != clock::time_point::max(); }
+
+   bool expired() const { return has_deadline() && clock::now() >= deadline; }
+
+   bool cancelled() const { return stop.stop_requested(); }
+
+   // Whether the result can still be of use to the client
+   bool abandoned() const { return cancelled() || expired(); }
+
+   // Time left before the client gives up (clock::duration::max() without a deadline)
+   clock::duration remaining() const {
+      if (!has_deadline()) {
+         return clock::duration::max();
+      }
+      const auto now = clock::now();
+      return now >= deadline ? clock::duration::zero() : deadline - now;
+   }
+
+   // The context of the request being handled on this thread, or nullptr outside of one
+   static const request_context*& current() {
+      thread_local const request_context* context = nullptr;
+      return context;
+   }
+};
+
+// Makes a context current for the lifetime of the scope
+class request_scope {
+public:
+   explicit request_scope(const request_context& context) : previous(request_context::current()) {
+      request_context::current() = &context;
+   }
+
+   ~request_scope() { request_context::current() = previous; }
+
+   request_scope(const request_scope&) = delete;
+   request_scope& operator=(const request_scope&) = delete;
+
+private:
+   const request_context* previous;
+};
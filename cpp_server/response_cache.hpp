@@ -0,0 +1,148 @@
+#pragma once
+
+#include <glaze/rpc/repe/repe.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// A response body as it was encoded, shareable between requests and connections
+struct serialized_response {
+   std::shared_ptr<const std::string> body{};
+   uint16_t body_format = 0;
+   glz::error_code ec = glz::error_code::none;
+};
+
+// Serialized responses of pure methods, keyed by (method, format, request body), where the
+// format key covers both the request's body format and the format the reply was asked in.
+// A hit hands back the response body exactly as it was encoded, so the caller only has to
+// write a fresh header with its own id. Entries expire after the TTL given on insert, and
+// each shard evicts least recently used entries once it is over its share of max_bytes.
+class response_cache {
+public:
+   using clock = std::chrono::steady_clock;
+
+   struct stats {
+      uint64_t hits = 0;
+      uint64_t misses = 0;
+      uint64_t evictions = 0;
+      uint64_t entries = 0;
+      uint64_t bytes = 0;
+   };
+
+   explicit response_cache(size_t max_bytes = size_t(64) << 20) : shard_budget(max_bytes / shard_count) {}
+
+   std::optional<serialized_response> find(std::string_view method, uint32_t format, std::string_view body) {
+      const uint64_t key = hash(method, format, body);
+      auto& s = shards[key % shard_count];
+      std::lock_guard lock{s.mutex};
+      const auto now = clock::now();
+      auto [it, end] = s.index.equal_range(key);
+      for (; it != end; ++it) {
+         auto& e = *it->second;
+         if (e.format != format || e.method != method || e.request != body) {
+            continue;
+         }
+         if (e.expires <= now) {
+            s.erase(it);
+            break;
+         }
+         s.lru.splice(s.lru.begin(), s.lru, it->second); // most recently used first
+         hits.fetch_add(1, std::memory_order_relaxed);
+         return e.value;
+      }
+      misses.fetch_add(1, std::memory_order_relaxed);
+      return std::nullopt;
+   }
+
+   void insert(std::string_view method, uint32_t format, std::string_view body, serialized_response value,
+               clock::duration ttl) {
+      const uint64_t key = hash(method, format, body);
+      auto& s = shards[key % shard_count];
+      std::lock_guard lock{s.mutex};
+      auto [it, end] = s.index.equal_range(key);
+      for (; it != end; ++it) {
+         const auto& e = *it->second;
+         if (e.format == format && e.method == method && e.request == body) {
+            s.erase(it);
+            break;
+         }
+      }
+
+      s.lru.push_front(entry{key, std::string(method), format, std::string(body), std::move(value),
+                             clock::now() + ttl});
+      s.bytes += s.lru.front().size();
+      s.index.emplace(key, s.lru.begin());
+      while (s.bytes > shard_budget && s.lru.size() > 1) {
+         auto oldest = std::prev(s.lru.end());
+         auto [first, last] = s.index.equal_range(oldest->key);
+         for (; first != last; ++first) {
+            if (first->second == oldest) {
+               s.erase(first);
+               break;
+            }
+         }
+         evictions.fetch_add(1, std::memory_order_relaxed);
+      }
+   }
+
+   stats snapshot() {
+      stats out{};
+      out.hits = hits.load(std::memory_order_relaxed);
+      out.misses = misses.load(std::memory_order_relaxed);
+      out.evictions = evictions.load(std::memory_order_relaxed);
+      for (auto& s : shards) {
+         std::lock_guard lock{s.mutex};
+         out.entries += s.lru.size();
+         out.bytes += s.bytes;
+      }
+      return out;
+   }
+
+private:
+   static constexpr size_t shard_count = 16;
+
+   struct entry {
+      uint64_t key = 0;
+      std::string method{};
+      uint32_t format = 0;
+      std::string request{};
+      serialized_response value{};
+      clock::time_point expires{};
+
+      size_t size() const { return method.size() + request.size() + (value.body ? value.body->size() : 0); }
+   };
+
+   struct shard {
+      std::mutex mutex;
+      std::list<entry> lru;
+      std::unordered_multimap<uint64_t, std::list<entry>::iterator> index;
+      size_t bytes = 0;
+
+      void erase(std::unordered_multimap<uint64_t, std::list<entry>::iterator>::iterator it) {
+         bytes -= it->second->size();
+         lru.erase(it->second);
+         index.erase(it);
+      }
+   };
+
+   size_t shard_budget;
+   shard shards[shard_count];
+   std::atomic<uint64_t> hits{0};
+   std::atomic<uint64_t> misses{0};
+   std::atomic<uint64_t> evictions{0};
+
+   static uint64_t hash(std::string_view method, uint32_t format, std::string_view body) {
+      uint64_t h = std::hash<std::string_view>{}(method);
+      h ^= std::hash<std::string_view>{}(body) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+      h ^= format + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+      return h;
+   }
+};
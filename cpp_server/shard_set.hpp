@@ -0,0 +1,145 @@
+#pragma once
+
+#include "worker_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// Shared-nothing execution: `count` shards, each a single thread that owns its own `T`.
+// Every connection is assigned to one shard and its requests for `T` run there, so a shard's
+// state is only ever touched by its own thread and needs no locking. The rare operation that
+// needs all shards (or another shard's state) is a message: a task queued on the owning
+// shard, whose result comes back through a future.
+//
+// A shard thread must not wait on another shard, which may be waiting on it; call() and
+// gather() refuse to from a shard thread. Run global operations on an ordinary pool.
+
+// Thrown by a call() whose shard has no room in its queue
+struct shard_busy : std::runtime_error {
+   shard_busy() : std::runtime_error("shard queue full") {}
+};
+
+template <class T>
+class shard_set {
+public:
+   shard_set(size_t count, size_t max_queued, codel controller, std::function<void()> on_start = {}) {
+      shards.reserve(count == 0 ? 1 : count);
+      for (size_t i = 0; i < std::max<size_t>(count, 1); ++i) {
+         shards.push_back(std::make_unique<shard>(max_queued, controller, on_start));
+      }
+   }
+
+   shard_set(const shard_set&) = delete;
+   shard_set& operator=(const shard_set&) = delete;
+
+   size_t size() const { return shards.size(); }
+
+   // Shard for a new connection: the one serving the fewest
+   size_t assign() {
+      size_t best = 0;
+      for (size_t i = 1; i < shards.size(); ++i) {
+         if (shards[i]->connections.load(std::memory_order_relaxed) <
+             shards[best]->connections.load(std::memory_order_relaxed)) {
+            best = i;
+         }
+      }
+      shards[best]->connections.fetch_add(1, std::memory_order_relaxed);
+      return best;
+   }
+
+   void release(size_t index) { shards[index]->connections.fetch_sub(1, std::memory_order_relaxed); }
+
+   size_t connections(size_t index) const { return shards[index]->connections.load(std::memory_order_relaxed); }
+
+   // The state of the shard running the calling thread, or nullptr off the shards
+   static T* local() { return current; }
+
+   // Queue a request on a shard; as worker_pool::submit
+   bool submit(size_t index, std::function<void()> run, std::function<void()> shed,
+               worker_pool::priority level = worker_pool::priority::normal) {
+      auto& target = *shards[index];
+      return target.pool.submit(
+         [&target, run = std::move(run)] {
+            current = &target.state;
+            run();
+         },
+         std::move(shed), level);
+   }
+
+   // Run `f(state)` on shard `index` and return its result. Runs at once when called from that
+   // shard; otherwise it is queued ahead of the shard's requests.
+   template <class F>
+   std::future<std::invoke_result_t<F, T&>> call(size_t index, F f) {
+      using result = std::invoke_result_t<F, T&>;
+      auto& target = *shards[index];
+      auto promise = std::make_shared<std::promise<result>>();
+      auto future = promise->get_future();
+      if (current == &target.state) {
+         fulfil(*promise, f, target.state);
+         return future;
+      }
+      if (current) {
+         throw std::logic_error("a shard cannot wait on another shard");
+      }
+      auto run = [&target, promise, f = std::move(f)]() mutable {
+         current = &target.state;
+         fulfil(*promise, f, target.state);
+      };
+      auto refused = [promise] {
+         promise->set_exception(std::make_exception_ptr(shard_busy{}));
+      };
+      if (!target.pool.submit(run, refused, worker_pool::priority::high)) {
+         refused();
+      }
+      return future;
+   }
+
+   // `f(state)` on every shard, in shard order: the per-shard parts of a global read or
+   // update, for the caller to fold
+   template <class F>
+   std::vector<std::invoke_result_t<F, T&>> gather(F f) {
+      std::vector<std::future<std::invoke_result_t<F, T&>>> pending;
+      pending.reserve(shards.size());
+      for (size_t i = 0; i < shards.size(); ++i) {
+         pending.push_back(call(i, f));
+      }
+      std::vector<std::invoke_result_t<F, T&>> results;
+      results.reserve(shards.size());
+      for (auto& part : pending) {
+         results.push_back(part.get());
+      }
+      return results;
+   }
+
+   worker_pool::stats snapshot(size_t index) { return shards[index]->pool.snapshot(); }
+
+private:
+   struct shard {
+      shard(size_t max_queued, codel controller, std::function<void()> on_start)
+         : pool(1, max_queued, controller, std::move(on_start)) {}
+      T state{};
+      std::atomic<size_t> connections{0};
+      worker_pool pool; // declared last: its thread is joined before `state` is destroyed
+   };
+
+   static inline thread_local T* current = nullptr;
+
+   std::vector<std::unique_ptr<shard>> shards;
+
+   template <class R, class F>
+   static void fulfil(std::promise<R>& promise, F& f, T& state) {
+      try {
+         promise.set_value(f(state));
+      }
+      catch (...) {
+         promise.set_exception(std::current_exception());
+      }
+   }
+};
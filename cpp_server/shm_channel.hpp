@@ -0,0 +1,369 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// A shared-memory channel between a client and the server on the same host: memory mapped by
+// both processes holding two single-producer/single-consumer byte rings, one carrying request
+// frames to the server and one carrying response frames back. The rings carry the same bytes
+// a socket would, so frames larger than a ring simply stream through it.
+//
+// The server creates the memory as a memfd sealed against resizing and passes its descriptor
+// to the client over the Unix domain socket (SCM_RIGHTS). The client can write anything into
+// the rings, but it cannot shrink the memory under the server's mapping, which would kill
+// the server with SIGBUS on its next access.
+//
+// Layout (little-endian, mirrored by REPE.jl's SharedMemoryStream):
+//   0     uint64 magic "REPERING", uint32 version, uint32 capacity (bytes per ring, a power of two)
+//   16    uint32 closed, set by either side to end the channel
+//   256   request ring control
+//   512   response ring control
+//   4096  request ring data, then response ring data
+// Each ring control holds its consumer's position (head) and producer's position (tail) on
+// cache lines of their own, and a futex word plus a waiting flag for each side.
+//
+// Steady-state traffic never enters the kernel: a side that finds its ring empty (or full)
+// spins for a while first, and only sleeps on the futex if nothing arrives. The other side
+// makes the wake syscall only when the waiting flag says someone is asleep.
+inline constexpr uint64_t shm_magic = 0x474E495245504552; // "REPERING"
+inline constexpr uint32_t shm_version = 1;
+inline constexpr size_t shm_header_bytes = 4096;
+inline constexpr uint32_t shm_min_capacity = 4096;
+inline constexpr uint32_t shm_max_capacity = 1u << 30;
+
+struct shm_ring_control {
+   alignas(64) std::atomic<uint64_t> head;
+   alignas(64) std::atomic<uint64_t> tail;
+   alignas(64) std::atomic<uint32_t> data_signal; // bumped to wake a consumer waiting for data
+   std::atomic<uint32_t> consumer_waiting;
+   alignas(64) std::atomic<uint32_t> space_signal; // bumped to wake a producer waiting for space
+   std::atomic<uint32_t> producer_waiting;
+};
+
+struct shm_channel_header {
+   uint64_t magic;
+   uint32_t version;
+   uint32_t capacity;
+   std::atomic<uint32_t> closed;
+   alignas(256) shm_ring_control requests;
+   alignas(256) shm_ring_control responses;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free);
+static_assert(sizeof(shm_ring_control) == 256);
+static_assert(offsetof(shm_channel_header, closed) == 16);
+static_assert(offsetof(shm_channel_header, requests) == 256);
+static_assert(offsetof(shm_channel_header, responses) == 512);
+static_assert(sizeof(shm_channel_header) <= shm_header_bytes);
+
+// How long a side spins before sleeping. The budget adapts: it doubles (up to `limit`) when
+// the data came while spinning, and halves when spinning was wasted, so an idle channel stops
+// burning a core while a busy one keeps its round trips in user space.
+struct spin_policy {
+   std::chrono::nanoseconds limit{std::chrono::microseconds(50)};
+   std::chrono::nanoseconds budget{limit};
+
+   void hit() { budget = std::min(limit, budget * 2 + std::chrono::nanoseconds(100)); }
+   void miss() { budget = std::max(limit / 64, budget / 2); }
+};
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+   _mm_pause();
+#elif defined(__aarch64__)
+   asm volatile("yield");
+#endif
+}
+
+// Sleep until `word` no longer holds `expected`, a wake, or the timeout. Shared (not
+// FUTEX_PRIVATE) futexes, since the other side is another process. Without futexes, a short sleep.
+inline void futex_wait(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::nanoseconds timeout) {
+#if defined(__linux__)
+   const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+   timespec ts{static_cast<time_t>(seconds.count()), static_cast<long>((timeout - seconds).count())};
+   syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+   (void)word;
+   (void)expected;
+   std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, std::chrono::microseconds(200)));
+#endif
+}
+
+inline void futex_wake(std::atomic<uint32_t>& word) {
+#if defined(__linux__)
+   syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+   (void)word;
+#endif
+}
+
+// One direction of a channel. Positions only grow; the ring holds tail - head bytes. The peer
+// is another process that could write anything into the control block, so positions that do
+// not make sense close the channel instead of being trusted.
+class shm_ring {
+public:
+   shm_ring(shm_ring_control& control, char* data, uint32_t capacity, std::atomic<uint32_t>& closed)
+      : control(control), data(data), capacity(capacity), closed(closed) {}
+
+   // Copy as much of `bytes` as fits; never blocks
+   size_t write_some(std::string_view bytes) {
+      const uint64_t tail = control.tail.load(std::memory_order_relaxed);
+      const uint64_t used = tail - control.head.load(std::memory_order_acquire);
+      if (used > capacity) {
+         corrupt();
+         return 0;
+      }
+      const size_t n = std::min<size_t>(bytes.size(), capacity - used);
+      if (n == 0) {
+         return 0;
+      }
+      const size_t offset = tail & (capacity - 1);
+      const size_t first = std::min<size_t>(n, capacity - offset);
+      std::memcpy(data + offset, bytes.data(), first);
+      std::memcpy(data, bytes.data() + first, n - first);
+      control.tail.store(tail + n, std::memory_order_release);
+      notify(control.data_signal, control.consumer_waiting);
+      return n;
+   }
+
+   // Copy out up to `size` waiting bytes; never blocks
+   size_t read_some(char* out, size_t size) {
+      const uint64_t head = control.head.load(std::memory_order_relaxed);
+      const uint64_t available = control.tail.load(std::memory_order_acquire) - head;
+      if (available > capacity) {
+         corrupt();
+         return 0;
+      }
+      const size_t n = std::min<size_t>(size, available);
+      if (n == 0) {
+         return 0;
+      }
+      const size_t offset = head & (capacity - 1);
+      const size_t first = std::min<size_t>(n, capacity - offset);
+      std::memcpy(out, data + offset, first);
+      std::memcpy(out + first, data, n - first);
+      control.head.store(head + n, std::memory_order_release);
+      notify(control.space_signal, control.producer_waiting);
+      return n;
+   }
+
+   void wait_readable(spin_policy& spin) {
+      wait(control.data_signal, control.consumer_waiting, spin, [this] {
+         return control.tail.load(std::memory_order_acquire) != control.head.load(std::memory_order_relaxed);
+      });
+   }
+
+   void wait_writable(spin_policy& spin) {
+      wait(control.space_signal, control.producer_waiting, spin, [this] {
+         // Also true for impossible positions, which write_some then reports
+         return control.tail.load(std::memory_order_relaxed) - control.head.load(std::memory_order_acquire) !=
+                capacity;
+      });
+   }
+
+   // Wake both sides, e.g. after setting `closed`
+   void wake() {
+      control.data_signal.fetch_add(1, std::memory_order_release);
+      futex_wake(control.data_signal);
+      control.space_signal.fetch_add(1, std::memory_order_release);
+      futex_wake(control.space_signal);
+   }
+
+private:
+   shm_ring_control& control;
+   char* data;
+   uint32_t capacity;
+   std::atomic<uint32_t>& closed;
+
+   void corrupt() { closed.store(1, std::memory_order_release); }
+
+   // Wake the other side if it is asleep. The fence orders our position update before reading
+   // its flag, pairing with the fence in wait(), so a wake is never missed.
+   static void notify(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& waiting) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiting.load(std::memory_order_relaxed) != 0) {
+         signal.fetch_add(1, std::memory_order_release);
+         futex_wake(signal);
+      }
+   }
+
+   // Return once `ready()` or the channel is closed: spin for the budget, then sleep on the
+   // futex. Sleeps are bounded, so a peer that dies without waking us is noticed.
+   template <class Ready>
+   void wait(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& waiting, spin_policy& spin, Ready ready) {
+      auto done = [&] { return ready() || closed.load(std::memory_order_acquire) != 0; };
+      const auto until = std::chrono::steady_clock::now() + spin.budget;
+      do {
+         for (int i = 0; i < 64; ++i) {
+            if (done()) {
+               spin.hit();
+               return;
+            }
+            cpu_relax();
+         }
+      } while (std::chrono::steady_clock::now() < until);
+      spin.miss();
+      while (true) {
+         const uint32_t seen = signal.load(std::memory_order_acquire);
+         waiting.store(1, std::memory_order_relaxed);
+         std::atomic_thread_fence(std::memory_order_seq_cst);
+         if (done()) {
+            waiting.store(0, std::memory_order_relaxed);
+            return;
+         }
+         futex_wait(signal, seen, std::chrono::milliseconds(100));
+         waiting.store(0, std::memory_order_relaxed);
+         if (done()) {
+            return;
+         }
+      }
+   }
+};
+
+// The server's end of a channel: it reads the request ring and writes the response ring.
+// Reads come from one thread (the connection's reader) and writes from one thread at a time
+// (under the connection's write mutex), as the rings require.
+class shm_channel {
+public:
+   // A new channel of `capacity` bytes per ring in a sealed memfd. `fd` is left open for the
+   // caller to pass to the client and then close. Linux only: elsewhere there is no memory
+   // that can be shared with a client and guaranteed to keep its size.
+   static std::shared_ptr<shm_channel> create(uint32_t capacity, std::chrono::nanoseconds spin, int& fd,
+                                              std::string& error) {
+      fd = -1;
+      if (capacity < shm_min_capacity || capacity > shm_max_capacity || (capacity & (capacity - 1)) != 0) {
+         error = "Capacity must be a power of two from " + std::to_string(shm_min_capacity) + " to " +
+                 std::to_string(shm_max_capacity);
+         return nullptr;
+      }
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+      const size_t length = shm_header_bytes + 2 * size_t{capacity};
+      fd = memfd_create("repe-channel", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+      if (fd < 0) {
+         error = std::string("Cannot create channel memory: ") + std::strerror(errno);
+         return nullptr;
+      }
+      // Sealing the seals too, so the client cannot lift them
+      if (ftruncate(fd, static_cast<off_t>(length)) != 0 ||
+          fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+         error = std::string("Cannot size and seal channel memory: ") + std::strerror(errno);
+         ::close(std::exchange(fd, -1));
+         return nullptr;
+      }
+      void* base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (base == MAP_FAILED) {
+         error = "Cannot map channel memory";
+         ::close(std::exchange(fd, -1));
+         return nullptr;
+      }
+      // The memory starts zeroed: both rings empty, nobody waiting, not closed
+      auto* header = static_cast<shm_channel_header*>(base);
+      header->magic = shm_magic;
+      header->version = shm_version;
+      header->capacity = capacity;
+      return std::shared_ptr<shm_channel>{new shm_channel(base, length, capacity, spin)};
+#else
+      (void)spin;
+      error = "Shared-memory channels need sealed memfds (Linux)";
+      return nullptr;
+#endif
+   }
+
+   ~shm_channel() { munmap(base, length); }
+
+   shm_channel(const shm_channel&) = delete;
+   shm_channel& operator=(const shm_channel&) = delete;
+
+   uint32_t capacity() const { return capacity_bytes; }
+   bool closed() const { return header->closed.load(std::memory_order_acquire) != 0; }
+
+   // As recv() on a socket: up to `size` bytes (exactly `size` with `all`), waiting for the
+   // first. Returns 0 once the channel is closed and drained.
+   size_t receive(char* out, size_t size, bool all) {
+      auto& ring = request_ring;
+      size_t got = 0;
+      while (got < size) {
+         const size_t n = ring.read_some(out + got, size - got);
+         got += n;
+         if (got == size || (got > 0 && !all)) {
+            break;
+         }
+         if (n == 0) {
+            if (closed()) {
+               break;
+            }
+            ring.wait_readable(read_spin);
+         }
+      }
+      return got;
+   }
+
+   // Write all of `bytes`, waiting for space. False if the channel closed first.
+   bool send(std::string_view bytes) {
+      auto& ring = response_ring;
+      while (!bytes.empty()) {
+         if (closed()) {
+            return false;
+         }
+         const size_t n = ring.write_some(bytes);
+         bytes.remove_prefix(n);
+         if (n == 0) {
+            ring.wait_writable(write_spin);
+         }
+      }
+      return true;
+   }
+
+   // Write what fits of `bytes` without waiting
+   size_t send_some(std::string_view bytes) { return closed() ? 0 : response_ring.write_some(bytes); }
+
+   // End the channel and wake anyone waiting on either ring, on both sides
+   void close() {
+      header->closed.store(1, std::memory_order_release);
+      request_ring.wake();
+      response_ring.wake();
+   }
+
+private:
+   void* base;
+   size_t length;
+   shm_channel_header* header;
+   uint32_t capacity_bytes;
+   shm_ring request_ring;
+   shm_ring response_ring;
+   spin_policy read_spin;
+   spin_policy write_spin;
+
+   shm_channel(void* base, size_t length, uint32_t capacity, std::chrono::nanoseconds spin)
+      : base(base), length(length), header(static_cast<shm_channel_header*>(base)), capacity_bytes(capacity),
+        request_ring(header->requests, static_cast<char*>(base) + shm_header_bytes, capacity, header->closed),
+        response_ring(header->responses, static_cast<char*>(base) + shm_header_bytes + capacity, capacity,
+                      header->closed),
+        read_spin{spin, spin}, write_spin{spin, spin} {}
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Coalesces identical concurrent calls. The first caller with a given key runs the work;
+// callers that arrive with the same key while it is running wait for it and receive the
+// same result instead of repeating the work. Once the call finishes the key is released,
+// so later callers run it again (pair with response_cache to reuse results over time).
+template <class Result>
+class singleflight {
+public:
+   struct stats {
+      uint64_t executions = 0;
+      uint64_t joined = 0;
+   };
+
+   // Returns the result and whether this caller ran the work itself
+   template <class Work>
+   std::pair<Result, bool> run(const std::string& key, Work&& work) {
+      std::shared_ptr<call> flight;
+      bool leader = false;
+      {
+         std::lock_guard lock{mutex};
+         auto& slot = calls[key];
+         if (!slot) {
+            slot = std::make_shared<call>();
+            leader = true;
+         }
+         flight = slot;
+      }
+
+      if (!leader) {
+         joined.fetch_add(1, std::memory_order_relaxed);
+         std::unique_lock lock{flight->mutex};
+         flight->done_cv.wait(lock, [&] { return flight->done; });
+         if (flight->error) {
+            std::rethrow_exception(flight->error);
+         }
+         return {*flight->result, false};
+      }
+
+      executions.fetch_add(1, std::memory_order_relaxed);
+      std::optional<Result> result;
+      std::exception_ptr error;
+      try {
+         result.emplace(work());
+      }
+      catch (...) {
+         error = std::current_exception();
+      }
+
+      {
+         // Release the key first so that callers arriving from now on start a new call
+         std::lock_guard lock{mutex};
+         calls.erase(key);
+      }
+      {
+         std::lock_guard lock{flight->mutex};
+         flight->result = result;
+         flight->error = error;
+         flight->done = true;
+      }
+      flight->done_cv.notify_all();
+
+      if (error) {
+         std::rethrow_exception(error);
+      }
+      return {std::move(*result), true};
+   }
+
+   stats snapshot() const {
+      return {executions.load(std::memory_order_relaxed), joined.load(std::memory_order_relaxed)};
+   }
+
+private:
+   struct call {
+      std::mutex mutex;
+      std::condition_variable done_cv;
+      bool done = false;
+      std::optional<Result> result{};
+      std::exception_ptr error{};
+   };
+
+   std::mutex mutex;
+   std::unordered_map<std::string, std::shared_ptr<call>> calls;
+   std::atomic<uint64_t> executions{0};
+   std::atomic<uint64_t> joined{0};
+};
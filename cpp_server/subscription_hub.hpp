@@ -0,0 +1,446 @@
+#pragma once
+
+#include "client_connection.hpp"
+#include "json_patch.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Pushes registry changes to subscribed connections as notify frames.
+//
+// A change is serialized once per (path, body format) and the buffer is shared, reference
+// counted, by every subscriber of that path. Each subscriber holds at most one pending
+// value: a newer change replaces an unsent one (latest value wins), so a slow client
+// costs one buffer per subscription rather than a growing queue. Frames are written
+// without blocking; a connection whose socket stays full for longer than
+// slow_consumer_timeout is shut down, and its subscriptions are dropped.
+//
+// Delta subscribers receive merge patch writes as merge patches (body_format_merge_patch)
+// relative to their path, and the full JSON value for any other write. A delta that would be
+// coalesced with an unsent one is replaced by the full value instead, since dropping a patch
+// would corrupt the subscriber's copy. So is a delta that arrives after a later write was
+// already published for the path (concurrent writers publish in any order): the full value,
+// read afterwards, includes both writes.
+template <class Registry>
+class subscription_hub {
+public:
+   struct stats {
+      uint64_t published = 0;
+      uint64_t delivered = 0;
+      uint64_t coalesced = 0;
+      uint64_t slow_consumers = 0;
+   };
+
+   subscription_hub(Registry& registry, std::chrono::milliseconds slow_consumer_timeout = std::chrono::seconds(5))
+      : registry(registry), slow_consumer_timeout(slow_consumer_timeout) {
+      worker = std::thread([this] { run(); });
+   }
+
+   ~subscription_hub() {
+      {
+         std::lock_guard lock{mutex};
+         stopping = true;
+      }
+      cv.notify_all();
+      worker.join();
+   }
+
+   subscription_hub(const subscription_hub&) = delete;
+   subscription_hub& operator=(const subscription_hub&) = delete;
+
+   // Register interest in a JSON pointer; the current value is pushed right away.
+   // Returns false if the path does not name a readable registry value.
+   bool subscribe(const std::shared_ptr<client_connection>& connection, uint64_t id, std::string_view path,
+                  uint16_t format, bool delta = false) {
+      auto sub = std::make_shared<subscriber>();
+      sub->connection = connection;
+      sub->id = id;
+      sub->path = normalize(path);
+      sub->format = delta ? 2 : format; // deltas are JSON merge patches
+      sub->delta = delta;
+      format = sub->format;
+
+      std::shared_ptr<path_entry> entry;
+      {
+         std::lock_guard lock{mutex};
+         auto& slot = by_path[sub->path];
+         if (!slot) {
+            slot = std::make_shared<path_entry>();
+         }
+         entry = slot;
+      }
+
+      std::lock_guard publish_lock{entry->publish_mutex};
+      auto initial = std::make_shared<std::string>();
+      if (registry.read(sub->path, format, *initial)) {
+         std::lock_guard lock{mutex};
+         erase_if_empty(sub->path);
+         return false;
+      }
+      // Patches of writes older than this value must not be applied over it
+      entry->sequence = std::max(entry->sequence, registry.write_sequence());
+
+      std::lock_guard lock{mutex};
+      // The entry may have been erased while empty; re-attach it (or join its replacement)
+      auto& slot = by_path[sub->path];
+      if (!slot) {
+         slot = entry;
+      }
+      slot->subscribers.emplace_back(sub);
+      sub->pending = std::move(initial);
+      sub->pending_format = format;
+      sub->queued = true;
+      ready.emplace_back(std::move(sub));
+      cv.notify_one();
+      return true;
+   }
+
+   bool unsubscribe(const client_connection* connection, uint64_t id) {
+      std::lock_guard lock{mutex};
+      bool removed = false;
+      for (auto it = by_path.begin(); it != by_path.end();) {
+         auto& subs = it->second->subscribers;
+         const auto before = subs.size();
+         std::erase_if(subs, [&](const auto& sub) {
+            if (sub->connection.get() == connection && sub->id == id) {
+               sub->active = false;
+               return true;
+            }
+            return false;
+         });
+         removed |= subs.size() != before;
+         it = subs.empty() ? by_path.erase(it) : std::next(it);
+      }
+      return removed;
+   }
+
+   // Drop every subscription held by a connection. Must be called before its socket is closed.
+   void remove_connection(const client_connection* connection) {
+      std::lock_guard lock{mutex};
+      for (auto it = by_path.begin(); it != by_path.end();) {
+         auto& subs = it->second->subscribers;
+         std::erase_if(subs, [&](const auto& sub) {
+            if (sub->connection.get() == connection) {
+               sub->active = false;
+               return true;
+            }
+            return false;
+         });
+         it = subs.empty() ? by_path.erase(it) : std::next(it);
+      }
+   }
+
+   bool has_subscriptions(const client_connection* connection) const {
+      std::lock_guard lock{mutex};
+      for (const auto& [path, entry] : by_path) {
+         for (const auto& sub : entry->subscribers) {
+            if (sub->connection.get() == connection) {
+               return true;
+            }
+         }
+      }
+      return false;
+   }
+
+   // Notify subscribers of a changed path: subscriptions on the path itself, on any of its
+   // ancestors and on any of its descendants all see a new value. For a merge patch write,
+   // `body` is the patch; it lets delta subscribers receive only the change and skips
+   // subscriptions below the path that the patch did not touch. `sequence` is the registry's
+   // number for the write (see json_pointer_registry::on_write), 0 if unknown.
+   void publish(std::string_view changed_path, std::string_view body = {}, uint16_t format = 0,
+                uint64_t sequence = 0) {
+      const std::string changed = normalize(changed_path);
+      const bool has_delta = !body.empty() && format == body_format_merge_patch;
+
+      std::vector<std::pair<std::string, std::shared_ptr<path_entry>>> affected;
+      {
+         std::lock_guard lock{mutex};
+         if (by_path.empty()) {
+            return;
+         }
+         // Ancestors (and the path itself), walking back one segment at a time
+         for (size_t end = changed.size();; end = changed.rfind('/', end - 1)) {
+            auto it = by_path.find(std::string_view{changed}.substr(0, end));
+            if (it != by_path.end()) {
+               affected.emplace_back(it->first, it->second);
+            }
+            if (end == 0 || end == std::string::npos) {
+               break;
+            }
+         }
+         // Descendants sort between "<path>/" and "<path>0" ('0' follows '/')
+         for (auto it = by_path.lower_bound(changed + '/'); it != by_path.end() && it->first < changed + '0'; ++it) {
+            affected.emplace_back(it->first, it->second);
+         }
+      }
+
+      for (auto& [path, entry] : affected) {
+         relative_delta delta{};
+         if (has_delta) {
+            delta = rebase_merge_patch(changed, path, body);
+            if (delta.kind == delta_kind::unchanged) {
+               continue;
+            }
+         }
+         publish_entry(path, *entry, delta, sequence);
+      }
+   }
+
+   stats snapshot() const {
+      stats s{};
+      s.published = published.load(std::memory_order_relaxed);
+      s.delivered = delivered.load(std::memory_order_relaxed);
+      s.coalesced = coalesced.load(std::memory_order_relaxed);
+      s.slow_consumers = slow_consumers.load(std::memory_order_relaxed);
+      return s;
+   }
+
+private:
+   struct subscriber {
+      std::shared_ptr<client_connection> connection{};
+      uint64_t id{};
+      std::string path{};
+      uint16_t format{};
+      bool delta = false;
+      std::atomic<bool> active{true};
+
+      // Guarded by the hub mutex
+      std::shared_ptr<const std::string> pending{};
+      uint16_t pending_format{};
+      bool queued = false;
+
+      // Only touched by the delivery thread
+      bool stalled = false;
+      std::chrono::steady_clock::time_point stalled_since{};
+   };
+
+   struct path_entry {
+      // Orders serialize-and-store for a path so an older value never replaces a newer one
+      std::mutex publish_mutex;
+      uint64_t sequence = 0; // latest write published for the path (guarded by publish_mutex)
+      std::vector<std::shared_ptr<subscriber>> subscribers{}; // guarded by the hub mutex
+   };
+
+   static constexpr auto retry_interval = std::chrono::milliseconds(10);
+
+   Registry& registry;
+   const std::chrono::milliseconds slow_consumer_timeout;
+
+   mutable std::mutex mutex;
+   std::condition_variable cv;
+   std::map<std::string, std::shared_ptr<path_entry>, std::less<>> by_path{};
+   std::deque<std::shared_ptr<subscriber>> ready{};
+   bool stopping = false;
+   std::thread worker;
+
+   std::atomic<uint64_t> published{0};
+   std::atomic<uint64_t> delivered{0};
+   std::atomic<uint64_t> coalesced{0};
+   std::atomic<uint64_t> slow_consumers{0};
+
+   // "/a/b/" and "a/b" both become "/a/b"; "/" becomes "" (the root)
+   static std::string normalize(std::string_view path) {
+      while (!path.empty() && path.back() == '/') {
+         path.remove_suffix(1);
+      }
+      if (path.empty()) {
+         return {};
+      }
+      std::string out;
+      if (path.front() != '/') {
+         out.push_back('/');
+      }
+      out.append(path);
+      return out;
+   }
+
+   void erase_if_empty(const std::string& path) {
+      auto it = by_path.find(path);
+      if (it != by_path.end() && it->second->subscribers.empty()) {
+         by_path.erase(it);
+      }
+   }
+
+   void publish_entry(const std::string& path, path_entry& entry, relative_delta& delta, uint64_t sequence) {
+      std::lock_guard publish_lock{entry.publish_mutex};
+      if (sequence < entry.sequence || sequence == 0) {
+         delta.kind = delta_kind::full; // out of order (or unordered): only the current value is safe
+      }
+      entry.sequence = std::max(entry.sequence, sequence);
+
+      // Delta subscribers with an unsent value need the full value. Only delivery can clear
+      // `pending` while publish_mutex is held, so this snapshot can only err towards full.
+      std::vector<std::shared_ptr<subscriber>> subs;
+      std::vector<bool> needs_full;
+      {
+         std::lock_guard lock{mutex};
+         subs = entry.subscribers;
+         for (const auto& sub : subs) {
+            needs_full.push_back(!sub->delta || delta.kind != delta_kind::patch || sub->pending);
+         }
+      }
+      if (subs.empty()) {
+         return;
+      }
+
+      // One serialization per body format, shared by every subscriber
+      std::shared_ptr<const std::string> buffers[2]{}; // BEVE, JSON
+      for (size_t i = 0; i < subs.size(); ++i) {
+         auto& buffer = buffers[subs[i]->format == 1 ? 0 : 1];
+         if (needs_full[i] && !buffer) {
+            auto body = std::make_shared<std::string>();
+            if (registry.read(path, subs[i]->format == 1 ? 1 : 2, *body)) {
+               return;
+            }
+            buffer = std::move(body);
+            published.fetch_add(1, std::memory_order_relaxed);
+         }
+      }
+      std::shared_ptr<const std::string> patch{};
+      if (delta.kind == delta_kind::patch) {
+         patch = std::make_shared<const std::string>(std::move(delta.patch));
+      }
+
+      std::lock_guard lock{mutex};
+      for (size_t i = 0; i < subs.size(); ++i) {
+         auto& sub = subs[i];
+         if (!sub->active) {
+            continue;
+         }
+         if (sub->pending) {
+            coalesced.fetch_add(1, std::memory_order_relaxed);
+         }
+         if (needs_full[i]) {
+            sub->pending = buffers[sub->format == 1 ? 0 : 1];
+            sub->pending_format = sub->format == 1 ? 1 : 2;
+         }
+         else {
+            sub->pending = patch;
+            sub->pending_format = body_format_merge_patch;
+         }
+         if (!sub->queued) {
+            sub->queued = true;
+            ready.emplace_back(sub);
+         }
+      }
+      cv.notify_one();
+   }
+
+   void run() {
+      std::vector<std::shared_ptr<subscriber>> batch;
+      std::vector<std::shared_ptr<subscriber>> retry;
+
+      std::unique_lock lock{mutex};
+      while (!stopping) {
+         if (ready.empty()) {
+            if (retry.empty()) {
+               cv.wait(lock, [&] { return stopping || !ready.empty(); });
+            }
+            else {
+               cv.wait_for(lock, retry_interval, [&] { return stopping || !ready.empty(); });
+            }
+            if (stopping) {
+               break;
+            }
+         }
+         batch.assign(ready.begin(), ready.end());
+         ready.clear();
+         lock.unlock();
+
+         // A stalled subscriber may have been queued again by a newer change
+         batch.insert(batch.end(), retry.begin(), retry.end());
+         retry.clear();
+         std::sort(batch.begin(), batch.end());
+         batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+
+         for (auto& sub : batch) {
+            if (!deliver(*sub)) {
+               retry.emplace_back(std::move(sub));
+            }
+         }
+         batch.clear();
+         lock.lock();
+      }
+   }
+
+   // Returns false if the subscriber should be retried later
+   bool deliver(subscriber& sub) {
+      auto& connection = *sub.connection;
+      std::unique_lock write_lock{connection.write_mutex, std::try_to_lock};
+      if (!write_lock) {
+         return false; // a response is being written right now
+      }
+      if (!sub.active || !connection.open) {
+         return true;
+      }
+
+      auto status = connection.flush_partial();
+      if (status == client_connection::send_status::would_block) {
+         return stalled(sub);
+      }
+
+      std::shared_ptr<const std::string> body;
+      uint16_t body_format{};
+      {
+         std::lock_guard lock{mutex};
+         body = std::move(sub.pending);
+         body_format = sub.pending_format;
+         sub.pending.reset();
+         sub.queued = false;
+      }
+      if (status == client_connection::send_status::closed || !body) {
+         sub.stalled = false;
+         return true;
+      }
+
+      outbound_frame frame{};
+      frame.query = sub.path;
+      frame.body = std::move(body);
+      frame.header.notify = true;
+      frame.header.id = sub.id;
+      frame.header.query_format = 1; // JSON pointer
+      frame.header.body_format = body_format;
+      frame.header.query_length = frame.query.size();
+      frame.header.body_length = frame.body->size();
+      frame.header.length = frame.size();
+
+      status = connection.try_send(std::move(frame));
+      if (status == client_connection::send_status::closed) {
+         return true;
+      }
+      delivered.fetch_add(1, std::memory_order_relaxed);
+      if (status == client_connection::send_status::would_block) {
+         return stalled(sub);
+      }
+      sub.stalled = false;
+      return true;
+   }
+
+   bool stalled(subscriber& sub) {
+      const auto now = std::chrono::steady_clock::now();
+      if (!sub.stalled) {
+         sub.stalled = true;
+         sub.stalled_since = now;
+         return false;
+      }
+      if (now - sub.stalled_since > slow_consumer_timeout) {
+         slow_consumers.fetch_add(1, std::memory_order_relaxed);
+         std::cerr << "Dropping slow subscriber on " << sub.path << " (id " << sub.id << ")\n";
+         // The reading thread sees the shutdown and removes the connection's subscriptions
+         sub.connection->shutdown();
+         return true;
+      }
+      return false;
+   }
+};
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Hierarchical timing wheel (Varghese & Lauck) run by its own thread. Scheduling and
+// cancelling are O(1) whatever the number of timers, so every connection and request can
+// carry its own timeouts: five levels of 64 slots, where a timer sits in the finest level
+// whose range reaches its expiry and moves down a level each time the level below wraps.
+// Expiry is rounded up to whole ticks, so a timer fires no earlier than asked and at most
+// about a tick late.
+//
+// Timers live in a slab addressed by id, with a generation count so that a stale id (of a
+// timer that fired or was cancelled) never touches a newer timer in the same slot.
+// Callbacks run on the wheel's thread one at a time and must be short.
+class timer_wheel {
+public:
+   using clock = std::chrono::steady_clock;
+   using timer_id = uint64_t; // 0 is never a timer
+
+   explicit timer_wheel(clock::duration tick = std::chrono::milliseconds(10))
+      : tick(tick > clock::duration::zero() ? tick : clock::duration(1)) {
+      heads.fill(none);
+      thread = std::thread([this] { loop(); });
+   }
+
+   ~timer_wheel() {
+      {
+         std::lock_guard lock{mutex};
+         stopping = true;
+      }
+      wake.notify_all();
+      thread.join();
+   }
+
+   timer_wheel(const timer_wheel&) = delete;
+   timer_wheel& operator=(const timer_wheel&) = delete;
+
+   // Run `fire` once, `after` from now
+   timer_id schedule(clock::duration after, std::function<void()> fire) {
+      return schedule_repeating(after, [fire = std::move(fire)] {
+         fire();
+         return clock::duration::zero();
+      });
+   }
+
+   // Run `fire` `after` from now. It returns how long until it should run again, or zero
+   // to stop; the timer keeps its id, so one cancel() stops it whenever it is next due.
+   timer_id schedule_repeating(clock::duration after, std::function<clock::duration()> fire) {
+      std::lock_guard lock{mutex};
+      uint32_t index;
+      if (free_list.empty()) {
+         index = static_cast<uint32_t>(nodes.size());
+         nodes.emplace_back();
+      }
+      else {
+         index = free_list.back();
+         free_list.pop_back();
+      }
+      auto& n = nodes[index];
+      n.fire = std::move(fire);
+      n.cancelled = false;
+      n.expires = current + ticks(after);
+      link(index);
+      if (active++ == 0) {
+         wake.notify_one(); // the thread sleeps without a deadline while there are no timers
+      }
+      return (static_cast<uint64_t>(n.generation) << 32) | (static_cast<uint64_t>(index) + 1);
+   }
+
+   // Stop a timer. Returns true if it was stopped before running. If its callback is running
+   // at that moment, waits for the callback to return (and stops it running again), so that
+   // afterwards nothing it refers to is used by the wheel.
+   bool cancel(timer_id id) {
+      std::unique_lock lock{mutex};
+      const auto index = find(id);
+      if (index == none) {
+         return false;
+      }
+      auto& n = nodes[index];
+      switch (n.state) {
+      case phase::linked:
+         unlink(index);
+         release(index);
+         return true;
+      case phase::pending:
+         n.cancelled = true; // the thread frees it instead of running it
+         return true;
+      case phase::running:
+         n.cancelled = true;
+         if (std::this_thread::get_id() != thread.get_id()) {
+            finished.wait(lock, [&] { return find(id) == none || nodes[index].state != phase::running; });
+         }
+         return false;
+      case phase::free:
+         break;
+      }
+      return false;
+   }
+
+   // Timers scheduled and not yet finished
+   size_t size() {
+      std::lock_guard lock{mutex};
+      return active;
+   }
+
+private:
+   static constexpr uint32_t none = UINT32_MAX;
+   static constexpr unsigned bits = 6;
+   static constexpr uint64_t slots = uint64_t{1} << bits;
+   static constexpr uint64_t mask = slots - 1;
+   static constexpr unsigned levels = 5;
+   static constexpr uint64_t max_ticks = (uint64_t{1} << (bits * levels)) - 1;
+
+   enum class phase : uint8_t { free, linked, pending, running };
+
+   struct node {
+      std::function<clock::duration()> fire{};
+      uint64_t expires = 0;
+      uint32_t generation = 0;
+      uint32_t prev = none;
+      uint32_t next = none;
+      uint32_t slot = none;
+      phase state = phase::free;
+      bool cancelled = false;
+   };
+
+   clock::duration tick;
+   std::mutex mutex;
+   std::condition_variable wake;
+   std::condition_variable finished;
+   std::vector<node> nodes;
+   std::vector<uint32_t> free_list;
+   std::array<uint32_t, levels * slots> heads{};
+   uint64_t current = 0; // the next tick to expire
+   size_t active = 0;
+   bool stopping = false;
+   std::thread thread; // started last, once the wheel is ready
+
+   uint64_t ticks(clock::duration after) const {
+      if (after <= clock::duration::zero()) {
+         return 0;
+      }
+      const auto count = static_cast<uint64_t>((after + tick - clock::duration(1)) / tick);
+      return count < max_ticks ? count : max_ticks;
+   }
+
+   uint32_t find(timer_id id) const {
+      const auto low = static_cast<uint32_t>(id & 0xffffffff);
+      if (low == 0 || low > nodes.size()) {
+         return none;
+      }
+      const uint32_t index = low - 1;
+      const auto& n = nodes[index];
+      return (n.state != phase::free && n.generation == static_cast<uint32_t>(id >> 32)) ? index : none;
+   }
+
+   // Slot for a timer relative to `current`: the finest level whose range covers it
+   void link(uint32_t index) {
+      auto& n = nodes[index];
+      const uint64_t delta = n.expires > current ? n.expires - current : 0;
+      uint32_t slot;
+      if (delta == 0) {
+         slot = static_cast<uint32_t>(current & mask);
+      }
+      else {
+         unsigned level = 0;
+         while (level + 1 < levels && delta >= (uint64_t{1} << (bits * (level + 1)))) {
+            ++level;
+         }
+         slot = static_cast<uint32_t>(level * slots + ((n.expires >> (bits * level)) & mask));
+      }
+      n.slot = slot;
+      n.state = phase::linked;
+      n.prev = none;
+      n.next = heads[slot];
+      if (n.next != none) {
+         nodes[n.next].prev = index;
+      }
+      heads[slot] = index;
+   }
+
+   void unlink(uint32_t index) {
+      auto& n = nodes[index];
+      if (n.prev != none) {
+         nodes[n.prev].next = n.next;
+      }
+      else {
+         heads[n.slot] = n.next;
+      }
+      if (n.next != none) {
+         nodes[n.next].prev = n.prev;
+      }
+      n.prev = n.next = n.slot = none;
+   }
+
+   void release(uint32_t index) {
+      auto& n = nodes[index];
+      n.fire = nullptr;
+      n.state = phase::free;
+      ++n.generation;
+      free_list.push_back(index);
+      --active;
+   }
+
+   // Detach every timer in a slot, returning the head of the detached list
+   uint32_t take(uint32_t slot) {
+      const uint32_t head = heads[slot];
+      heads[slot] = none;
+      return head;
+   }
+
+   // Expire one tick: first move timers down from coarser levels whose slot comes due,
+   // then collect the timers in this tick's slot
+   void advance(std::vector<uint32_t>& due) {
+      if ((current & mask) == 0) {
+         for (unsigned level = 1; level < levels; ++level) {
+            const uint64_t index = (current >> (bits * level)) & mask;
+            for (uint32_t i = take(static_cast<uint32_t>(level * slots + index)); i != none;) {
+               const uint32_t next = nodes[i].next;
+               link(i);
+               i = next;
+            }
+            if (index != 0) {
+               break;
+            }
+         }
+      }
+      for (uint32_t i = take(static_cast<uint32_t>(current & mask)); i != none;) {
+         const uint32_t next = nodes[i].next;
+         nodes[i].state = phase::pending;
+         nodes[i].prev = nodes[i].next = nodes[i].slot = none;
+         due.push_back(i);
+         i = next;
+      }
+      ++current;
+   }
+
+   void loop() {
+      std::vector<uint32_t> due;
+      std::unique_lock lock{mutex};
+      auto next_tick = clock::now() + tick;
+      while (!stopping) {
+         if (active == 0) {
+            wake.wait(lock, [this] { return stopping || active > 0; });
+            next_tick = clock::now() + tick;
+            continue;
+         }
+         wake.wait_until(lock, next_tick, [this] { return stopping; });
+         const auto now = clock::now();
+         while (next_tick <= now) {
+            advance(due);
+            next_tick += tick;
+         }
+         for (const uint32_t index : due) {
+            run(index, lock);
+         }
+         due.clear();
+      }
+   }
+
+   void run(uint32_t index, std::unique_lock<std::mutex>& lock) {
+      if (nodes[index].cancelled) {
+         release(index);
+         return;
+      }
+      nodes[index].state = phase::running;
+      auto fire = std::move(nodes[index].fire); // nodes may be reallocated while unlocked
+      lock.unlock();
+      const auto again = fire();
+      lock.lock();
+      auto& n = nodes[index];
+      if (!n.cancelled && again > clock::duration::zero()) {
+         n.fire = std::move(fire);
+         n.expires = current + ticks(again);
+         link(index);
+      }
+      else {
+         release(index);
+      }
+      finished.notify_all();
+   }
+};
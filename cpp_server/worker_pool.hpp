@@ -0,0 +1,143 @@
+#pragma once
+
+#include "codel.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running submitted tasks, in FIFO order within each priority.
+// Connection threads only read and parse frames and hand requests to the pool, so they stay
+// free to read control messages (such as cancel) while earlier requests are still running.
+//
+// Admission is bounded: submit() refuses work once `max_queued` tasks are waiting, and a
+// CoDel controller sheds tasks at dequeue once queueing delay has stayed above target.
+// A refused or shed task has its `shed` callback run instead, which should answer cheaply
+// (e.g. with a busy error) so the client can back off or go elsewhere.
+//
+// High priority tasks are taken before any normal one, so cheap control-plane calls do not
+// wait behind a backlog of heavy work (they still wait for a worker to free up; give them
+// a pool of their own when that is too long).
+//
+// `on_start` runs first on each worker thread, e.g. to pin it to a core (cpu_placement.hpp).
+class worker_pool {
+public:
+   using clock = std::chrono::steady_clock;
+
+   enum class priority { high, normal };
+
+   struct stats {
+      uint64_t queued = 0;
+      uint64_t refused = 0; // queue full at submit
+      uint64_t shed = 0;    // dropped by CoDel at dequeue
+   };
+
+   explicit worker_pool(size_t threads = std::thread::hardware_concurrency(), size_t max_queued = 1024,
+                        codel controller = codel{}, std::function<void()> on_start = {})
+      : max_queued(max_queued), controller(controller) {
+      if (threads == 0) {
+         threads = 1;
+      }
+      workers.reserve(threads);
+      for (size_t i = 0; i < threads; ++i) {
+         workers.emplace_back([this, on_start] {
+            if (on_start) {
+               on_start();
+            }
+            work();
+         });
+      }
+   }
+
+   ~worker_pool() {
+      {
+         std::lock_guard lock{mutex};
+         stopping = true;
+      }
+      ready.notify_all();
+      for (auto& worker : workers) {
+         worker.join();
+      }
+   }
+
+   worker_pool(const worker_pool&) = delete;
+   worker_pool& operator=(const worker_pool&) = delete;
+
+   // Queue `run`, or return false (without running either callback) if the queue is full
+   bool submit(std::function<void()> run, std::function<void()> shed, priority level = priority::normal) {
+      {
+         std::lock_guard lock{mutex};
+         if (high.size() + tasks.size() >= max_queued) {
+            refused.fetch_add(1, std::memory_order_relaxed);
+            return false;
+         }
+         auto& queue = (level == priority::high) ? high : tasks;
+         queue.push_back(task{std::move(run), std::move(shed), clock::now()});
+      }
+      ready.notify_one();
+      return true;
+   }
+
+   stats snapshot() {
+      std::lock_guard lock{mutex};
+      return {high.size() + tasks.size(), refused.load(std::memory_order_relaxed),
+              shed.load(std::memory_order_relaxed)};
+   }
+
+   size_t size() const { return workers.size(); }
+
+private:
+   struct task {
+      std::function<void()> run;
+      std::function<void()> shed;
+      clock::time_point enqueued;
+   };
+
+   size_t max_queued;
+   codel controller;
+   std::mutex mutex;
+   std::condition_variable ready;
+   std::deque<task> high;
+   std::deque<task> tasks;
+   std::vector<std::thread> workers;
+   bool stopping = false;
+   std::atomic<uint64_t> refused{0};
+   std::atomic<uint64_t> shed{0};
+
+   void work() {
+      while (true) {
+         task next;
+         bool drop = false;
+         {
+            std::unique_lock lock{mutex};
+            ready.wait(lock, [this] { return stopping || !high.empty() || !tasks.empty(); });
+            if (!high.empty()) {
+               next = std::move(high.front());
+               high.pop_front(); // never shed: these are cheap and jump the backlog
+            }
+            else if (!tasks.empty()) {
+               next = std::move(tasks.front());
+               tasks.pop_front();
+               const auto now = clock::now();
+               drop = controller.should_drop(now - next.enqueued, now);
+            }
+            else {
+               return; // stopping, and nothing left to run
+            }
+         }
+         if (drop) {
+            shed.fetch_add(1, std::memory_order_relaxed);
+            next.shed();
+         }
+         else {
+            next.run();
+         }
+      }
+   }
+};
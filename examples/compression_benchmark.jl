@@ -0,0 +1,101 @@
+#!/usr/bin/env julia
+
+# Compression ratio versus CPU time for REPE body codecs.
+#
+# Needs CodecZstd and CodecLz4 in the environment. The dictionary rows need the `zstd`
+# command line tool, which trains the dictionary from sample messages:
+#
+#   julia --project examples/compression_benchmark.jl
+
+using REPE
+using CodecZstd
+using CodecLz4
+
+println("REPE Body Compression Benchmark")
+println("===============================")
+println()
+
+# A small, repetitive message like the ones a telemetry or control client sends all day
+function reading(i)
+    Dict(
+        "sensor" => "rack-$(i % 16)/probe-$(i % 7)",
+        "unit" => "kelvin",
+        "value" => 290.0 + (i % 100) / 10,
+        "status" => i % 50 == 0 ? "warning" : "ok",
+        "sequence" => i,
+    )
+end
+
+small_json = [encode_body(reading(i), BODY_JSON) for i in 1:2000]
+large_json = encode_body([reading(i) for i in 1:20_000], BODY_JSON)
+large_beve = encode_body(Dict("values" => [sin(i / 100) for i in 1:200_000]), BODY_BEVE)
+
+# Mean time per call of f(), over at least `seconds`
+function time_per_call(f; seconds = 0.5)
+    f()   # compile
+    calls = 0
+    start = time_ns()
+    while time_ns() - start < seconds * 1e9
+        f()
+        calls += 1
+    end
+    return (time_ns() - start) / 1e9 / calls
+end
+
+function report(name, bodies::Vector{Vector{UInt8}}, codec; level = 3, dictionary = nothing)
+    original = sum(length, bodies)
+    compressed = [compress_body(codec, b; level = level, dictionary = dictionary) for b in bodies]
+    total = sum(length, compressed)
+    format = compressed_format(codec, BODY_RAW_BINARY)
+    @assert all(decompress_body(format, c) == b for (c, b) in zip(compressed, bodies))
+    t_compress = time_per_call(() -> foreach(b -> compress_body(codec, b; level = level, dictionary = dictionary), bodies))
+    t_decompress = time_per_call(() -> foreach(c -> decompress_body(format, c), compressed))
+    mb = original / 1e6
+    println(rpad(name, 28), lpad(string(round(original / total, digits = 2), "x"), 8),
+            lpad(string(round(mb / t_compress, digits = 1)), 14),
+            lpad(string(round(mb / t_decompress, digits = 1)), 16))
+end
+
+function table(title, bodies; dictionary = nothing)
+    println(title)
+    println(rpad("codec", 28), lpad("ratio", 8), lpad("compress MB/s", 14), lpad("decompress MB/s", 16))
+    report("lz4", bodies, :lz4)
+    for level in (1, 3, 9, 19)
+        report("zstd level $level", bodies, :zstd; level = level)
+    end
+    if dictionary !== nothing
+        for level in (1, 3, 9)
+            report("zstd level $level + dictionary", bodies, :zstd; level = level, dictionary = dictionary)
+        end
+    end
+    println()
+end
+
+# Train a dictionary on the first half of the small messages and measure on the second half
+function train_dictionary(samples)
+    Sys.which("zstd") === nothing && return nothing
+    dir = mktempdir()
+    for (i, sample) in enumerate(samples)
+        write(joinpath(dir, "sample$i.json"), sample)
+    end
+    path = joinpath(dir, "messages.dict")
+    run(pipeline(`zstd --train -q -r $dir -o $path --maxdict=16384`, stderr = devnull))
+    return read(path)
+end
+
+dictionary = train_dictionary(small_json[1:1000])
+if dictionary === nothing
+    println("zstd tool not found: skipping dictionary rows")
+    println()
+else
+    load_dictionary!(dictionary)
+end
+
+table("Small JSON messages (~$(sum(length, small_json[1001:end]) ÷ 1000) bytes each)", small_json[1001:end];
+      dictionary = dictionary)
+table("Large JSON body ($(length(large_json) ÷ 1024) KiB)", [large_json])
+table("Large BEVE body of Float64 ($(length(large_beve) ÷ 1024) KiB)", [large_beve])
+
+println("Without a dictionary, messages this small barely compress; a trained dictionary")
+println("supplies the repeated keys and values up front. Dense floating-point arrays usually")
+println("compress poorly with any codec: compress them when the link, not the CPU, is the bottleneck.")
@@ -0,0 +1,15 @@
+module REPECodecLz4Ext
+
+using REPE
+using CodecLz4
+
+# LZ4 is chosen for speed, so the level and dictionaries are not used
+_compress(data::Vector{UInt8}, level::Int, dictionary) = transcode(LZ4FrameCompressor, data)
+
+_decompress(data::Vector{UInt8}) = transcode(LZ4FrameDecompressor, data)
+
+function __init__()
+    REPE.register_codec!(:lz4, _compress, _decompress)
+end
+
+end
@@ -0,0 +1,60 @@
+module REPECodecZstdExt
+
+using REPE
+using CodecZstd
+using CodecZstd: LibZstd, TranscodingStreams
+
+function _check(code, what)
+    if LibZstd.ZSTD_isError(code) != 0
+        throw(ErrorException("zstd $what failed: $(unsafe_string(LibZstd.ZSTD_getErrorName(code)))"))
+    end
+    return code
+end
+
+function _compress(data::Vector{UInt8}, level::Int, dictionary)
+    if dictionary === nothing
+        codec = ZstdCompressor(level=level)
+        TranscodingStreams.initialize(codec)
+        try
+            return transcode(codec, data)
+        finally
+            TranscodingStreams.finalize(codec)
+        end
+    end
+    # One-shot compression records the content size, which decompression relies on
+    cctx = LibZstd.ZSTD_createCCtx()
+    try
+        out = Vector{UInt8}(undef, LibZstd.ZSTD_compressBound(length(data)))
+        n = _check(LibZstd.ZSTD_compress_usingDict(cctx, out, length(out), data, length(data),
+                                                   dictionary, length(dictionary), level), "compression")
+        return resize!(out, n)
+    finally
+        LibZstd.ZSTD_freeCCtx(cctx)
+    end
+end
+
+function _decompress(data::Vector{UInt8})
+    id = UInt32(LibZstd.ZSTD_getDictID_fromFrame(data, length(data)))
+    id == 0 && return transcode(ZstdDecompressor, data)
+    dictionary = REPE._zstd_dictionary(id)
+    dictionary === nothing && throw(ErrorException("Body needs zstd dictionary $id, which is not loaded"))
+    size = UInt64(LibZstd.ZSTD_getFrameContentSize(data, length(data)))
+    if size >= typemax(UInt64) - 1   # ZSTD_CONTENTSIZE_ERROR or ZSTD_CONTENTSIZE_UNKNOWN
+        throw(ErrorException("Dictionary-compressed body does not record its size"))
+    end
+    dctx = LibZstd.ZSTD_createDCtx()
+    try
+        out = Vector{UInt8}(undef, size)
+        n = _check(LibZstd.ZSTD_decompress_usingDict(dctx, out, length(out), data, length(data),
+                                                     dictionary, length(dictionary)), "decompression")
+        return resize!(out, n)
+    finally
+        LibZstd.ZSTD_freeDCtx(dctx)
+    end
+end
+
+function __init__()
+    REPE.register_codec!(:zstd, _compress, _decompress)
+end
+
+end
@@ -1,6 +1,8 @@
 module REPE
 
 using Sockets
+using Mmap
+using Libdl
 import BEVE as BEVEModule
 
 module JSONInternal
@@ -11,18 +13,24 @@ const JSONLib = JSONInternal.JSON
 
 export Header, Message, Client, Server
 export ErrorCode, QueryFormat, BodyFormat
-export send_request, send_request_async, send_notify
+export send_request, send_request_async, send_notify, deadline_budget, cancel_request, send_stream, hello
 export REPEError, ConnectionError, TimeoutError, ValidationError
 export batch, await_batch
+export subscribe, unsubscribe
 export connect, disconnect, listen, stop, isconnected, wait_for_server
+export EmbeddedServer
 export serialize_message, deserialize_message
 export parse_query, parse_body, encode_body
+export compress_body, decompress_body, compressed_format, inner_format, codec_of, codec_available
+export load_dictionary!
+export load_native_codec!, native_codec_available, transcode_body
 export set_nodelay!
 # Registry exports
 export Registry, serve, register, register!
-export parse_json_pointer, resolve_json_pointer, set_json_pointer!
+export parse_json_pointer, resolve_json_pointer, set_json_pointer!, apply_merge_patch!
 # Constants exports
 export HEADER_SIZE, QUERY_JSON_POINTER, BODY_JSON, BODY_BEVE, BODY_UTF8
+export BODY_MERGE_PATCH, BODY_JSON_PATCH, BODY_LZ4_BASE, BODY_ZSTD_BASE
 # UniUDP exports
 export UniUDP, UniUDPClient, UniUDPServer
 # Fleet exports (TCP)
@@ -39,8 +47,12 @@ export notify_all
 include("constants.jl")
 include("header.jl")
 include("message.jl")
+include("compression.jl")
+include("shared_memory.jl")
 include("client.jl")
 include("server.jl")
+include("embedded.jl")
+include("native_codec.jl")
 include("registry.jl")
 include("errors.jl")
 
@@ -1,28 +1,63 @@
 struct PendingRequest
     channel::Channel
     result_type::Union{Nothing, Type}
+    on_chunk::Union{Nothing, Function}   # receives the response body piece by piece instead
 end
 
+PendingRequest(channel::Channel, result_type::Union{Nothing, Type}) = PendingRequest(channel, result_type, nothing)
+
 mutable struct Client
-    socket::TCPSocket
+    socket::Union{TCPSocket, Base.PipeEndpoint, SharedMemoryStream}
     host::String
     port::Int
+    socket_path::Union{Nothing, String}   # Unix domain socket to connect to instead of host:port
+    shared_memory::Bool   # move the connection onto a shared-memory channel (needs socket_path)
     connected::Bool
     timeout::Float64
     next_id::Threads.Atomic{UInt64}
     pending_requests::Dict{UInt64, PendingRequest}
+    subscriptions::Dict{UInt64, Function}   # id => handler(::Message)
+    chunks::Dict{UInt64, Vector{UInt8}}     # id => body received so far of a response sent in chunks
     nodelay::Bool
+    send_deadline::Bool   # put each request's timeout in the header as a deadline budget
+    cancel_on_timeout::Bool   # tell the server to stop a request we stopped waiting for
+    compression::Symbol   # :none, :lz4 or :zstd for request bodies (and so for large replies)
+    compression_level::Int
+    dictionary::Union{Nothing, Vector{UInt8}}   # trained zstd dictionary used to compress
+    reply_format::Symbol   # asked of the server with each request (:request leaves it to the server)
     
     # Synchronization primitives
     state_lock::ReentrantLock        # Protects connected and socket
-    requests_lock::ReentrantLock     # Protects pending_requests
+    requests_lock::ReentrantLock     # Protects pending_requests, subscriptions and chunks
     write_lock::ReentrantLock        # Protects socket writes
     
-    function Client(host::String = "localhost", port::Int = 8080; timeout::Float64 = 30.0, nodelay::Bool = true)
-        new(TCPSocket(), host, port, false, timeout, 
+    function Client(host::String = "localhost", port::Int = 8080; timeout::Float64 = 30.0, nodelay::Bool = true,
+                    send_deadline::Bool = false, cancel_on_timeout::Bool = false,
+                    compression::Symbol = :none, compression_level::Int = 3,
+                    dictionary::Union{Nothing, Vector{UInt8}} = nothing, reply_format::Symbol = :request,
+                    socket_path::Union{Nothing, String} = nothing, shared_memory::Bool = false)
+        shared_memory && socket_path === nothing &&
+            throw(ArgumentError("shared_memory requires socket_path: channels are attached over a Unix domain socket"))
+        reply_format in REPLY_FORMATS ||
+            throw(ArgumentError("reply_format must be one of $(join(REPLY_FORMATS, ", ")), got :$reply_format"))
+        compression in (:none, :lz4, :zstd) ||
+            throw(ArgumentError("compression must be :none, :lz4 or :zstd, got :$compression"))
+        if dictionary !== nothing
+            compression === :zstd || throw(ArgumentError("A dictionary requires compression = :zstd"))
+            load_dictionary!(dictionary)   # replies may be compressed with it too
+        end
+        new(TCPSocket(), host, port, socket_path, shared_memory, false, timeout, 
             Threads.Atomic{UInt64}(1), 
             Dict{UInt64, PendingRequest}(),
+            Dict{UInt64, Function}(),
+            Dict{UInt64, Vector{UInt8}}(),
             nodelay,
+            send_deadline,
+            cancel_on_timeout,
+            compression,
+            compression_level,
+            dictionary,
+            reply_format,
             ReentrantLock(),
             ReentrantLock(),
             ReentrantLock())
@@ -83,8 +118,14 @@ function connect(client::Client)
         end
 
         try
-            client.socket = _connect_socket(client.host, client.port)
-            Sockets.nagle(client.socket, !client.nodelay)
+            if client.socket_path === nothing
+                client.socket = _connect_socket(client.host, client.port)
+                Sockets.nagle(client.socket, !client.nodelay)
+            elseif client.shared_memory
+                client.socket = _attach_shared_memory(client.socket_path)
+            else
+                client.socket = Sockets.connect(client.socket_path)
+            end
             client.connected = true
             
             # Start the response handler
@@ -101,7 +142,7 @@ end
 function set_nodelay!(client::Client, enabled::Bool)
     lock(client.state_lock) do
         client.nodelay = enabled
-        if client.connected
+        if client.connected && client.socket isa TCPSocket
             Sockets.nagle(client.socket, !enabled)
         end
     end
@@ -125,11 +166,27 @@ function disconnect(client::Client)
                     close(pending.channel)
                 end
                 empty!(client.pending_requests)
+                empty!(client.subscriptions)
             end
         end
     end
 end
 
+"""
+    deadline_budget(timeout::Real) -> UInt32
+
+Convert a timeout in seconds to the deadline budget carried in a request header's
+`reserved` field: whole milliseconds, at least 1 (0 means no deadline).
+
+# Examples
+```julia
+deadline_budget(2.5)  # 0x000009c4 (2500 ms)
+```
+"""
+function deadline_budget(timeout::Real)::UInt32
+    return UInt32(clamp(round(Int, timeout * 1000), 1, typemax(UInt32)))
+end
+
 function _get_next_id(client::Client)::UInt64
     # atomic_add! returns the old value and adds, so we get unique sequential IDs
     old_val = Threads.atomic_add!(client.next_id, UInt64(1))
@@ -142,33 +199,127 @@ function _send_message(client::Client, msg::Message)
         throw(ErrorException("Client not connected"))
     end
     
-    data = serialize_message(msg)
+    # Large bodies are written in place rather than copied into a frame buffer first
+    data = length(msg.body) < STREAM_THRESHOLD ? serialize_message(msg) : nothing
     
     # Lock for socket write to prevent message interleaving
     lock(client.write_lock) do
-        write(client.socket, data)
+        if data === nothing
+            write(client.socket, serialize_header(msg.header))
+            write(client.socket, msg.query)
+            write(client.socket, msg.body)
+        else
+            write(client.socket, data)
+        end
         flush(client.socket)
     end
 end
 
+# Write a request whose body is copied from `source` in pieces of `chunk_size` bytes, so it
+# never has to be held in memory whole
+function _send_streamed(client::Client, header::Header, query::String, source::IO, chunk_size::Int)
+    if !client.connected
+        throw(ErrorException("Client not connected"))
+    end
+    
+    buffer = Vector{UInt8}(undef, min(chunk_size, max(header.body_length, 1)))
+    lock(client.write_lock) do
+        write(client.socket, serialize_header(header))
+        write(client.socket, query)
+        remaining = header.body_length
+        while remaining > 0
+            n = readbytes!(source, buffer, min(remaining, length(buffer)))
+            if n == 0
+                # The frame cannot be completed; the connection is unusable
+                close(client.socket)
+                throw(ErrorException("Stream source ended $remaining bytes before the declared length"))
+            end
+            write(client.socket, view(buffer, 1:n))
+            remaining -= n
+        end
+        flush(client.socket)
+    end
+end
+
+# Compress an outgoing body with the client's codec. Every body is compressed, however small:
+# a compressed request is what tells the server it may compress the reply.
+function _compress_request(client::Client, body::Vector{UInt8}, body_format::BodyFormat)
+    format = UInt16(body_format)
+    if client.compression === :none || format > 0x00ff   # patch formats are sent as they are
+        return body, format
+    end
+    compressed = isempty(body) ? body :
+        compress_body(client.compression, body; level=client.compression_level, dictionary=client.dictionary)
+    return compressed, compressed_format(client.compression, format)
+end
+
+# Ask for the client's reply format with a query parameter, which servers that negotiate
+# reply formats remove before looking up the method
+function _with_reply_format(client::Client, method::String)
+    client.reply_format === :request && return method
+    return string(method, occursin('?', method) ? '&' : '?', "format=", client.reply_format)
+end
+
+"""
+    hello(client::Client; reply_format=nothing) -> Dict
+
+Handshake with the server. With `reply_format` (`:request`, `:json`, `:beve` or `:auto`),
+the server answers every later request on this connection in that format, unless a request
+asks for another. The reply describes the server: its connection's `reply_format`, the
+`reply_formats` and compression `codecs` it supports, and `auto_beve_bytes`, the size from
+which automatic replies are BEVE.
+
+# Examples
+```julia
+client = Client("localhost", 8081)
+connect(client)
+hello(client; reply_format = :auto)   # large numeric results now arrive as BEVE
+```
+"""
+function hello(client::Client; reply_format::Union{Nothing, Symbol} = nothing,
+               timeout::Union{Float64, Nothing} = nothing)
+    params = reply_format === nothing ? nothing : Dict("reply_format" => string(reply_format))
+    return _send_request_sync(client, "/hello", params; timeout = timeout)
+end
+
 function send_notify(client::Client, method::String, params = nothing; 
                     query_format::QueryFormat = QUERY_JSON_POINTER,
                     body_format::BodyFormat = BODY_JSON)
     
     body_bytes = params === nothing ? UInt8[] : encode_body(params, body_format)
+    body_bytes, format = _compress_request(client, body_bytes, body_format)
     
     msg = Message(
         id = _get_next_id(client),
         query = method,
         body = body_bytes,
         query_format = UInt16(query_format),
-        body_format = UInt16(body_format),
+        body_format = format,
         notify = true
     )
     
     _send_message(client, msg)
 end
 
+"""
+    cancel_request(client::Client, id::UInt64)
+
+Ask the server to abandon request `id` sent earlier on this connection. The cancel is a
+notification to the `/cancel` method: a server that supports it drops the request if it
+has not started and signals its handler to stop if it has. Servers without `/cancel`
+ignore it.
+
+# Examples
+```julia
+id = UInt64(42)
+task = @async send_request(client, "/slow", nothing; request_id=id)
+cancel_request(client, id)
+```
+"""
+function cancel_request(client::Client, id::UInt64)
+    send_notify(client, "/cancel", Dict("id" => id))
+end
+
 # Async version that returns a Task
 function send_request_async(client::Client, method::String, params = nothing; 
                            query_format::QueryFormat = QUERY_JSON_POINTER,
@@ -190,35 +341,56 @@ function _send_request_sync(client::Client, method::String, params = nothing;
                           query_format::QueryFormat = QUERY_JSON_POINTER,
                           body_format::BodyFormat = BODY_JSON,
                           timeout::Union{Float64, Nothing} = nothing,
-                          result_type::Union{Nothing, Type} = nothing)
+                          result_type::Union{Nothing, Type} = nothing,
+                          subscription::Union{Nothing, Function} = nothing,
+                          request_id::Union{Nothing, UInt64} = nothing,
+                          on_chunk::Union{Nothing, Function} = nothing,
+                          source::Union{Nothing, IO} = nothing,
+                          source_length::Integer = 0,
+                          chunk_size::Int = 1 << 20)
     
     if !client.connected
         connect(client)
     end
     
-    request_id = _get_next_id(client)
+    # A caller retrying a request passes its original id so the server can recognize the retry
+    request_id = something(request_id, _get_next_id(client))
     response_channel = Channel(1)
     
-    # Register the pending request
+    # Register the pending request (and any subscription callback, since the server may
+    # push the first value before the response arrives)
     lock(client.requests_lock) do
-        client.pending_requests[request_id] = PendingRequest(response_channel, result_type)
+        client.pending_requests[request_id] = PendingRequest(response_channel, result_type, on_chunk)
+        if subscription !== nothing
+            client.subscriptions[request_id] = subscription
+        end
     end
     
-    body_bytes = params === nothing ? UInt8[] : encode_body(params, body_format)
+    body_bytes = params === nothing || source !== nothing ? UInt8[] : encode_body(params, body_format)
+    # Streamed sources go out as they are
+    body_bytes, format = source === nothing ? _compress_request(client, body_bytes, body_format) :
+                                              (body_bytes, UInt16(body_format))
+    timeout_val = something(timeout, client.timeout)
     
     msg = Message(
         id = request_id,
-        query = method,
+        query = _with_reply_format(client, method),
         body = body_bytes,
         query_format = UInt16(query_format),
-        body_format = UInt16(body_format),
-        notify = false
+        body_format = format,
+        notify = false,
+        reserved = client.send_deadline ? deadline_budget(timeout_val) : 0
     )
     
     try
-        _send_message(client, msg)
-        
-        timeout_val = something(timeout, client.timeout)
+        if source === nothing
+            _send_message(client, msg)
+        else
+            header = msg.header
+            header.body_length = UInt64(source_length)
+            header.length = HEADER_SIZE + header.query_length + header.body_length
+            _send_streamed(client, header, msg.query, source, chunk_size)
+        end
         
         # Wait for response with timeout
         poll_interval = 0.001
@@ -230,8 +402,16 @@ function _send_request_sync(client::Client, method::String, params = nothing;
             # Clean up on timeout
             lock(client.requests_lock) do
                 delete!(client.pending_requests, request_id)
+                delete!(client.chunks, request_id)
             end
             close(response_channel)
+            if client.cancel_on_timeout
+                try
+                    cancel_request(client, request_id)
+                catch cancel_err
+                    @debug "Failed to send cancel" exception=cancel_err
+                end
+            end
             throw(ErrorException("Request timed out"))
         end
         
@@ -252,6 +432,8 @@ function _send_request_sync(client::Client, method::String, params = nothing;
         # Clean up on error
         lock(client.requests_lock) do
             delete!(client.pending_requests, request_id)
+            delete!(client.subscriptions, request_id)
+            delete!(client.chunks, request_id)
         end
         close(response_channel)
         rethrow(e)
@@ -263,13 +445,58 @@ function send_request(client::Client, method::String, params = nothing;
                      query_format::QueryFormat = QUERY_JSON_POINTER,
                      body_format::BodyFormat = BODY_JSON,
                      timeout::Union{Float64, Nothing} = nothing,
-                     result_type::Union{Nothing, Type} = nothing)
+                     result_type::Union{Nothing, Type} = nothing,
+                     request_id::Union{Nothing, UInt64} = nothing,
+                     on_chunk::Union{Nothing, Function} = nothing)
     
     return _send_request_sync(client, method, params; 
                             query_format=query_format, 
                             body_format=body_format, 
                             timeout=timeout,
-                            result_type=result_type)
+                            result_type=result_type,
+                            request_id=request_id,
+                            on_chunk=on_chunk)
+end
+
+"""
+    send_stream(client::Client, method::String, source::IO, length::Integer; body_format=BODY_RAW_BINARY,
+                timeout=nothing, chunk_size=1 << 20, on_chunk=nothing, result_type=nothing)
+
+Send a request whose body is the next `length` bytes of `source`, copied to the socket
+`chunk_size` bytes at a time, so a large upload is never held in memory whole. The server
+sees an ordinary request, so a streaming handler can consume the body while it arrives.
+
+The response is returned like that of `send_request`. With `on_chunk`, the response body is
+instead passed to `on_chunk(bytes)` piece by piece as it arrives (one call per frame of a
+response sent in chunks), and `nothing` is returned; use it for results too large to hold.
+
+# Examples
+```julia
+result = open("data.bin") do io
+    send_stream(client, "/digest", io, filesize("data.bin"))
+end
+
+# `on_chunk` works with send_request too, for a large result of a small request
+open("out.bin", "w") do out
+    send_request(client, "/generate", Dict("bytes" => 1 << 30); on_chunk = bytes -> write(out, bytes))
+end
+```
+"""
+function send_stream(client::Client, method::String, source::IO, length::Integer;
+                     body_format::BodyFormat = BODY_RAW_BINARY,
+                     timeout::Union{Float64, Nothing} = nothing,
+                     chunk_size::Int = 1 << 20,
+                     on_chunk::Union{Nothing, Function} = nothing,
+                     result_type::Union{Nothing, Type} = nothing)
+    
+    return _send_request_sync(client, method, nothing;
+                            body_format=body_format,
+                            timeout=timeout,
+                            result_type=result_type,
+                            on_chunk=on_chunk,
+                            source=source,
+                            source_length=length,
+                            chunk_size=chunk_size)
 end
 
 function send_request(::Type{T}, client::Client, method::String, params = nothing; 
@@ -322,36 +549,81 @@ function _handle_responses(client::Client)
             
             header = deserialize_header(header_bytes)
             
-            # Read complete message
-            message_bytes = Vector{UInt8}(undef, header.length)
-            message_bytes[1:HEADER_SIZE] = header_bytes
+            # Read query and body straight into their own buffers
+            query = String(read(client.socket, header.query_length))
+            body = read(client.socket, header.body_length)
+            if sizeof(query) != header.query_length || length(body) != header.body_length
+                break
+            end
+            msg = Message(header, query, body)
             
-            if header.query_length + header.body_length > 0
-                remaining = read(client.socket, header.query_length + header.body_length)
-                message_bytes[HEADER_SIZE+1:end] = remaining
+            # Server push for a subscription
+            if msg.header.notify != 0
+                callback = lock(client.requests_lock) do
+                    get(client.subscriptions, msg.header.id, nothing)
+                end
+                if callback !== nothing
+                    try
+                        callback(msg)
+                    catch callback_err
+                        @warn "Error in subscription callback" exception=callback_err
+                    end
+                end
+                continue
             end
             
-            msg = deserialize_message(message_bytes)
+            # Find the waiting request. Its chunk callback and the parse run outside the lock,
+            # so a slow consumer does not hold up other requests or disconnect.
+            pending = lock(client.requests_lock) do
+                get(client.pending_requests, msg.header.id, nothing)
+            end
+            pending === nothing && continue
+            ch = pending.channel
             
-            # Find and notify the waiting request
-            lock(client.requests_lock) do
-                if haskey(client.pending_requests, msg.header.id)
-                    pending = client.pending_requests[msg.header.id]
-                    ch = pending.channel
-                    
-                    if msg.header.ec != UInt32(EC_OK)
-                        error_msg = isempty(msg.body) ? "Unknown error" : String(msg.body)
-                        put!(ch, ErrorException("RPC Error ($(msg.header.ec)): $error_msg"))
-                    else
-                        try
-                            result = pending.result_type === nothing ? 
-                                parse_body(msg) : 
-                                parse_body(msg, pending.result_type)
-                            put!(ch, result)
-                        catch parse_err
-                            put!(ch, parse_err)
-                        end
+            if msg.header.ec == UInt32(EC_OK) && pending.on_chunk !== nothing
+                # The caller consumes the body as it arrives
+                try
+                    isempty(msg.body) || pending.on_chunk(msg.body)
+                    (msg.header.reserved & CHUNK_MORE) == 0 && put!(ch, nothing)
+                catch chunk_err
+                    lock(client.requests_lock) do
+                        delete!(client.pending_requests, msg.header.id)   # ignore the rest
                     end
+                    put!(ch, chunk_err)
+                end
+                continue
+            end
+            
+            reply = lock(client.requests_lock) do
+                if msg.header.ec != UInt32(EC_OK)
+                    delete!(client.chunks, msg.header.id)   # an error ends a chunked response early
+                    msg
+                elseif (msg.header.reserved & CHUNK_MORE) != 0
+                    append!(get!(() -> UInt8[], client.chunks, msg.header.id), msg.body)
+                    nothing
+                elseif haskey(client.chunks, msg.header.id)
+                    # Last frame of a response sent in chunks: parse the whole body
+                    body = append!(pop!(client.chunks, msg.header.id), msg.body)
+                    msg.header.body_length = length(body)
+                    msg.header.length = HEADER_SIZE + msg.header.query_length + length(body)
+                    Message(msg.header, msg.query, body)
+                else
+                    msg
+                end
+            end
+            reply === nothing && continue
+            
+            if reply.header.ec != UInt32(EC_OK)
+                error_msg = isempty(reply.body) ? "Unknown error" : String(reply.body)
+                put!(ch, ErrorException("RPC Error ($(reply.header.ec)): $error_msg"))
+            else
+                try
+                    result = pending.result_type === nothing ? 
+                        parse_body(reply) : 
+                        parse_body(reply, pending.result_type)
+                    put!(ch, result)
+                catch parse_err
+                    put!(ch, parse_err)
                 end
             end
             
@@ -374,6 +646,64 @@ function _handle_responses(client::Client)
     end
 end
 
+"""
+    subscribe(callback, client::Client, path::String; body_format=BODY_JSON, delta=false, timeout=nothing) -> UInt64
+
+Ask the server to push the registry value at `path` whenever it (or anything below it)
+changes, instead of polling it. `callback(value)` runs on the client's response task for
+each pushed value, starting with the current one, so it should return quickly. The server
+coalesces updates, so a callback always sees the latest value but may skip intermediate ones.
+
+With `delta=true` the server sends JSON merge patches (`BODY_MERGE_PATCH`) after the first
+value. The client applies them to its copy, so `callback` still receives the full value while
+only the changed fields cross the wire.
+
+Returns the subscription id to pass to `unsubscribe`.
+
+# Examples
+```julia
+id = subscribe(client, "/config") do config
+    println("config is now ", config)
+end
+```
+"""
+function subscribe(callback::Function, client::Client, path::String;
+                   body_format::BodyFormat = BODY_JSON,
+                   delta::Bool = false,
+                   timeout::Union{Float64, Nothing} = nothing)
+    handler = if delta
+        current = Ref{Any}(nothing)
+        function (msg::Message)
+            value = parse_body(msg)
+            if msg.header.body_format == UInt16(BODY_MERGE_PATCH)
+                value = apply_merge_patch!(current[], value)
+            end
+            current[] = value
+            callback(value)
+        end
+    else
+        msg::Message -> callback(parse_body(msg))
+    end
+    result = _send_request_sync(client, "/subscribe", Dict("path" => path, "delta" => delta);
+                                body_format=body_format,
+                                timeout=timeout,
+                                subscription=handler)
+    return UInt64(result["subscription"])
+end
+
+"""
+    unsubscribe(client::Client, id; timeout=nothing)
+
+Cancel a subscription created with `subscribe`.
+"""
+function unsubscribe(client::Client, id::Integer; timeout::Union{Float64, Nothing} = nothing)
+    lock(client.requests_lock) do
+        delete!(client.subscriptions, UInt64(id))
+    end
+    send_request(client, "/unsubscribe", Dict("subscription" => UInt64(id)); timeout=timeout)
+    return nothing
+end
+
 # Convenience function for concurrent batch requests
 function batch(client::Client, requests::AbstractVector{<:Tuple{String, Any}}; kwargs...)
     tasks = Task[]
@@ -397,5 +727,6 @@ end
 # Pretty printing for REPL
 function Base.show(io::IO, client::Client)
     status = client.connected ? "connected" : "disconnected"
-    print(io, "Client(\"$(client.host):$(client.port)\", $status)")
+    endpoint = something(client.socket_path, "$(client.host):$(client.port)")
+    print(io, "Client(\"$endpoint\", $status)")
 end
@@ -0,0 +1,168 @@
+# Body compression codecs. The codecs live in optional packages: loading CodecZstd or
+# CodecLz4 next to REPE activates a package extension that registers the codec here.
+
+struct BodyCodec
+    compress::Function     # (data::Vector{UInt8}, level::Int, dictionary) -> Vector{UInt8}
+    decompress::Function   # (data::Vector{UInt8}) -> Vector{UInt8}
+end
+
+const BODY_CODECS = Dict{Symbol, BodyCodec}()
+const CODECS_LOCK = ReentrantLock()
+
+# Trained zstd dictionaries by dictionary id, for decompressing frames that name one
+const ZSTD_DICTIONARIES = Dict{UInt32, Vector{UInt8}}()
+
+const ZSTD_DICTIONARY_MAGIC = 0xEC30A437
+
+function register_codec!(name::Symbol, compress::Function, decompress::Function)
+    lock(CODECS_LOCK) do
+        BODY_CODECS[name] = BodyCodec(compress, decompress)
+    end
+end
+
+"""
+    codec_available(codec::Symbol) -> Bool
+
+Whether body compression with `codec` (`:lz4` or `:zstd`) can be used, i.e. whether the
+package providing it (CodecLz4 or CodecZstd) has been loaded.
+
+# Examples
+```julia
+using REPE, CodecZstd
+codec_available(:zstd)  # true
+```
+"""
+codec_available(codec::Symbol) = codec === :none || lock(() -> haskey(BODY_CODECS, codec), CODECS_LOCK)
+
+function _codec(name::Symbol)::BodyCodec
+    lock(CODECS_LOCK) do
+        codec = get(BODY_CODECS, name, nothing)
+        if codec === nothing
+            package = name === :zstd ? "CodecZstd" : name === :lz4 ? "CodecLz4" : nothing
+            hint = package === nothing ? "" : "; load $package to enable it"
+            throw(ArgumentError("Compression codec :$name is not available$hint"))
+        end
+        return codec
+    end
+end
+
+"""
+    codec_of(format::Integer) -> Symbol
+
+The codec of a body format: `:lz4`, `:zstd`, or `:none` for an uncompressed format.
+"""
+function codec_of(format::Integer)::Symbol
+    base = UInt16(format) & 0xff00
+    base == BODY_LZ4_BASE && return :lz4
+    base == BODY_ZSTD_BASE && return :zstd
+    return :none
+end
+
+"""
+    inner_format(format::Integer) -> UInt16
+
+The format of the body inside a compressed format (the format itself if uncompressed).
+"""
+inner_format(format::Integer)::UInt16 =
+    codec_of(format) === :none ? UInt16(format) : UInt16(format) & 0x00ff
+
+"""
+    compressed_format(codec::Symbol, inner) -> UInt16
+
+The body format of `inner`-format bodies compressed with `codec`.
+
+# Examples
+```julia
+compressed_format(:zstd, BODY_JSON)  # 0x1202
+```
+"""
+function compressed_format(codec::Symbol, inner)::UInt16
+    format = UInt16(inner)
+    format > 0x00ff && throw(ArgumentError("Only formats below 256 can be compressed, got $format"))
+    codec === :lz4 && return BODY_LZ4_BASE | format
+    codec === :zstd && return BODY_ZSTD_BASE | format
+    codec === :none && return format
+    throw(ArgumentError("Unknown compression codec :$codec"))
+end
+
+"""
+    load_dictionary!(dictionary::Vector{UInt8}) -> UInt32
+    load_dictionary!(path::AbstractString) -> UInt32
+
+Register a trained zstd dictionary (made with `zstd --train`) so that bodies compressed
+with it can be decompressed. Returns the dictionary id. Compress with it by passing it to
+`Client(...; dictionary=...)` or `compress_body`.
+"""
+function load_dictionary!(dictionary::Vector{UInt8})::UInt32
+    id = zstd_dictionary_id(dictionary)
+    id == 0 && throw(ArgumentError("Not a trained zstd dictionary"))
+    lock(CODECS_LOCK) do
+        ZSTD_DICTIONARIES[id] = dictionary
+    end
+    return id
+end
+
+load_dictionary!(path::AbstractString) = load_dictionary!(read(path))
+
+# Id of a trained dictionary: a little-endian UInt32 after its magic number (0 if there is none)
+function zstd_dictionary_id(dictionary::AbstractVector{UInt8})::UInt32
+    length(dictionary) < 8 && return 0
+    magic = reinterpret(UInt32, dictionary[1:4])[1]
+    ltoh(magic) == ZSTD_DICTIONARY_MAGIC || return 0
+    return ltoh(reinterpret(UInt32, dictionary[5:8])[1])
+end
+
+_zstd_dictionary(id::UInt32) = lock(() -> get(ZSTD_DICTIONARIES, id, nothing), CODECS_LOCK)
+
+"""
+    compress_body(codec::Symbol, data::Vector{UInt8}; level=3, dictionary=nothing) -> Vector{UInt8}
+
+Compress a body with `codec`. `dictionary` (zstd only) is a trained dictionary, which the
+receiver must have loaded as well.
+"""
+function compress_body(codec::Symbol, data::Vector{UInt8}; level::Integer=3,
+                       dictionary::Union{Nothing, Vector{UInt8}}=nothing)::Vector{UInt8}
+    codec === :none && return data
+    if dictionary !== nothing && codec !== :zstd
+        throw(ArgumentError("Dictionaries are only supported with :zstd"))
+    end
+    return _codec(codec).compress(data, Int(level), dictionary)
+end
+
+"""
+    decompress_body(format::Integer, data::Vector{UInt8}) -> Vector{UInt8}
+
+Decompress a body of a compressed `format`; uncompressed bodies are returned as they are.
+"""
+function decompress_body(format::Integer, data::Vector{UInt8})::Vector{UInt8}
+    codec = codec_of(format)
+    (codec === :none || isempty(data)) && return data
+    return _codec(codec).decompress(data)
+end
+
+# The message with its body decompressed and the inner body format in its header
+function _decompressed(msg::Message)::Message
+    body = decompress_body(msg.header.body_format, msg.body)
+    header = deepcopy(msg.header)
+    header.body_format = inner_format(msg.header.body_format)
+    header.body_length = UInt64(length(body))
+    header.length = HEADER_SIZE + header.query_length + header.body_length
+    return Message(header, msg.query, body)
+end
+
+# Compress a reply for a client that sent a compressed request, when it is worth it
+function _compress_reply(request::Message, response::Message)::Message
+    codec = codec_of(request.header.body_format)
+    (codec === :none || response.header.ec != UInt32(EC_OK)) && return response
+    length(response.body) < COMPRESSION_THRESHOLD && return response
+    codec_of(response.header.body_format) === :none || return response
+    response.header.body_format > 0x00ff && return response
+    codec_available(codec) || return response
+    body = compress_body(codec, response.body)
+    length(body) < length(response.body) || return response
+    header = deepcopy(response.header)
+    header.body_format = compressed_format(codec, response.header.body_format)
+    header.body_length = UInt64(length(body))
+    header.length = HEADER_SIZE + header.query_length + header.body_length
+    return Message(header, response.query, body)
+end
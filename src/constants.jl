@@ -2,6 +2,13 @@ const REPE_SPEC = 0x1507
 const REPE_VERSION = 0x01
 const HEADER_SIZE = 48
 
+# Response header `reserved` flag: more frames of this response follow under the same id.
+# A streamed response is the concatenation of the bodies of its frames.
+const CHUNK_MORE = UInt32(1)
+
+# Bodies at least this large are written straight to the socket rather than copied into one frame buffer
+const STREAM_THRESHOLD = 64 * 1024
+
 @enum ErrorCode::UInt32 begin
     EC_OK = 0
     EC_VERSION_MISMATCH = 1
@@ -12,6 +19,10 @@ const HEADER_SIZE = 48
     EC_METHOD_NOT_FOUND = 6
     EC_TIMEOUT = 7
     EC_APPLICATION_ERROR_BASE = 4096
+    EC_CANCELLED = 4097   # the client cancelled the request
+    EC_BUSY = 4098        # the server shed the request under overload; retry later or elsewhere
+    EC_RATE_LIMITED = 4099  # the client exceeded its rate limit; slow down
+    EC_MESSAGE_TOO_LARGE = 4100  # the query or body exceeds the server's size limit
 end
 
 @enum QueryFormat::UInt16 begin
@@ -26,8 +37,24 @@ end
     BODY_JSON = 2
     BODY_UTF8 = 3
     BODY_CUSTOM_BASE = 4096
+    BODY_MERGE_PATCH = 4097   # RFC 7386 JSON Merge Patch
+    BODY_JSON_PATCH = 4098    # RFC 6902 JSON Patch
 end
 
+# Compressed body formats wrap another format: the high byte names the codec and the low byte
+# is the format of the uncompressed body, so BODY_ZSTD_BASE | UInt16(BODY_JSON) is zstd-compressed
+# JSON. Bodies are standard LZ4 frames or zstd frames.
+const BODY_LZ4_BASE = UInt16(0x1100)
+const BODY_ZSTD_BASE = UInt16(0x1200)
+
+# Responses at least this large are compressed for a client that sent a compressed request
+const COMPRESSION_THRESHOLD = 4096
+
+# Reply formats a client can ask for: its request's own format, JSON, BEVE, or automatic
+# (BEVE for replies of at least AUTO_BEVE_BYTES as JSON, JSON below that)
+const REPLY_FORMATS = (:request, :json, :beve, :auto)
+const AUTO_BEVE_BYTES = 16 * 1024
+
 const ERROR_MESSAGES = Dict{ErrorCode, String}(
     EC_OK => "OK",
     EC_VERSION_MISMATCH => "Version mismatch",
@@ -36,7 +63,11 @@ const ERROR_MESSAGES = Dict{ErrorCode, String}(
     EC_INVALID_BODY => "Invalid body",
     EC_PARSE_ERROR => "Parse error",
     EC_METHOD_NOT_FOUND => "Method not found",
-    EC_TIMEOUT => "Timeout"
+    EC_TIMEOUT => "Timeout",
+    EC_CANCELLED => "Cancelled",
+    EC_BUSY => "Server busy",
+    EC_RATE_LIMITED => "Rate limited",
+    EC_MESSAGE_TOO_LARGE => "Message too large"
 )
 
 const JSON = BODY_JSON
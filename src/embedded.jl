@@ -0,0 +1,185 @@
+# The C++ server core hosted in this process through its C ABI (cpp_server/repe_core.h):
+# requests are answered by a ccall instead of a round trip to a repe_server process.
+
+const CORE_OK = Cint(0)
+const CORE_BUFFER_TOO_SMALL = Cint(1)
+
+# Mirrors repe_buffer
+struct CoreBuffer
+    data::Ptr{UInt8}
+    capacity::Csize_t
+    size::Csize_t
+end
+
+"""
+    EmbeddedServer(library = get(ENV, "REPE_CORE_LIBRARY", ...); options = String[])
+
+Load the `repe_core` shared library (built next to `repe_server` by its CMake project) and
+create a server core in this process. `options` are `repe_server` command line options, such
+as `["--dataset", "data.beve"]`. Requests are answered on the calling thread, through the
+same dispatch, cache and body formats as the server, with no socket or second process.
+
+Call it like a client with `send_request`, or pass whole messages to `handle`. `close` frees
+the core.
+
+# Examples
+```julia
+server = EmbeddedServer("cpp_server/build/librepe_core.so")
+send_request(server, "/add", Dict("a" => 1.0, "b" => 2.0))   # Dict("result" => 3.0)
+close(server)
+```
+"""
+mutable struct EmbeddedServer
+    library::Ptr{Cvoid}
+    core::Ptr{Cvoid}
+    handle::Ptr{Cvoid}    # repe_handle
+    take::Ptr{Cvoid}      # repe_take_response
+    destroy::Ptr{Cvoid}   # repe_core_destroy
+    next_id::Threads.Atomic{UInt64}
+    buffers::Vector{Vector{UInt8}}   # response buffers, reused from call to call
+    lock::ReentrantLock              # protects core, calls and buffers
+    idle::Threads.Condition          # on `lock`: notified when the last call in progress returns
+    calls::Int                       # calls in progress, which `close` waits for
+
+    function EmbeddedServer(library::AbstractString = get(ENV, "REPE_CORE_LIBRARY", _default_core_library());
+                            options::Vector{String} = String[])
+        handle = Libdl.dlopen(library)
+        create = Libdl.dlsym(handle, :repe_core_create)
+        argv = ["repe_core"; options]
+        core = ccall(create, Ptr{Cvoid}, (Cint, Ptr{Cstring}), length(argv), argv)
+        core == C_NULL && throw(ArgumentError("repe_core rejected the options $(join(options, ' '))"))
+        server_lock = ReentrantLock()
+        server = new(handle, core, Libdl.dlsym(handle, :repe_handle), Libdl.dlsym(handle, :repe_take_response),
+                     Libdl.dlsym(handle, :repe_core_destroy), Threads.Atomic{UInt64}(1), Vector{UInt8}[],
+                     server_lock, Threads.Condition(server_lock), 0)
+        finalizer(_destroy_unreachable, server)
+        return server
+    end
+end
+
+function _default_core_library()
+    name = Sys.isapple() ? "librepe_core.dylib" : Sys.iswindows() ? "repe_core.dll" : "librepe_core.so"
+    return joinpath(@__DIR__, "..", "cpp_server", "build", name)
+end
+
+# Free the core, once calls in progress have returned; new calls are refused from the start
+function Base.close(server::EmbeddedServer)
+    lock(server.lock) do
+        core = server.core
+        server.core = C_NULL
+        while server.calls > 0
+            wait(server.idle)
+        end
+        core == C_NULL || ccall(server.destroy, Cvoid, (Ptr{Cvoid},), core)
+    end
+    return nothing
+end
+
+# The finalizer, which must not take locks. A server the GC finds unreachable has no call in
+# progress and no `close` running (both hold a reference), so nothing else can touch the core.
+function _destroy_unreachable(server::EmbeddedServer)
+    if server.core != C_NULL
+        ccall(server.destroy, Cvoid, (Ptr{Cvoid},), server.core)
+        server.core = C_NULL
+    end
+    return nothing
+end
+
+Base.isopen(server::EmbeddedServer) = lock(() -> server.core != C_NULL, server.lock)
+
+# The core for one call, counted so that `close` waits for the call to return
+function _begin_call(server::EmbeddedServer)::Ptr{Cvoid}
+    lock(server.lock) do
+        server.core == C_NULL && throw(ErrorException("EmbeddedServer is closed"))
+        server.calls += 1
+        return server.core
+    end
+end
+
+function _end_call(server::EmbeddedServer)
+    lock(server.lock) do
+        server.calls -= 1
+        server.calls == 0 && notify(server.idle)
+    end
+end
+
+function _take_buffer(server::EmbeddedServer)
+    lock(server.lock) do
+        isempty(server.buffers) ? Vector{UInt8}(undef, 64 * 1024) : pop!(server.buffers)
+    end
+end
+
+_return_buffer(server::EmbeddedServer, buffer::Vector{UInt8}) = lock(() -> push!(server.buffers, buffer), server.lock)
+
+"""
+    handle(server::EmbeddedServer, request::Message) -> Union{Message, Nothing}
+
+Answer one request with the in-process core. Returns the response, with the chunks of a
+response sent in chunks joined into one body, or `nothing` for a notification.
+"""
+function handle(server::EmbeddedServer, request::Message)::Union{Message, Nothing}
+    frame = serialize_message(request)
+    core = _begin_call(server)
+    buffer = _take_buffer(server)
+    try
+        # Both calls happen on this thread with no yield between them, as repe_take_response requires
+        out = Ref(CoreBuffer(pointer(buffer), length(buffer), 0))
+        status = GC.@preserve frame buffer ccall(server.handle, Cint,
+                                                 (Ptr{Cvoid}, Ptr{UInt8}, Csize_t, Ref{CoreBuffer}),
+                                                 core, frame, length(frame), out)
+        if status == CORE_BUFFER_TOO_SMALL
+            resize!(buffer, out[].size)
+            out = Ref(CoreBuffer(pointer(buffer), length(buffer), 0))
+            status = GC.@preserve buffer ccall(server.take, Cint, (Ptr{Cvoid}, Ref{CoreBuffer}), core, out)
+        end
+        status == CORE_OK || throw(ErrorException("repe_handle failed ($status)"))
+        return _join_frames(view(buffer, 1:Int(out[].size)))
+    finally
+        _return_buffer(server, buffer)
+        _end_call(server)
+    end
+end
+
+# One response from the frames the core wrote, joining the bodies of a response sent in chunks
+function _join_frames(bytes::AbstractVector{UInt8})::Union{Message, Nothing}
+    response = nothing
+    body = UInt8[]
+    offset = 0
+    while offset < length(bytes)
+        header = deserialize_header(Vector{UInt8}(view(bytes, offset+1:offset+HEADER_SIZE)))
+        query_start = offset + HEADER_SIZE
+        body_start = query_start + Int(header.query_length)
+        append!(body, view(bytes, body_start+1:body_start+Int(header.body_length)))
+        response = (header, String(bytes[query_start+1:body_start]))
+        offset += Int(header.length)
+    end
+    response === nothing && return nothing
+    header, query = response
+    header.reserved &= ~CHUNK_MORE
+    header.body_length = length(body)
+    header.length = HEADER_SIZE + header.query_length + header.body_length
+    return Message(header, query, body)
+end
+
+function send_request(server::EmbeddedServer, method::String, params = nothing;
+                      query_format::QueryFormat = QUERY_JSON_POINTER,
+                      body_format::BodyFormat = BODY_JSON,
+                      result_type::Union{Nothing, Type} = nothing)
+    request = Message(
+        id = Threads.atomic_add!(server.next_id, UInt64(1)),
+        query = method,
+        body = params === nothing ? UInt8[] : encode_body(params, body_format),
+        query_format = UInt16(query_format),
+        body_format = UInt16(body_format)
+    )
+    response = handle(server, request)
+    if response.header.ec != UInt32(EC_OK)
+        error_msg = isempty(response.body) ? "Unknown error" : String(response.body)
+        throw(ErrorException("RPC Error ($(response.header.ec)): $error_msg"))
+    end
+    return result_type === nothing ? parse_body(response) : parse_body(response, result_type)
+end
+
+function Base.show(io::IO, server::EmbeddedServer)
+    print(io, "EmbeddedServer(", isopen(server) ? "open" : "closed", ")")
+end
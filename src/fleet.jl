@@ -511,6 +511,10 @@ function _call_with_retry(fleet::Fleet, node::Node, method::String, params;
     start_time = time()
     last_error = nothing
 
+    # Every attempt carries the same id, so a server with an idempotency window answers a
+    # retry of a request it already ran from its stored response instead of running it again
+    request_id = _get_next_id(node.client)
+
     for attempt in 1:fleet.retry_policy.max_attempts
         try
             # Ensure connected
@@ -524,7 +528,8 @@ function _call_with_retry(fleet::Fleet, node::Node, method::String, params;
             result = send_request(node.client, method, params;
                                   query_format=query_format,
                                   body_format=body_format,
-                                  timeout=timeout)
+                                  timeout=timeout,
+                                  request_id=request_id)
 
             elapsed = time() - start_time
             return RemoteResult{Any}(node.name, result, nothing, elapsed)
@@ -134,9 +134,7 @@ function validate_header(header::Header)::Bool
         return false
     end
     
-    if header.reserved != 0
-        return false
-    end
+    # `reserved` may carry a request's deadline budget in milliseconds (see deadline_budget)
     
     expected_length = HEADER_SIZE + header.query_length + header.body_length
     if header.length != expected_length
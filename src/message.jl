@@ -21,7 +21,8 @@ function Message(;
     query_format::Union{UInt16,Int}=UInt16(QUERY_RAW_BINARY),
     body_format::Union{UInt16,Int}=UInt16(BODY_RAW_BINARY),
     notify::Bool=false,
-    ec::Union{UInt32,Int}=UInt32(EC_OK)
+    ec::Union{UInt32,Int}=UInt32(EC_OK),
+    reserved::Union{UInt32,Int}=0
 )
     if body === nothing
         body_bytes = UInt8[]
@@ -31,7 +32,7 @@ function Message(;
         body_bytes = body
     else
         # Handle other types - encode based on format
-        if body_format == UInt16(BODY_JSON)
+        if body_format == UInt16(BODY_JSON) || _is_patch_format(body_format)
             json_str = JSONLib.json(body)
             body_bytes = Vector{UInt8}(json_str)
         elseif body_format == UInt16(BODY_BEVE)
@@ -53,6 +54,7 @@ function Message(;
         query_format=UInt16(query_format),
         body_format=UInt16(body_format),
         notify=notify ? 0x01 : 0x00,
+        reserved=UInt32(reserved),
         ec=UInt32(ec)
     )
 
@@ -115,7 +117,10 @@ function parse_body(msg::Message)
     if isempty(msg.body)
         return nothing
     end
-    if msg.header.body_format == UInt16(BODY_JSON)
+    if codec_of(msg.header.body_format) !== :none
+        return parse_body(_decompressed(msg))
+    end
+    if msg.header.body_format == UInt16(BODY_JSON) || _is_patch_format(msg.header.body_format)
         return JSONLib.parse(msg.body)
     elseif msg.header.body_format == UInt16(BODY_BEVE)
         return BEVEModule.from_beve(msg.body)
@@ -132,8 +137,14 @@ function parse_body(msg::Message, ::Type{T}) where T
     if isempty(msg.body)
         return nothing
     end
+    if codec_of(msg.header.body_format) !== :none
+        return parse_body(_decompressed(msg), T)
+    end
     format = msg.header.body_format
     if format == UInt16(BODY_JSON)
+        if T === Vector{Float64} && (codec = _native_codec(length(msg.body))) !== nothing
+            return _native_json_to_f64(codec, msg.body)
+        end
         return JSONLib.parse(msg.body, T)
     elseif format == UInt16(BODY_BEVE)
         return BEVEModule.deser_beve(T, msg.body)
@@ -142,8 +153,15 @@ function parse_body(msg::Message, ::Type{T}) where T
     end
 end
 
+# Patch formats carry JSON documents describing a change rather than a value
+_is_patch_format(format::Integer) =
+    format == UInt16(BODY_MERGE_PATCH) || format == UInt16(BODY_JSON_PATCH)
+
 function encode_body(data, format::BodyFormat)::Vector{UInt8}
-    if format == BODY_JSON
+    if format == BODY_JSON || _is_patch_format(UInt16(format))
+        if data isa DenseVector{Float64} && (codec = _native_codec(sizeof(data))) !== nothing
+            return _native_f64_to_json(codec, data)
+        end
         json_str = JSONLib.json(data)
         return Vector{UInt8}(json_str)
     elseif format == BODY_BEVE
@@ -165,6 +183,13 @@ function encode_body(data, format::BodyFormat)::Vector{UInt8}
     end
 end
 
+# Encode for a numeric format code, which may be a compressed format (see compressed_format)
+function encode_body(data, format::Integer)::Vector{UInt8}
+    codec = codec_of(format)
+    codec === :none && return encode_body(data, BodyFormat(format))
+    return compress_body(codec, encode_body(data, BodyFormat(inner_format(format))))
+end
+
 function create_error_message(ec::ErrorCode, msg::String="")::Message
     error_msg = isempty(msg) ? get(ERROR_MESSAGES, ec, "Unknown error") : msg
 
@@ -176,8 +201,23 @@ function create_error_message(ec::ErrorCode, msg::String="")::Message
     )
 end
 
-function create_response(request::Message, result; body_format::BodyFormat=BODY_JSON)::Message
-    body_bytes = encode_body(result, body_format)
+# Encode a handler's result in the reply format negotiated for the request being served
+# (see _negotiate); JSON when there is none
+function _encode_reply(result)
+    preference = get(task_local_storage(), :repe_reply_format, :request)
+    if preference === :beve
+        return encode_body(result, BODY_BEVE), BODY_BEVE
+    end
+    json = encode_body(result, BODY_JSON)
+    if preference === :auto && length(json) >= AUTO_BEVE_BYTES
+        return encode_body(result, BODY_BEVE), BODY_BEVE
+    end
+    return json, BODY_JSON
+end
+
+function create_response(request::Message, result; body_format::Union{Nothing,BodyFormat}=nothing)::Message
+    body_bytes, body_format = body_format === nothing ? _encode_reply(result) :
+                                                        (encode_body(result, body_format), body_format)
 
     return Message(
         id=request.header.id,
@@ -0,0 +1,135 @@
+# glaze's JSON and BEVE codecs, loaded from the repe_codec shared library built next to the
+# C++ server (cpp_server/repe_codec.h). Once loaded, large bodies are encoded and decoded by it
+# instead of by JSON.jl and BEVE.jl; results come back through the same buffer protocol as
+# EmbeddedServer's responses.
+
+# Bodies below this size stay in Julia, where a ccall and a copy would cost more than they save
+const NATIVE_CODEC_MIN_BYTES = 64 * 1024
+
+struct NativeCodec
+    library::Ptr{Cvoid}
+    json_to_beve::Ptr{Cvoid}
+    beve_to_json::Ptr{Cvoid}
+    json_to_f64::Ptr{Cvoid}
+    f64_to_json::Ptr{Cvoid}
+    take::Ptr{Cvoid}
+    error::Ptr{Cvoid}
+end
+
+const NATIVE_CODEC = Ref{Union{Nothing, NativeCodec}}(nothing)
+const NATIVE_CODEC_CHECKED = Ref(false)   # whether REPE_CODEC_LIBRARY has been looked at
+
+function _default_codec_library()
+    name = Sys.isapple() ? "librepe_codec.dylib" : Sys.iswindows() ? "repe_codec.dll" : "librepe_codec.so"
+    return joinpath(@__DIR__, "..", "cpp_server", "build", name)
+end
+
+"""
+    load_native_codec!(library = get(ENV, "REPE_CODEC_LIBRARY", ...))
+
+Load the `repe_codec` shared library (built by the C++ server's CMake project) so that large
+JSON and BEVE bodies are handled by glaze: `Vector{Float64}` bodies are encoded and parsed
+natively, and `transcode_body` converts between JSON and BEVE without building Julia values.
+Setting `REPE_CODEC_LIBRARY` loads it on first use instead.
+
+# Examples
+```julia
+load_native_codec!("cpp_server/build/librepe_codec.so")
+native_codec_available()  # true
+```
+"""
+function load_native_codec!(library::AbstractString = get(ENV, "REPE_CODEC_LIBRARY", _default_codec_library()))
+    handle = Libdl.dlopen(library)
+    codec = NativeCodec(handle, Libdl.dlsym(handle, :repe_json_to_beve), Libdl.dlsym(handle, :repe_beve_to_json),
+                        Libdl.dlsym(handle, :repe_json_to_f64), Libdl.dlsym(handle, :repe_f64_to_json),
+                        Libdl.dlsym(handle, :repe_codec_take), Libdl.dlsym(handle, :repe_codec_error))
+    lock(CODECS_LOCK) do
+        NATIVE_CODEC[] = codec
+        NATIVE_CODEC_CHECKED[] = true
+    end
+    return nothing
+end
+
+"""
+    native_codec_available() -> Bool
+
+Whether the `repe_codec` library is loaded (see `load_native_codec!`).
+"""
+native_codec_available() = _native_codec() !== nothing
+
+function _native_codec()::Union{Nothing, NativeCodec}
+    NATIVE_CODEC_CHECKED[] && return NATIVE_CODEC[]
+    library = lock(CODECS_LOCK) do
+        NATIVE_CODEC_CHECKED[] ? nothing : (NATIVE_CODEC_CHECKED[] = true; get(ENV, "REPE_CODEC_LIBRARY", nothing))
+    end
+    if library !== nothing
+        try
+            load_native_codec!(library)
+        catch e
+            @warn "Could not load the native codec from REPE_CODEC_LIBRARY" library exception = e
+        end
+    end
+    return NATIVE_CODEC[]
+end
+
+# The native codec if it is loaded and `nbytes` is worth handing to it
+_native_codec(nbytes::Integer) = nbytes >= NATIVE_CODEC_MIN_BYTES ? _native_codec() : nothing
+
+# Run one codec call into a new Vector{T} of `guess` elements. A result that does not fit is
+# held by the library for this thread; it is fetched with no yield in between.
+function _native_call(call::Function, codec::NativeCodec, ::Type{T}, guess::Integer) where {T}
+    result = Vector{T}(undef, max(guess, 16))
+    out = Ref(CoreBuffer(pointer(result), sizeof(result), 0))
+    status = GC.@preserve result call(out)
+    if status == CORE_BUFFER_TOO_SMALL
+        resize!(result, cld(Int(out[].size), sizeof(T)))
+        out = Ref(CoreBuffer(pointer(result), sizeof(result), 0))
+        status = GC.@preserve result ccall(codec.take, Cint, (Ref{CoreBuffer},), out)
+    end
+    if status != CORE_OK
+        throw(ArgumentError("repe_codec: " * unsafe_string(ccall(codec.error, Cstring, ()))))
+    end
+    return resize!(result, Int(out[].size) ÷ sizeof(T))
+end
+
+function _native_transcode(codec::NativeCodec, body::Vector{UInt8}, to::BodyFormat)::Vector{UInt8}
+    f, guess = to == BODY_BEVE ? (codec.json_to_beve, length(body)) : (codec.beve_to_json, 2 * length(body))
+    return GC.@preserve body _native_call(codec, UInt8, guess) do out
+        ccall(f, Cint, (Ptr{UInt8}, Csize_t, Ref{CoreBuffer}), body, length(body), out)
+    end
+end
+
+function _native_json_to_f64(codec::NativeCodec, body::Vector{UInt8})::Vector{Float64}
+    # Numbers in JSON take about 8 to 24 characters
+    return GC.@preserve body _native_call(codec, Float64, length(body) ÷ 8) do out
+        ccall(codec.json_to_f64, Cint, (Ptr{UInt8}, Csize_t, Ref{CoreBuffer}), body, length(body), out)
+    end
+end
+
+function _native_f64_to_json(codec::NativeCodec, values::DenseVector{Float64})::Vector{UInt8}
+    return GC.@preserve values _native_call(codec, UInt8, 24 * length(values) + 2) do out
+        ccall(codec.f64_to_json, Cint, (Ptr{Float64}, Csize_t, Ref{CoreBuffer}), values, length(values), out)
+    end
+end
+
+"""
+    transcode_body(msg::Message, format::BodyFormat) -> Vector{UInt8}
+
+The body of `msg` re-encoded as `format` (`BODY_JSON` or `BODY_BEVE`). With the native codec
+loaded, large bodies are transcoded by glaze directly, without parsing them into Julia values;
+otherwise the body is parsed and encoded again.
+
+# Examples
+```julia
+beve = transcode_body(json_message, BODY_BEVE)
+```
+"""
+function transcode_body(msg::Message, format::BodyFormat)::Vector{UInt8}
+    codec_of(msg.header.body_format) === :none || return transcode_body(_decompressed(msg), format)
+    msg.header.body_format == UInt16(format) && return copy(msg.body)
+    if format in (BODY_JSON, BODY_BEVE) && msg.header.body_format in (UInt16(BODY_JSON), UInt16(BODY_BEVE))
+        codec = _native_codec(length(msg.body))
+        codec === nothing || return _native_transcode(codec, msg.body, format)
+    end
+    return encode_body(parse_body(msg), format)
+end
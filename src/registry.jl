@@ -313,6 +313,36 @@ function _set_segment!(obj, segment::String, value)
     end
 end
 
+"""
+    apply_merge_patch!(target, patch)
+
+Apply an RFC 7386 JSON merge patch to `target` and return the result. Dict-like targets are
+updated in place: object members in the patch are merged recursively, `nothing` (JSON `null`)
+deletes a key, and anything else replaces the value. A non-object patch replaces the target.
+
+# Examples
+```julia
+config = Dict{String, Any}("timeout" => 30, "retries" => 3)
+apply_merge_patch!(config, Dict("timeout" => 60, "retries" => nothing))
+# config == Dict("timeout" => 60)
+```
+"""
+function apply_merge_patch!(target, patch)
+    if !_is_dict_like(patch)
+        return patch
+    end
+    result = target isa AbstractDict ? target : Dict{String, Any}()
+    for (k, v) in pairs(patch)
+        key = string(k)
+        if v === nothing
+            delete!(result, key)
+        else
+            result[key] = apply_merge_patch!(get(result, key, nothing), v)
+        end
+    end
+    return result
+end
+
 """
     handle_registry_request(registry::Registry, request::Message)::Message
 
@@ -322,6 +352,7 @@ Behavior:
 - Empty body: READ the value at the JSON pointer path
 - Non-empty body with Function at path: CALL the function with body as arguments
 - Non-empty body with non-Function at path: WRITE the body value to that path
+- `BODY_MERGE_PATCH` body: merge the patch into the value at that path
 
 This matches the Glaze C++ REPE registry semantics.
 """
@@ -359,6 +390,19 @@ function handle_registry_request(registry::Registry, request::Message)::Message
                 # CALL the function with body as arguments
                 result = _invoke_function(target, params)
                 return create_response(request, result)
+            elseif request.header.body_format == UInt16(BODY_MERGE_PATCH)
+                # PATCH operation - merge into the existing value
+                if target === nothing
+                    throw(ArgumentError("Cannot patch missing path '$pointer'"))
+                end
+                patched = apply_merge_patch!(target, params)
+                if patched !== target
+                    if isempty(pointer) || pointer == "/"
+                        throw(ArgumentError("Cannot replace registry root with a non-object patch"))
+                    end
+                    set_json_pointer!(registry, pointer, patched)
+                end
+                return create_response(request, Dict("status" => "ok", "path" => pointer))
             else
                 # WRITE operation - set the value at the path
                 if isempty(pointer) || pointer == "/"
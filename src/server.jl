@@ -12,15 +12,17 @@ end
 mutable struct Server
     host::String
     port::Int
-    server::Union{Sockets.TCPServer,Nothing}
+    socket_path::Union{Nothing,String}   # listen on this Unix domain socket instead of host:port
+    server::Union{Sockets.TCPServer,Sockets.PipeServer,Nothing}
     running::Bool
     handlers::Dict{String,Function}
     middleware::Vector{Function}
     print_stacktrace::Bool
     nodelay::Bool
 
-    function Server(host::String="localhost", port::Int=8080; print_stacktrace::Bool=false, nodelay::Bool=true)
-        new(host, port, nothing, false, Dict{String,Function}(), Function[], print_stacktrace, nodelay)
+    function Server(host::String="localhost", port::Int=8080; print_stacktrace::Bool=false, nodelay::Bool=true,
+                    socket_path::Union{Nothing,String}=nothing)
+        new(host, port, socket_path, nothing, false, Dict{String,Function}(), Function[], print_stacktrace, nodelay)
     end
 end
 
@@ -57,19 +59,26 @@ function _start_server(server::Server)
         return
     end
 
-    listen_addr = _resolve_listen_address(server.host)
-    server.server = Sockets.listen(listen_addr, server.port)
+    if server.socket_path === nothing
+        listen_addr = _resolve_listen_address(server.host)
+        server.server = Sockets.listen(listen_addr, server.port)
+        @info "REPE Server listening on $(server.host):$(server.port)"
+    else
+        _remove_socket_file(server.socket_path)   # left by an earlier run
+        server.server = Sockets.listen(server.socket_path)
+        @info "REPE Server listening on $(server.socket_path)"
+    end
     server.running = true
 
-    @info "REPE Server listening on $(server.host):$(server.port)"
-
     # Yield to allow other tasks to run
     yield()
 
     while server.running
         try
             client = accept(server.server)
-            Sockets.nagle(client, !server.nodelay)
+            if client isa TCPSocket
+                Sockets.nagle(client, !server.nodelay)
+            end
             @async _handle_client(server, client)
         catch e
             if server.running
@@ -90,12 +99,25 @@ function stop(server::Server)
         close(server.server)
         server.server = nothing
     end
+    if server.socket_path !== nothing
+        _remove_socket_file(server.socket_path)
+    end
 
     @info "REPE Server stopped"
 end
 
-function _handle_client(server::Server, client::TCPSocket)
+# Remove a Unix domain socket file, but never a file of another kind at the same path
+function _remove_socket_file(path::String)
+    if issocket(path)
+        rm(path)
+    elseif ispath(path)
+        throw(ArgumentError("$path exists and is not a socket"))
+    end
+end
+
+function _handle_client(server::Server, client::Union{TCPSocket,Base.PipeEndpoint})
     @info "Client connected"
+    preferred_reply = :request   # reply format chosen with /hello
 
     try
         while isopen(client) && server.running
@@ -119,10 +141,18 @@ function _handle_client(server::Server, client::TCPSocket)
             end
 
             request = deserialize_message(message_bytes)
+            request, reply_format = _negotiate(request, preferred_reply)
 
-            response = _process_request(server, request)
+            response = if _is_hello(request)
+                preferred_reply, hello = _hello(request, preferred_reply)
+                hello
+            else
+                task_local_storage(() -> _process_request(server, request), :repe_reply_format, reply_format)
+            end
 
             if request.header.notify == 0
+                # A client that compressed its request reads compressed replies
+                response = _compress_reply(request, response)
                 response_data = serialize_message(response)
                 write(client, response_data)
                 flush(client)
@@ -180,6 +210,51 @@ function _process_request(server::Server, request::Message)::Message
     end
 end
 
+# Split a `format` query parameter (`/sum?format=beve`) off a request. Returns the request
+# with the bare path and the reply format asked for, or `default` if it names none.
+function _negotiate(request::Message, default::Symbol)
+    mark = findfirst('?', request.query)
+    mark === nothing && return request, default
+    preference = default
+    for param in split(request.query[nextind(request.query, mark):end], '&')
+        name, value = occursin('=', param) ? split(param, '=', limit=2) : (param, "")
+        if name == "format" && Symbol(value) in REPLY_FORMATS
+            preference = Symbol(value)
+        end
+    end
+    path = request.query[1:prevind(request.query, mark)]
+    header = deepcopy(request.header)
+    header.query_length = UInt64(sizeof(path))
+    header.length = HEADER_SIZE + header.query_length + header.body_length
+    return Message(header, path, request.body), preference
+end
+
+_is_hello(request::Message) = request.query == "/hello" || request.query == "hello"
+
+# The hello handshake: set the connection's reply format and describe what the server supports
+function _hello(request::Message, preferred::Symbol)
+    params = try
+        parse_body(request)
+    catch
+        nothing
+    end
+    requested = params isa AbstractDict ? get(params, "reply_format", nothing) : nothing
+    if requested !== nothing
+        if !(requested isa AbstractString && Symbol(requested) in REPLY_FORMATS)
+            return preferred, _create_error_response(request, EC_INVALID_BODY,
+                "Invalid reply_format for hello; expected request, json, beve or auto")
+        end
+        preferred = Symbol(requested)
+    end
+    codecs = [string(c) for c in (:zstd, :lz4) if codec_available(c)]
+    return preferred, create_response(request, Dict(
+        "reply_format" => string(preferred),
+        "reply_formats" => string.(collect(REPLY_FORMATS)),
+        "codecs" => codecs,
+        "auto_beve_bytes" => AUTO_BEVE_BYTES,
+    ); body_format=BODY_JSON)
+end
+
 function set_nodelay!(server::Server, enabled::Bool)
     server.nodelay = enabled
     return server
@@ -224,10 +299,28 @@ function wait_for_server(host::String, port::Int; attempts::Int=50, delay::Float
     error(ErrorException("Server failed to start on $host:$port"))
 end
 
+function wait_for_server(socket_path::String; attempts::Int=50, delay::Float64=0.1)
+    for _ in 1:attempts
+        try
+            close(Sockets.connect(socket_path))
+            return
+        catch e
+            if isa(e, Base.IOError) || isa(e, Base.UVError)
+                sleep(delay)
+            else
+                rethrow(e)
+            end
+        end
+    end
+
+    error(ErrorException("Server failed to start on $socket_path"))
+end
+
 # Pretty printing for REPL
 function Base.show(io::IO, server::Server)
     status = server.running ? "running" : "stopped"
     n_handlers = length(server.handlers)
     handler_text = n_handlers == 1 ? "1 handler" : "$n_handlers handlers"
-    print(io, "Server(\"$(server.host):$(server.port)\", $status, $handler_text)")
+    endpoint = something(server.socket_path, "$(server.host):$(server.port)")
+    print(io, "Server(\"$endpoint\", $status, $handler_text)")
 end
@@ -0,0 +1,397 @@
+# Shared-memory channel to a server on the same host. The client asks the server over a Unix
+# domain socket for a channel; the server creates memory holding two single-producer/
+# single-consumer byte rings (requests to the server, responses back), sealed so it cannot be
+# resized, and passes its descriptor back with the reply (SCM_RIGHTS). The client maps it, and
+# the rings then carry the same bytes the socket would. The layout mirrors
+# cpp_server/shm_channel.hpp. Linux only, as sealed memfds are.
+
+const SHM_MAGIC = 0x474E495245504552   # "REPERING"
+const SHM_VERSION = UInt32(1)
+const SHM_HEADER_BYTES = 4096
+const SHM_CAPACITY = 1 << 20            # bytes per ring
+const SHM_SPIN_NS = 50_000              # longest a side spins (yielding) before sleeping
+
+# Offsets in the channel header, and in each ring's control block
+const SHM_CLOSED = 16
+const SHM_REQUESTS = 256
+const SHM_RESPONSES = 512
+const RING_HEAD = 0
+const RING_TAIL = 64
+const RING_DATA_SIGNAL = 128
+const RING_CONSUMER_WAITING = 132
+const RING_SPACE_SIGNAL = 192
+const RING_PRODUCER_WAITING = 196
+
+# Sockets, descriptor passing and mapping on Linux
+const AF_UNIX = Cint(1)
+const SOCK_STREAM_CLOEXEC = Cint(1 | 0o2000000)
+const SOL_SOCKET = Cint(1)
+const SCM_RIGHTS = Cint(1)
+const MSG_NOSIGNAL = Cint(0x4000)
+const EINTR = 4
+
+struct IOVec
+    base::Ptr{UInt8}
+    length::Csize_t
+end
+
+struct MsgHdr
+    name::Ptr{Cvoid}
+    namelen::Cuint
+    iov::Ptr{IOVec}
+    iovlen::Csize_t
+    control::Ptr{UInt8}
+    controllen::Csize_t
+    flags::Cint
+end
+
+# futex(2), shared between processes (not FUTEX_PRIVATE); elsewhere waits poll instead
+const SYS_FUTEX = !Sys.islinux() ? nothing : Sys.ARCH === :x86_64 ? 202 : Sys.ARCH === :aarch64 ? 98 : nothing
+const FUTEX_WAIT = Cint(0)
+const FUTEX_WAKE = Cint(1)
+
+_load(p::Ptr{T}, order::Symbol = :acquire) where {T} = Core.Intrinsics.atomic_pointerref(p, order)
+_store!(p::Ptr{T}, x::T, order::Symbol = :release) where {T} = Core.Intrinsics.atomic_pointerset(p, x, order)
+_fence() = Core.Intrinsics.atomic_fence(:sequentially_consistent)
+
+# One direction of a channel: its control block, its data and its capacity (a power of two)
+struct Ring
+    control::Ptr{UInt8}
+    data::Ptr{UInt8}
+    capacity::UInt64
+    closed::Ptr{UInt32}
+end
+
+_ring_ptr(ring::Ring, offset, ::Type{T}) where {T} = Ptr{T}(ring.control + offset)
+
+_isclosed(ring::Ring) = _load(ring.closed) != 0
+
+# Copy up to `n` bytes from `p` into the ring; never waits
+function _ring_write_some(ring::Ring, p::Ptr{UInt8}, n::Integer)::Int
+    tail = _load(_ring_ptr(ring, RING_TAIL, UInt64), :monotonic)
+    used = tail - _load(_ring_ptr(ring, RING_HEAD, UInt64))
+    used > ring.capacity && (_store!(ring.closed, UInt32(1)); return 0)
+    count = Int(min(UInt64(n), ring.capacity - used))
+    count == 0 && return 0
+    offset = tail & (ring.capacity - 1)
+    first = Int(min(UInt64(count), ring.capacity - offset))
+    unsafe_copyto!(ring.data + offset, p, first)
+    unsafe_copyto!(ring.data, p + first, count - first)
+    _store!(_ring_ptr(ring, RING_TAIL, UInt64), tail + UInt64(count))
+    _notify(ring, RING_DATA_SIGNAL, RING_CONSUMER_WAITING)
+    return count
+end
+
+# Copy up to `n` waiting bytes out of the ring to `p`; never waits
+function _ring_read_some(ring::Ring, p::Ptr{UInt8}, n::Integer)::Int
+    head = _load(_ring_ptr(ring, RING_HEAD, UInt64), :monotonic)
+    available = _load(_ring_ptr(ring, RING_TAIL, UInt64)) - head
+    available > ring.capacity && (_store!(ring.closed, UInt32(1)); return 0)
+    count = Int(min(UInt64(n), available))
+    count == 0 && return 0
+    offset = head & (ring.capacity - 1)
+    first = Int(min(UInt64(count), ring.capacity - offset))
+    unsafe_copyto!(p, ring.data + offset, first)
+    unsafe_copyto!(p + first, ring.data, count - first)
+    _store!(_ring_ptr(ring, RING_HEAD, UInt64), head + UInt64(count))
+    _notify(ring, RING_SPACE_SIGNAL, RING_PRODUCER_WAITING)
+    return count
+end
+
+_ring_available(ring::Ring) =
+    _load(_ring_ptr(ring, RING_TAIL, UInt64)) - _load(_ring_ptr(ring, RING_HEAD, UInt64), :monotonic)
+
+_ring_readable(ring::Ring) = _ring_available(ring) != 0
+_ring_writable(ring::Ring) = _ring_available(ring) != ring.capacity
+
+# Wake the other side if it sleeps; the fence pairs with the one in _ring_wait
+function _notify(ring::Ring, signal, waiting)
+    _fence()
+    if _load(_ring_ptr(ring, waiting, UInt32), :monotonic) != 0
+        _wake(_ring_ptr(ring, signal, UInt32))
+    end
+end
+
+function _wake(signal::Ptr{UInt32})
+    Core.Intrinsics.atomic_pointermodify(signal, +, UInt32(1), :release)
+    if SYS_FUTEX !== nothing
+        ccall(:syscall, Clong, (Clong, Ptr{UInt32}, Cint, Cint), SYS_FUTEX, signal, FUTEX_WAKE, typemax(Cint))
+    end
+end
+
+# Sleep while `signal` holds `seen`, for at most `timeout` seconds. The wait runs on a libuv
+# worker thread so that it blocks this task and not the Julia thread running it.
+function _futex_wait(signal::Ptr{UInt32}, seen::UInt32, timeout::Float64)
+    if SYS_FUTEX === nothing
+        sleep(0.001)
+        return
+    end
+    timespec = Clong[0, round(Clong, timeout * 1e9)]
+    GC.@preserve timespec begin
+        @threadcall(:syscall, Clong, (Clong, Ptr{UInt32}, Cint, UInt32, Ptr{Clong}),
+                    SYS_FUTEX, signal, FUTEX_WAIT, seen, pointer(timespec))
+    end
+    return
+end
+
+# Wait until `ready(ring)` or the channel closes: spin, yielding to other tasks, for up to
+# the budget in `spin[]`, then sleep on the futex. The budget adapts as on the server side:
+# doubled when spinning paid off, halved when it did not.
+function _ring_wait(ring::Ring, ready::Function, signal, waiting, spin::Ref{Int})
+    done() = ready(ring) || _isclosed(ring)
+    deadline = time_ns() + spin[]
+    while time_ns() < deadline
+        if done()
+            spin[] = min(SHM_SPIN_NS, 2 * spin[] + 100)
+            return
+        end
+        yield()
+    end
+    spin[] = max(SHM_SPIN_NS ÷ 64, spin[] ÷ 2)
+    signal_ptr = _ring_ptr(ring, signal, UInt32)
+    waiting_ptr = _ring_ptr(ring, waiting, UInt32)
+    while true
+        seen = _load(signal_ptr)
+        _store!(waiting_ptr, UInt32(1), :monotonic)
+        _fence()
+        if done()
+            _store!(waiting_ptr, UInt32(0), :monotonic)
+            return
+        end
+        _futex_wait(signal_ptr, seen, 0.1)
+        _store!(waiting_ptr, UInt32(0), :monotonic)
+        done() && return
+    end
+end
+
+"""
+    SharedMemoryStream <: IO
+
+The client end of a shared-memory channel: writes go to the request ring and reads come
+from the response ring. `Client(...; socket_path = path, shared_memory = true)` creates one
+in place of its socket. Closing it ends the channel on both sides.
+"""
+mutable struct SharedMemoryStream <: IO
+    memory::Vector{UInt8}   # the mapped channel
+    requests::Ring
+    responses::Ring
+    control::Cint           # socket the channel was attached over (-1 for none)
+    read_spin::Ref{Int}
+    write_spin::Ref{Int}
+end
+
+function SharedMemoryStream(memory::Vector{UInt8}, control::Integer)
+    base = pointer(memory)
+    capacity = Int(ltoh(unsafe_load(Ptr{UInt32}(base + 12))))
+    closed = Ptr{UInt32}(base + SHM_CLOSED)
+    requests = Ring(base + SHM_REQUESTS, base + SHM_HEADER_BYTES, capacity, closed)
+    responses = Ring(base + SHM_RESPONSES, base + SHM_HEADER_BYTES + capacity, capacity, closed)
+    return SharedMemoryStream(memory, requests, responses, Cint(control), Ref(SHM_SPIN_NS), Ref(SHM_SPIN_NS))
+end
+
+"""
+    SharedMemoryStream(fd::RawFD; control = -1)
+
+Map the channel the server passed as descriptor `fd`, which is closed once mapped. The
+header is checked before the channel is used.
+"""
+function SharedMemoryStream(fd::RawFD; control::Integer = -1)
+    io = fdio(fd.fd, true)
+    memory = try
+        bytes = filesize(io)
+        bytes >= SHM_HEADER_BYTES + 2 * 4096 || throw(ArgumentError("channel memory is too small"))
+        Mmap.mmap(io, Vector{UInt8}, bytes; grow = false)
+    finally
+        close(io)   # the mapping keeps the memory
+    end
+    base = pointer(memory)
+    capacity = ltoh(unsafe_load(Ptr{UInt32}(base + 12)))
+    if ltoh(unsafe_load(Ptr{UInt64}(base))) != SHM_MAGIC || ltoh(unsafe_load(Ptr{UInt32}(base + 8))) != SHM_VERSION ||
+       !ispow2(capacity) || length(memory) != SHM_HEADER_BYTES + 2 * Int(capacity)
+        throw(ArgumentError("not a channel this client understands"))
+    end
+    return SharedMemoryStream(memory, control)
+end
+
+"""
+    SharedMemoryStream(capacity::Integer)
+
+A channel in anonymous memory of this process, with both ends here (for tests).
+"""
+function SharedMemoryStream(capacity::Integer)
+    ispow2(capacity) && capacity >= 4096 || throw(ArgumentError("capacity must be a power of two of at least 4096"))
+    memory = Mmap.mmap(Vector{UInt8}, SHM_HEADER_BYTES + 2 * capacity)
+    base = pointer(memory)
+    unsafe_store!(Ptr{UInt64}(base), htol(SHM_MAGIC))
+    unsafe_store!(Ptr{UInt32}(base + 8), htol(SHM_VERSION))
+    unsafe_store!(Ptr{UInt32}(base + 12), htol(UInt32(capacity)))
+    return SharedMemoryStream(memory, -1)
+end
+
+Base.isopen(s::SharedMemoryStream) = !_isclosed(s.requests)
+Base.bytesavailable(s::SharedMemoryStream) = Int(_ring_available(s.responses))
+Base.flush(::SharedMemoryStream) = nothing
+
+function Base.eof(s::SharedMemoryStream)
+    _ring_readable(s.responses) && return false
+    _ring_wait(s.responses, _ring_readable, RING_DATA_SIGNAL, RING_CONSUMER_WAITING, s.read_spin)
+    return !_ring_readable(s.responses)
+end
+
+function Base.unsafe_write(s::SharedMemoryStream, p::Ptr{UInt8}, n::UInt)
+    written = 0
+    while written < n
+        isopen(s) || throw(Base.IOError("shared-memory channel closed", 0))
+        count = _ring_write_some(s.requests, p + written, n - written)
+        written += count
+        if count == 0
+            _ring_wait(s.requests, _ring_writable, RING_SPACE_SIGNAL, RING_PRODUCER_WAITING, s.write_spin)
+        end
+    end
+    return Int(n)
+end
+
+Base.write(s::SharedMemoryStream, x::UInt8) = unsafe_write(s, Ref(x), UInt(1))
+
+# Up to `nb` bytes, fewer only if the channel closes first
+function Base.readbytes!(s::SharedMemoryStream, b::Vector{UInt8}, nb::Integer = length(b))
+    nb > length(b) && resize!(b, nb)
+    got = 0
+    GC.@preserve b while got < nb
+        count = _ring_read_some(s.responses, pointer(b, got + 1), nb - got)
+        got += count
+        count == 0 && eof(s) && break
+    end
+    return got
+end
+
+function Base.unsafe_read(s::SharedMemoryStream, p::Ptr{UInt8}, n::UInt)
+    got = 0
+    while got < n
+        count = _ring_read_some(s.responses, p + got, n - got)
+        got += count
+        count == 0 && eof(s) && throw(EOFError())
+    end
+    return nothing
+end
+
+function Base.read(s::SharedMemoryStream, ::Type{UInt8})
+    x = Ref{UInt8}()
+    unsafe_read(s, x, UInt(1))
+    return x[]
+end
+
+function Base.close(s::SharedMemoryStream)
+    _store!(s.requests.closed, UInt32(1))
+    for ring in (s.requests, s.responses), signal in (RING_DATA_SIGNAL, RING_SPACE_SIGNAL)
+        _wake(_ring_ptr(ring, signal, UInt32))
+    end
+    if s.control >= 0
+        ccall(:close, Cint, (Cint,), s.control)
+        s.control = -1
+    end
+    return nothing
+end
+
+# A connected Unix domain socket of our own, outside libuv, so descriptors passed on it can
+# be received with recvmsg
+function _unix_connect(path::String)::Cint
+    sizeof(path) < 108 || throw(ArgumentError("Unix socket path is too long: $path"))
+    fd = ccall(:socket, Cint, (Cint, Cint, Cint), AF_UNIX, SOCK_STREAM_CLOEXEC, 0)
+    systemerror("socket", fd < 0)
+    address = zeros(UInt8, 110)   # sockaddr_un: sa_family_t, then the path
+    address[1:2] .= reinterpret(UInt8, [UInt16(AF_UNIX)])
+    copyto!(address, 3, codeunits(path), 1, sizeof(path))
+    if ccall(:connect, Cint, (Cint, Ptr{UInt8}, Cuint), fd, address, length(address)) != 0
+        errno = Libc.errno()
+        ccall(:close, Cint, (Cint,), fd)
+        throw(SystemError("connect to $path", errno))
+    end
+    return fd
+end
+
+function _send_all(fd::Cint, bytes::Vector{UInt8})
+    sent = 0
+    while sent < length(bytes)
+        n = GC.@preserve bytes ccall(:send, Cssize_t, (Cint, Ptr{UInt8}, Csize_t, Cint),
+                                     fd, pointer(bytes, sent + 1), length(bytes) - sent, MSG_NOSIGNAL)
+        if n < 0
+            Libc.errno() == EINTR && continue
+            throw(SystemError("send", Libc.errno()))
+        end
+        sent += n
+    end
+end
+
+# Exactly `n` bytes from the socket, and a descriptor passed with them (RawFD(-1) if none).
+# Blocking calls run on a libuv worker thread, as futex waits do.
+function _receive_with_descriptor(fd::Cint, n::Integer)
+    buffer = Vector{UInt8}(undef, n)
+    control = zeros(UInt8, 64)
+    passed = RawFD(-1)
+    got = 0
+    while got < n
+        iov = Ref(IOVec(pointer(buffer, got + 1), n - got))
+        r = GC.@preserve buffer control iov begin
+            msg = Ref(MsgHdr(C_NULL, 0, Base.unsafe_convert(Ptr{IOVec}, iov), 1, pointer(control), length(control), 0))
+            result = GC.@preserve msg @threadcall(:recvmsg, Cssize_t, (Cint, Ptr{MsgHdr}, Cint),
+                                                  fd, Base.unsafe_convert(Ptr{MsgHdr}, msg), 0)
+            result > 0 && (passed = _take_descriptor(control, msg[].controllen, passed))
+            result
+        end
+        if r < 0
+            Libc.errno() == EINTR && continue
+            throw(SystemError("recvmsg", Libc.errno()))
+        end
+        r == 0 && throw(EOFError())
+        got += r
+    end
+    return buffer, passed
+end
+
+# The descriptor in an SCM_RIGHTS control message, if there is one. The header is a size_t
+# length and two ints, and the data starts at the next size_t boundary.
+function _take_descriptor(control::Vector{UInt8}, controllen::Integer, passed::RawFD)::RawFD
+    data = cld(sizeof(Csize_t) + 2 * sizeof(Cint), sizeof(Csize_t)) * sizeof(Csize_t)
+    controllen >= data + sizeof(Cint) || return passed
+    GC.@preserve control begin
+        base = pointer(control)
+        level = unsafe_load(Ptr{Cint}(base + sizeof(Csize_t)))
+        type = unsafe_load(Ptr{Cint}(base + sizeof(Csize_t) + sizeof(Cint)))
+        (level == SOL_SOCKET && type == SCM_RIGHTS) || return passed
+        received = unsafe_load(Ptr{Cint}(base + data))
+    end
+    passed.fd >= 0 || return RawFD(received)
+    ccall(:close, Cint, (Cint,), received)   # only one is expected
+    return passed
+end
+
+# Connect to the server's Unix domain socket and move the connection onto a new channel,
+# whose memory the server passes back with its reply
+function _attach_shared_memory(socket_path::String, capacity::Integer = SHM_CAPACITY)
+    Sys.islinux() || throw(ArgumentError("shared-memory channels need Linux"))
+    ispow2(capacity) && capacity >= 4096 || throw(ArgumentError("capacity must be a power of two of at least 4096"))
+    control = _unix_connect(socket_path)
+    try
+        request = Message(query = "/shm_attach", body = Dict("capacity" => capacity),
+                          query_format = UInt16(QUERY_JSON_POINTER), body_format = UInt16(BODY_JSON))
+        _send_all(control, serialize_message(request))
+        head, fd = _receive_with_descriptor(control, HEADER_SIZE)
+        header = deserialize_header(head)
+        rest, later = _receive_with_descriptor(control, header.query_length + header.body_length)
+        if fd.fd < 0
+            fd = later
+        elseif later.fd >= 0
+            ccall(:close, Cint, (Cint,), later.fd)   # only one is expected
+        end
+        if header.ec != UInt32(EC_OK) || fd.fd < 0
+            fd.fd >= 0 && ccall(:close, Cint, (Cint,), fd.fd)
+            body = String(rest[header.query_length + 1:end])
+            throw(ErrorException("Server refused shared memory: $body"))
+        end
+        return SharedMemoryStream(fd; control = control)
+    catch
+        ccall(:close, Cint, (Cint,), control)
+        rethrow()
+    end
+end
@@ -0,0 +1,8 @@
+# Helpers shared by the testsets that play the server side of a connection by hand
+
+# Read one REPE frame from a socket
+function read_frame(sock)
+    header_bytes = read(sock, REPE.HEADER_SIZE)
+    header = REPE.deserialize_header(header_bytes)
+    return REPE.deserialize_message(vcat(header_bytes, read(sock, header.query_length + header.body_length)))
+end
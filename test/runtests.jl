@@ -2,6 +2,8 @@ using Test
 using REPE
 using Sockets
 
+include("helpers.jl")
+
 @testset "REPE.jl Tests" begin
     include("test_header.jl")
     include("test_message.jl")
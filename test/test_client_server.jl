@@ -181,4 +181,257 @@
             REPE.stop(server)
         end
     end
+
+    @testset "Subscriptions" begin
+        port = 9006
+        listener = Sockets.listen(Sockets.IPv4(127, 0, 0, 1), port)
+
+        # Minimal server: answer the subscribe request, then push two updates
+        server_task = @async begin
+            sock = accept(listener)
+            request = read_frame(sock)
+            @test REPE.parse_body(request)["path"] == "/config/timeout"
+
+            response = REPE.create_response(request, Dict("subscription" => request.header.id))
+            write(sock, serialize_message(response))
+            for value in (30, 60)
+                push = REPE.Message(id = request.header.id, query = "/config/timeout",
+                                    body = value, body_format = UInt16(REPE.BODY_JSON), notify = true)
+                write(sock, serialize_message(push))
+            end
+            flush(sock)
+            sock
+        end
+
+        client = REPE.Client("127.0.0.1", port)
+        REPE.connect(client)
+
+        try
+            values = Channel{Any}(10)
+            id = subscribe(client, "/config/timeout") do value
+                put!(values, value)
+            end
+            @test haskey(client.subscriptions, id)
+            @test take!(values) == 30
+            @test take!(values) == 60
+        finally
+            REPE.disconnect(client)
+            close(fetch(server_task))
+            close(listener)
+        end
+    end
+
+    @testset "Delta Subscriptions" begin
+        port = 9007
+        listener = Sockets.listen(Sockets.IPv4(127, 0, 0, 1), port)
+
+        # Push a full value, then a merge patch against it
+        server_task = @async begin
+            sock = accept(listener)
+            request = read_frame(sock)
+            @test REPE.parse_body(request)["delta"] == true
+
+            response = REPE.create_response(request, Dict("subscription" => request.header.id))
+            write(sock, serialize_message(response))
+            pushes = ((Dict("timeout" => 30, "retries" => 3), REPE.BODY_JSON),
+                      (Dict("timeout" => 60), REPE.BODY_MERGE_PATCH))
+            for (body, format) in pushes
+                push = REPE.Message(id = request.header.id, query = "/config",
+                                    body = body, body_format = UInt16(format), notify = true)
+                write(sock, serialize_message(push))
+            end
+            flush(sock)
+            sock
+        end
+
+        client = REPE.Client("127.0.0.1", port)
+        REPE.connect(client)
+
+        try
+            values = Channel{Any}(10)
+            subscribe(client, "/config"; delta = true) do value
+                put!(values, copy(value))
+            end
+            @test take!(values) == Dict("timeout" => 30, "retries" => 3)
+            @test take!(values) == Dict("timeout" => 60, "retries" => 3)
+        finally
+            REPE.disconnect(client)
+            close(fetch(server_task))
+            close(listener)
+        end
+    end
+
+    @testset "Cancel On Timeout" begin
+        port = 9008
+        listener = Sockets.listen(Sockets.IPv4(127, 0, 0, 1), port)
+
+        # Never answer the request; expect a cancel notification for it instead
+        server_task = @async begin
+            sock = accept(listener)
+            request = read_frame(sock)
+            cancel = read_frame(sock)
+            (sock, request, cancel)
+        end
+
+        client = REPE.Client("127.0.0.1", port; cancel_on_timeout = true, send_deadline = true)
+        REPE.connect(client)
+
+        try
+            @test_throws ErrorException send_request(client, "/slow", nothing; timeout = 0.2)
+            sock, request, cancel = fetch(server_task)
+            @test request.header.reserved == UInt32(200)
+            @test cancel.query == "/cancel"
+            @test cancel.header.notify == 0x01
+            @test REPE.parse_body(cancel)["id"] == request.header.id
+            close(sock)
+        finally
+            REPE.disconnect(client)
+            close(listener)
+        end
+    end
+
+    @testset "Streamed Bodies" begin
+        port = 9009
+        listener = Sockets.listen(Sockets.IPv4(127, 0, 0, 1), port)
+
+        reply(sock, request, body; more = false, format = REPE.BODY_JSON) = write(sock, REPE.serialize_message(
+            REPE.Message(id = request.header.id, query = request.query, body = body,
+                         body_format = UInt16(format), reserved = more ? REPE.CHUNK_MORE : 0)))
+
+        server_task = @async begin
+            sock = accept(listener)
+            # A JSON result in three frames
+            request = read_frame(sock)
+            reply(sock, request, "[1,"; more = true)
+            reply(sock, request, "2,3]"; more = true)
+            reply(sock, request, "")
+            # Raw bytes for a caller consuming them as they arrive
+            request = read_frame(sock)
+            reply(sock, request, "ab"; more = true, format = REPE.BODY_RAW_BINARY)
+            reply(sock, request, "cd"; more = true, format = REPE.BODY_RAW_BINARY)
+            reply(sock, request, "ef"; format = REPE.BODY_RAW_BINARY)
+            # An upload written in pieces
+            request = read_frame(sock)
+            reply(sock, request, Dict("bytes" => length(request.body), "sum" => sum(Int, request.body)))
+            sock
+        end
+
+        client = REPE.Client("127.0.0.1", port)
+        REPE.connect(client)
+
+        try
+            @test send_request(client, "/generate", nothing) == [1, 2, 3]
+
+            received = UInt8[]
+            held = Bool[]   # whether the client's request table was locked during each callback
+            consume = bytes -> (push!(held, islocked(client.requests_lock)); append!(received, bytes))
+            @test send_request(client, "/generate", nothing; on_chunk = consume) === nothing
+            @test !any(held)
+            @test String(received) == "abcdef"
+
+            upload = rand(UInt8, 200_000)
+            result = send_stream(client, "/digest", IOBuffer(upload), length(upload); chunk_size = 4096)
+            @test result["bytes"] == length(upload)
+            @test result["sum"] == sum(Int, upload)
+            @test isempty(client.chunks)
+            close(fetch(server_task))
+        finally
+            REPE.disconnect(client)
+            close(listener)
+        end
+    end
+
+    @testset "Reply Formats" begin
+        port = 9010
+        server = REPE.Server("localhost", port)
+        series = collect(1.0:5000.0)
+        REPE.register(server, "/series", (params, request) -> Dict("values" => series))
+        REPE.register(server, "/small", (params, request) -> Dict("ok" => true))
+        REPE.listen(server; async=true)
+        REPE.wait_for_server(server.host, port)
+
+        request = REPE.Message(query = "/series?format=beve&x=1", body = Dict("a" => 1), body_format = REPE.BODY_JSON)
+        stripped, preference = REPE._negotiate(request, :request)
+        @test stripped.query == "/series"
+        @test stripped.header.query_length == sizeof("/series")
+        @test preference == :beve
+        @test REPE._negotiate(REPE.Message(query = "/series?format=xml"), :json)[2] == :json
+
+        auto = task_local_storage(:repe_reply_format, :auto) do
+            (REPE.create_response(request, Dict("values" => series)), REPE.create_response(request, Dict("ok" => true)))
+        end
+        @test auto[1].header.body_format == UInt16(REPE.BODY_BEVE)
+        @test auto[2].header.body_format == UInt16(REPE.BODY_JSON)
+
+        beve_client = REPE.Client("localhost", port; reply_format = :beve)
+        client = REPE.Client("localhost", port)
+        REPE.connect(beve_client)
+        REPE.connect(client)
+
+        try
+            @test REPE.send_request(beve_client, "/series", nothing)["values"] == series
+
+            info = REPE.hello(client; reply_format = :auto)
+            @test info["reply_format"] == "auto"
+            @test "beve" in info["reply_formats"]
+            @test REPE.send_request(client, "/series", nothing)["values"] == series
+            @test REPE.send_request(client, "/small", nothing)["ok"] == true
+            @test_throws Exception REPE.hello(client; reply_format = :xml)
+        finally
+            REPE.disconnect(beve_client)
+            REPE.disconnect(client)
+            REPE.stop(server)
+        end
+    end
+
+    @testset "Unix Domain Socket" begin
+        path = joinpath(mktempdir(), "repe.sock")
+        server = REPE.Server(socket_path = path)
+        REPE.register(server, "/add", (params, request) -> params["a"] + params["b"])
+        REPE.listen(server; async=true)
+        REPE.wait_for_server(path)
+        @test issocket(path)
+
+        client = REPE.Client(socket_path = path)
+        REPE.connect(client)
+
+        try
+            @test REPE.send_request(client, "/add", Dict("a" => 2, "b" => 3)) == 5
+            REPE.set_nodelay!(client, false)   # no Nagle on a local socket: a no-op
+            @test REPE.send_request(client, "/add", Dict("a" => 4, "b" => 5)) == 9
+        finally
+            REPE.disconnect(client)
+            REPE.stop(server)
+        end
+        @test !ispath(path)
+    end
+
+    @testset "Shared Memory Rings" begin
+        stream = REPE.SharedMemoryStream(4096)
+        # The server's ends of the same rings
+        server_in, server_out = stream.requests, stream.responses
+
+        message = rand(UInt8, 10_000)   # larger than the ring: it wraps and waits for space
+        reader = @async begin
+            received = UInt8[]
+            buffer = Vector{UInt8}(undef, 1000)
+            while length(received) < length(message)
+                n = GC.@preserve buffer REPE._ring_read_some(server_in, pointer(buffer), length(buffer))
+                n == 0 ? yield() : append!(received, view(buffer, 1:n))
+            end
+            received
+        end
+        write(stream, message)
+        @test fetch(reader) == message
+
+        reply = rand(UInt8, 3000)
+        @test GC.@preserve(reply, REPE._ring_write_some(server_out, pointer(reply), length(reply))) == 3000
+        @test bytesavailable(stream) == 3000
+        @test read(stream, 3000) == reply
+
+        close(stream)
+        @test !isopen(stream)
+        @test eof(stream)
+        @test_throws ArgumentError REPE.Client(shared_memory = true)   # channels need a Unix socket
+    end
 end
@@ -414,9 +414,11 @@
 
         # Server that fails first 2 requests then succeeds
         call_count = Ref(0)
+        seen_ids = UInt64[]
         server = REPE.Server("localhost", port)
         REPE.register(server, "/flaky", function(params, req)
             call_count[] += 1
+            push!(seen_ids, req.header.id)
             if call_count[] < 3
                 throw(ErrorException("Temporary failure"))
             end
@@ -436,6 +438,10 @@
             @test REPE.succeeded(result)
             @test result.value["success"] == true
 
+            # Retries resend the original request id so servers can deduplicate them
+            @test length(seen_ids) == 3
+            @test allequal(seen_ids)
+
         finally
             REPE.stop(server)
         end
@@ -2,18 +2,42 @@ using REPE
 using Test
 using Sockets
 
+include("helpers.jl")
+
 println("Starting Glaze C++ server integration test...")
 
-# Start the C++ server in the background
 server_path = joinpath(@__DIR__, "..", "cpp_server", "build", "repe_server")
-server_process = run(`$server_path 8081`, wait=false)
 
-# Give server time to start
+# A port that is free right now: bind to port 0 and let the OS choose
+function free_port()
+    port, listener = listenany(IPv4(127, 0, 0, 1), 0)
+    close(listener)
+    return Int(port)
+end
+
+# Run `f(port)` against a server of its own started with `options`, and stop it afterwards
+function with_server(f, options::Cmd)
+    port = free_port()
+    process = run(`$server_path $port $options`, wait=false)
+    try
+        REPE.wait_for_server("localhost", port)
+        return f(port)
+    finally
+        kill(process)
+        wait(process)
+    end
+end
+
+# Start the C++ server in the background
+socket_path = joinpath(mktempdir(), "repe.sock")
+server_port = free_port()
+server_process = run(`$server_path $server_port --unix-socket $socket_path`, wait=false)
+
 println("Waiting for C++ server to start...")
-sleep(2)
+REPE.wait_for_server("localhost", server_port)
 
 @testset "Glaze C++ Server Integration" begin
-    client = REPE.Client("localhost", 8081)
+    client = REPE.Client("localhost", server_port)
     
     try
         REPE.connect(client)
@@ -65,6 +89,25 @@ sleep(2)
             @test result["status"] == "online"
             @test result["version"] == "1.0.0"
             println("✓ Status: $(result["status"]), Version: $(result["version"])")
+            # Only executions count as calls: a repeated add is a cache hit; status itself is not cached
+            before = REPE.send_request(client, "/status", nothing)["calls"]
+            for _ in 1:2
+                @test REPE.send_request(client, "/add", Dict("a" => 0.25, "b" => 0.5))["result"] ≈ 0.75
+            end
+            @test REPE.send_request(client, "/status", nothing)["calls"] == before + 1
+        end
+        
+        @testset "Lazy Decoding" begin
+            # The payload is only parsed when the kind needs it
+            result = REPE.send_request(client, "/ingest",
+                                      Dict("kind" => "sum", "payload" => [1.0, 2.0, 3.5]),
+                                      body_format = REPE.BODY_JSON)
+            @test result["result"] ≈ 6.5
+            result = REPE.send_request(client, "/ingest",
+                                      Dict("kind" => "discard", "payload" => "not numbers"),
+                                      body_format = REPE.BODY_JSON)
+            @test result["accepted"] == false
+            println("✓ Ingest: payload decoded only when needed")
         end
         
         @testset "Error Handling" begin
@@ -87,11 +130,550 @@ sleep(2)
             println("✓ Notification sent successfully")
         end
         
+        @testset "Shared Memory Channel" begin
+            local_client = REPE.Client(socket_path = socket_path, shared_memory = true)
+            REPE.connect(local_client)
+            try
+                result = REPE.send_request(local_client, "/add", Dict("a" => 2.0, "b" => 3.0))
+                @test result["result"] ≈ 5.0
+                # Larger than a ring, so it streams through
+                message = "x" ^ (2 * REPE.SHM_CAPACITY)
+                @test REPE.send_request(local_client, "/echo", Dict("message" => message))["result"] == "Echo: " * message
+                @test REPE.send_request(client, "/metrics", nothing)["connections_shm"] == 1
+            finally
+                REPE.disconnect(local_client)
+            end
+            # A channel is a connection of its own: with the socket it is attached through
+            # already at the cap, the attach is refused
+            limited_socket = joinpath(mktempdir(), "limited.sock")
+            with_server(`--max-connections 1 --unix-socket $limited_socket`) do port
+                refused = REPE.Client(socket_path = limited_socket, shared_memory = true)
+                @test_throws ErrorException REPE.connect(refused)
+                plain = REPE.Client(socket_path = limited_socket)
+                REPE.connect(plain)
+                try
+                    @test REPE.send_request(plain, "/metrics", nothing)["connections_shm"] == 0
+                finally
+                    REPE.disconnect(plain)
+                end
+            end
+            println("✓ Shared memory: requests and large bodies over the rings, channels under the connection cap")
+        end
+
+        @testset "Registry Writes" begin
+            REPE.send_request(client, "/config/timeout", 12.5)
+            @test REPE.send_request(client, "/config/timeout", nothing) ≈ 12.5
+            # A body that fails partway through changes nothing
+            malformed = "{\"timeout\": 99.0, \"retries\": \"many\"}"
+            @test_throws Exception REPE.send_stream(client, "/config", IOBuffer(malformed), sizeof(malformed);
+                                                    body_format = REPE.BODY_JSON)
+            config = REPE.send_request(client, "/config", nothing)
+            @test config["timeout"] ≈ 12.5
+            @test config["retries"] == 3
+            println("✓ Registry writes: a failed write leaves the old value")
+        end
+
+        @testset "Registry Patches" begin
+            updates = Channel{Any}(10)
+            id = REPE.subscribe(client, "/config/retries") do value
+                put!(updates, value)
+            end
+            try
+                @test take!(updates) == 3
+                # `test` compares values, so another spelling of the same number passes
+                patch = """[{"op": "test", "path": "/timeout", "value": 1.25e1},
+                            {"op": "replace", "path": "/retries", "value": 4}]"""
+                REPE.send_stream(client, "/config", IOBuffer(patch), sizeof(patch); body_format = REPE.BODY_JSON_PATCH)
+                @test take!(updates) == 4
+                # Subscribers hear about writes whatever query parameters the path carried
+                REPE.send_request(client, "/config/retries?format=json", 3)
+                @test take!(updates) == 3
+            finally
+                REPE.unsubscribe(client, id)
+            end
+            println("✓ Registry patches: value comparison and canonical paths for subscribers")
+        end
+
+        @testset "Delta Subscriptions" begin
+            copies = Channel{Any}(Inf)
+            id = REPE.subscribe(client, "/config"; delta = true) do value
+                put!(copies, deepcopy(value))
+            end
+            formats = Channel{UInt16}(Inf)
+            raw = REPE._send_request_sync(client, "/subscribe", Dict("path" => "/config", "delta" => true);
+                                          subscription = msg -> put!(formats, msg.header.body_format))
+            writers = [REPE.Client("localhost", server_port) for _ in 1:4]
+            foreach(REPE.connect, writers)
+            try
+                take!(copies)
+                @test take!(formats) == UInt16(REPE.BODY_JSON)
+                # A plain write is pushed as the full value, a merge patch as a patch
+                REPE.send_request(client, "/config/log_level", "warn")
+                @test take!(formats) == UInt16(REPE.BODY_JSON)
+                REPE.send_request(client, "/config", Dict("log_level" => "info"); body_format = REPE.BODY_MERGE_PATCH)
+                @test take!(formats) == UInt16(REPE.BODY_MERGE_PATCH)
+
+                # Concurrent patches of different members publish in any order; the subscriber's
+                # copy must still end up equal to the server's value
+                @sync for (i, w) in enumerate(writers), n in 1:25
+                    member = isodd(i) ? Dict("timeout" => 100.0 * i + n) : Dict("log_level" => "level-$i-$n")
+                    @async REPE.send_request(w, "/config", member; body_format = REPE.BODY_MERGE_PATCH)
+                end
+                expected = REPE.send_request(client, "/config", nothing)
+                latest = nothing
+                deadline = time() + 5
+                while latest != expected && time() < deadline
+                    isready(copies) ? (latest = take!(copies)) : sleep(0.01)
+                end
+                @test latest == expected
+            finally
+                foreach(REPE.disconnect, writers)
+                REPE.unsubscribe(client, id)
+                REPE.unsubscribe(client, raw["subscription"])
+                REPE.send_request(client, "/config", Dict("timeout" => 12.5, "log_level" => "info");
+                                  body_format = REPE.BODY_MERGE_PATCH)
+            end
+            println("✓ Delta subscriptions: full values for plain writes, ordered patches under concurrent writers")
+        end
+
+        @testset "JSON Pointer Reads" begin
+            config = REPE.send_request(client, "/config", nothing)
+            @test Set(keys(config)) == Set(["timeout", "retries", "log_level"])
+            REPE.send_request(client, "/config/log_level", "debug")
+            @test REPE.send_request(client, "/config/log_level", nothing) == "debug"
+            @test REPE.send_request(client, "/config", nothing)["log_level"] == "debug"
+            @test REPE.send_request(client, "/sum", [1.0, 2.0, 4.5]) ≈ 7.5
+            @test_throws ErrorException REPE.send_request(client, "/config/no_such_member", nothing)
+            @test_throws ErrorException REPE.send_request(client, "/config/retries", "three")
+            @test REPE.send_request(client, "/config/retries", nothing) == 3
+            # Method names resolve from raw binary queries too, registry paths only from JSON pointers
+            @test REPE.send_request(client, "/add", Dict("a" => 1.0, "b" => 2.0);
+                                    query_format = REPE.QUERY_RAW_BINARY)["result"] ≈ 3.0
+            @test_throws ErrorException REPE.send_request(client, "/config/retries", nothing;
+                                                          query_format = REPE.QUERY_RAW_BINARY)
+            sock = Sockets.connect("localhost", server_port)
+            try
+                write(sock, REPE.serialize_message(REPE.Message(id = 9, query = "/add",
+                                                                body = Dict("a" => 1.0, "b" => 2.0),
+                                                                query_format = 7,
+                                                                body_format = UInt16(REPE.BODY_JSON))))
+                reply = read_frame(sock)
+                @test reply.header.id == 9
+                @test reply.header.ec == UInt32(REPE.EC_INVALID_QUERY)
+            finally
+                close(sock)
+            end
+            println("✓ JSON pointers: member reads and writes, functions, unknown paths, query formats")
+        end
+
+        @testset "Response Cache" begin
+            before = REPE.send_request(client, "/metrics", nothing)
+            params = Dict("x" => 1.25, "y" => 8.0)
+            for _ in 1:3
+                @test REPE.send_request(client, "/multiply", params)["result"] ≈ 10.0
+            end
+            after = REPE.send_request(client, "/metrics", nothing)
+            @test after["cache_misses"] == before["cache_misses"] + 1
+            @test after["cache_hits"] == before["cache_hits"] + 2
+            @test after["cache_entries"] >= 1
+            println("✓ Cache: repeated pure calls are answered from the cache")
+        end
+
+        @testset "Coalescing" begin
+            # Identical concurrent divides either run or join a run; every caller gets the result
+            before = REPE.send_request(client, "/metrics", nothing)
+            calls_before = REPE.send_request(client, "/status", nothing)["calls"]
+            clients = [REPE.Client("localhost", server_port) for _ in 1:4]
+            foreach(REPE.connect, clients)
+            results = Channel{Any}(64)
+            try
+                @sync for c in clients, _ in 1:16
+                    @async put!(results, REPE.send_request(c, "/divide",
+                                                           Dict("numerator" => 7.0, "denominator" => 2.0)))
+                end
+            finally
+                foreach(REPE.disconnect, clients)
+            end
+            close(results)
+            @test all(r -> r["result"] ≈ 3.5, collect(results))
+            after = REPE.send_request(client, "/metrics", nothing)
+            runs = after["coalesced_executions"] - before["coalesced_executions"]
+            joins = after["coalesced_joined"] - before["coalesced_joined"]
+            @test runs >= 1
+            @test runs + joins == 64
+            # Only the executions count as calls, not the requests that joined them
+            @test REPE.send_request(client, "/status", nothing)["calls"] == calls_before + runs
+            println("✓ Coalescing: $runs executions answered 64 identical requests")
+        end
+
+        @testset "Read-Mostly Tables" begin
+            REPE.send_request(client, "/tables/rates", Dict("usd" => 1.0, "eur" => 1.08))
+            @test REPE.send_request(client, "/rate", Dict("name" => "eur"))["rate"] ≈ 1.08
+            # A merge patch is published as one snapshot; a failed one publishes nothing
+            REPE.send_request(client, "/tables", Dict("rates" => Dict("gbp" => 1.27)); body_format = REPE.BODY_MERGE_PATCH)
+            @test REPE.send_request(client, "/tables/rates", nothing)["gbp"] ≈ 1.27
+            @test_throws Exception REPE.send_request(client, "/tables", Dict("weights" => "not numbers");
+                                                     body_format = REPE.BODY_MERGE_PATCH)
+            @test REPE.send_request(client, "/tables/weights", nothing) == []
+            @test_throws Exception REPE.send_request(client, "/rate", Dict("name" => "xyz"))
+            @test REPE.send_request(client, "/metrics", nothing)["rcu_reclaimed"] >= 1
+            # With no further writes, the collection timer frees what the last write left waiting
+            deadline = time() + 2
+            while REPE.send_request(client, "/metrics", nothing)["rcu_retired"] > 0 && time() < deadline
+                sleep(0.05)
+            end
+            @test REPE.send_request(client, "/metrics", nothing)["rcu_retired"] == 0
+            println("✓ RCU tables: lock-free reads of published snapshots")
+        end
+
+        @testset "BEVE Dataset" begin
+            path = joinpath(mktempdir(), "results.beve")
+            runs = [Dict("temperature" => 20.0 + i, "label" => "run $i") for i in 0:9]
+            write(path, REPE.BEVEModule.to_beve(Dict("runs" => runs, "samples" => collect(1.0:100.0))))
+            with_server(`--dataset $path --dataset-prefix /dataset`) do port
+                c = REPE.Client("localhost", port)
+                REPE.connect(c)
+                try
+                    # Members, generic array elements and typed array elements, in both formats
+                    @test REPE.send_request(c, "/dataset/runs/3/temperature", nothing) ≈ 23.0
+                    @test REPE.send_request(c, "/dataset/runs/3/label", nothing; body_format = REPE.BODY_BEVE) == "run 3"
+                    @test REPE.send_request(c, "/dataset/samples/41", nothing; body_format = REPE.BODY_BEVE) ≈ 42.0
+                    @test length(REPE.send_request(c, "/dataset/runs", nothing)) == 10
+                    @test_throws ErrorException REPE.send_request(c, "/dataset/runs/10", nothing)
+                    @test_throws ErrorException REPE.send_request(c, "/dataset/missing", nothing)
+                finally
+                    REPE.disconnect(c)
+                end
+            end
+            println("✓ Dataset: JSON pointer slices of a mapped BEVE file")
+        end
+
+        @testset "Sharded Service" begin
+            with_server(`--shards 2`) do port
+                clients = [REPE.Client("localhost", port) for _ in 1:2]
+                foreach(REPE.connect, clients)
+                try
+                    for (i, c) in enumerate(clients)
+                        @test REPE.send_request(c, "/echo", Dict("message" => "shard $i"))["result"] == "Echo: shard $i"
+                        @test REPE.send_request(c, "/divide", Dict("numerator" => 9.0, "denominator" => 3.0))["result"] ≈ 3.0
+                    end
+                    metrics = REPE.send_request(clients[1], "/metrics", nothing)
+                    @test metrics["shards"] == 2
+                    @test metrics["shard_0_connections"] == 1 && metrics["shard_1_connections"] == 1
+                    status = REPE.send_request(clients[2], "/status", nothing)
+                    @test status["shards"] == 2
+                    @test status["calls"] == 4   # folded over both shards
+                finally
+                    foreach(REPE.disconnect, clients)
+                end
+            end
+            println("✓ Shards: one service instance per shard, status folded over them")
+        end
+
+        @testset "Pinned Busy-Polling Server" begin
+            with_server(`--workers 1 --io-cpus 0 --worker-cpus 0 --numa local --busy-poll 50`) do port
+                c = REPE.Client("localhost", port)
+                REPE.connect(c)
+                try
+                    for i in 1:5
+                        @test REPE.send_request(c, "/add", Dict("a" => i, "b" => 1.0))["result"] ≈ i + 1
+                    end
+                    metrics = REPE.send_request(c, "/metrics", nothing)
+                    @test metrics["threads_pinned"] + metrics["pin_failures"] >= 3   # worker, control pool, reader
+                    @test metrics["busy_poll_hits"] + metrics["busy_poll_sleeps"] >= 6
+                finally
+                    REPE.disconnect(c)
+                end
+            end
+            println("✓ Pinned threads and busy polling")
+        end
+
+        @testset "Load Shedding" begin
+            # Runs `count` sleeps at once on `c`, returning :ok or :busy for each
+            function sleeps(c, count, ms)
+                outcomes = Channel{Symbol}(count)
+                @sync for _ in 1:count
+                    @async put!(outcomes, try
+                        REPE.send_request(c, "/sleep", Dict("ms" => ms))
+                        :ok
+                    catch e
+                        occursin("4098", string(e)) ? :busy : :failed
+                    end)
+                end
+                close(outcomes)
+                return collect(outcomes)
+            end
+            # One worker and room for two waiting: the rest of a burst is refused at once
+            with_server(`--workers 1 --max-queued 2`) do port
+                clients = [REPE.Client("localhost", port) for _ in 1:4]
+                foreach(REPE.connect, clients)
+                try
+                    outcomes = Channel{Vector{Symbol}}(4)
+                    @sync for c in clients
+                        @async put!(outcomes, sleeps(c, 2, 200))
+                    end
+                    close(outcomes)
+                    all_outcomes = reduce(vcat, collect(outcomes))
+                    @test count(==(:ok), all_outcomes) >= 1
+                    @test count(==(:busy), all_outcomes) >= 3
+                    @test !(:failed in all_outcomes)
+                    @test REPE.send_request(clients[1], "/metrics", nothing)["shed_queue_full"] >= 3
+                finally
+                    foreach(REPE.disconnect, clients)
+                end
+            end
+            # Workers to spare, but a connection only has two requests in flight: four take two rounds
+            with_server(`--workers 4 --max-in-flight 2`) do port
+                c = REPE.Client("localhost", port)
+                REPE.connect(c)
+                try
+                    elapsed = @elapsed outcomes = sleeps(c, 4, 300)
+                    @test all(==(:ok), outcomes)
+                    @test elapsed >= 0.55
+                finally
+                    REPE.disconnect(c)
+                end
+            end
+            println("✓ Shedding: a full queue answers EC_BUSY, and in-flight requests are bounded")
+        end
+
+        @testset "Bulkheads and Priorities" begin
+            # sleep has a one-thread pool of its own; filling it leaves echo and status unaffected
+            with_server(`--workers 1 --pool slow=1 --route sleep=slow`) do port
+                c = REPE.Client("localhost", port)
+                REPE.connect(c)
+                try
+                    hogs = [@async(REPE.send_request(c, "/sleep", Dict("ms" => 300))) for _ in 1:4]
+                    sleep(0.1)
+                    @test (@elapsed REPE.send_request(c, "/echo", Dict("message" => "through"))) < 0.25
+                    @test (@elapsed REPE.send_request(c, "/status", nothing)) < 0.25
+                    @test REPE.send_request(c, "/metrics", nothing)["pool_slow_queue_depth"] >= 1
+                    foreach(wait, hogs)
+                finally
+                    REPE.disconnect(c)
+                end
+            end
+            # CoDel sheds queued normal requests under a standing queue; high-priority ones go first
+            with_server(`--workers 1 --codel-target 5 --codel-interval 20 --priority echo=high`) do port
+                clients = [REPE.Client("localhost", port) for _ in 1:5]
+                foreach(REPE.connect, clients)
+                try
+                    slow = Channel{Symbol}(16)
+                    fast = Channel{Symbol}(8)
+                    outcome(f) = try
+                        f()
+                        :ok
+                    catch e
+                        occursin("4098", string(e)) ? :busy : :failed
+                    end
+                    @sync begin
+                        for c in clients[1:4], _ in 1:4
+                            @async put!(slow, outcome(() -> REPE.send_request(c, "/sleep", Dict("ms" => 50))))
+                        end
+                        @async for i in 1:8
+                            sleep(0.05)
+                            put!(fast, outcome(() -> REPE.send_request(clients[5], "/echo", Dict("message" => "$i"))))
+                        end
+                    end
+                    close(slow)
+                    close(fast)
+                    @test :busy in collect(slow)
+                    @test all(==(:ok), collect(fast))
+                    @test REPE.send_request(clients[5], "/metrics", nothing)["shed_codel"] >= 1
+                finally
+                    foreach(REPE.disconnect, clients)
+                end
+            end
+            println("✓ Bulkheads keep pools apart, and high-priority requests are never shed")
+        end
+
+        @testset "Rate Limiting" begin
+            with_server(`--connection-rate 2 --rate-burst 1 --rate-mode reject`) do port
+                c = REPE.Client("localhost", port)
+                REPE.connect(c)
+                try
+                    # The bucket holds two requests; the rest of a quick burst is refused
+                    outcomes = map(1:6) do i
+                        try
+                            REPE.send_request(c, "/echo", Dict("message" => "burst $i"))
+                            :ok
+                        catch e
+                            occursin("4099", string(e)) ? :limited : :failed
+                        end
+                    end
+                    @test count(==(:ok), outcomes) >= 1
+                    @test count(==(:limited), outcomes) >= 3
+                    @test !(:failed in outcomes)
+                    # Tokens come back with time
+                    sleep(1.5)
+                    @test REPE.send_request(c, "/echo", Dict("message" => "later"))["result"] == "Echo: later"
+                finally
+                    REPE.disconnect(c)
+                end
+                # Limits are per connection, so a new one is served
+                observer = REPE.Client("localhost", port)
+                REPE.connect(observer)
+                try
+                    @test REPE.send_request(observer, "/metrics", nothing)["rate_rejected"] >= 3
+                finally
+                    REPE.disconnect(observer)
+                end
+            end
+            # In delay mode nothing is refused; the server reads the connection more slowly instead
+            with_server(`--connection-rate 5 --rate-burst 0.2`) do port
+                c = REPE.Client("localhost", port)
+                REPE.connect(c)
+                try
+                    elapsed = @elapsed for i in 1:6
+                        @test REPE.send_request(c, "/echo", Dict("message" => "paced $i"))["result"] == "Echo: paced $i"
+                    end
+                    @test elapsed >= 0.6   # one request of burst, then five at 5 per second
+                    @test REPE.send_request(c, "/metrics", nothing)["rate_delayed"] >= 1
+                finally
+                    REPE.disconnect(c)
+                end
+            end
+            println("✓ Rate limiting: requests over a connection's rate are refused")
+        end
+
+        @testset "Connection Reaping" begin
+            with_server(`--idle-timeout 1 --read-timeout 0.3`) do port
+                closed(sock) = (task = @async eof(sock); timedwait(() -> istaskdone(task), 10.0) === :ok)
+                # A connection that sends nothing, and one that stops partway through a header
+                idle = Sockets.connect("localhost", port)
+                stalled = Sockets.connect("localhost", port)
+                frame = REPE.serialize_message(REPE.Message(id = 1, query = "/status", body = nothing,
+                                                            body_format = UInt16(REPE.BODY_JSON)))
+                write(stalled, frame[1:20])
+                flush(stalled)
+                @test closed(stalled)
+                @test closed(idle)
+                observer = REPE.Client("localhost", port)
+                REPE.connect(observer)
+                try
+                    metrics = REPE.send_request(observer, "/metrics", nothing)
+                    @test metrics["timeouts_read"] >= 1
+                    @test metrics["timeouts_idle"] >= 1
+                finally
+                    REPE.disconnect(observer)
+                end
+            end
+            println("✓ Reaping: idle connections and stalled frames are closed")
+        end
+
+        @testset "Size Guards" begin
+            with_server(`--max-body-bytes 1024`) do port
+                c = REPE.Client("localhost", port)
+                REPE.connect(c)
+                try
+                    err = try
+                        REPE.send_request(c, "/echo", Dict("message" => "z" ^ 4096))
+                        nothing
+                    catch e
+                        e
+                    end
+                    @test err !== nothing && occursin("4100", string(err))
+                    # The oversized body was read and dropped, so the connection still works
+                    @test REPE.send_request(c, "/echo", Dict("message" => "small"))["result"] == "Echo: small"
+                    @test REPE.send_request(c, "/metrics", nothing)["oversized"] == 1
+                finally
+                    REPE.disconnect(c)
+                end
+                # A header declaring a huge query is refused from the header alone, before
+                # anything of that size is allocated or read, and the connection is closed
+                sock = Sockets.connect("localhost", port)
+                try
+                    huge = 1 << 40
+                    write(sock, REPE.serialize_header(REPE.Header(id = 7, query_length = huge,
+                                                                  length = REPE.HEADER_SIZE + huge)))
+                    reply = read_frame(sock)
+                    @test reply.header.id == 7
+                    @test reply.header.ec == UInt32(REPE.EC_MESSAGE_TOO_LARGE)
+                    @test eof(sock)
+                finally
+                    close(sock)
+                end
+            end
+            println("✓ Size guards: oversized bodies are refused without dropping the connection")
+        end
+
+        @testset "In-Process Core" begin
+            library = REPE._default_core_library()
+            if isfile(library)
+                core = REPE.EmbeddedServer(library)
+                try
+                    result = REPE.send_request(core, "/add", Dict("a" => 4.0, "b" => 6.0))
+                    @test result["result"] ≈ 10.0
+                    # Larger than the first response buffer
+                    message = "y" ^ (256 * 1024)
+                    @test REPE.send_request(core, "/echo", Dict("message" => message))["result"] == "Echo: " * message
+                    @test_throws ErrorException REPE.send_request(core, "/no_such_method", nothing)
+                    @test REPE.send_request(core, "/metrics", nothing)["requests_in_process"] == 4   # counting itself
+                    # Deadlines apply in-process as over a socket
+                    started = time()
+                    late = REPE.handle(core, REPE.Message(id = 900, query = "/sleep", body = Dict("ms" => 2000),
+                                                          query_format = UInt16(REPE.QUERY_JSON_POINTER),
+                                                          body_format = UInt16(REPE.BODY_JSON),
+                                                          reserved = REPE.deadline_budget(0.05)))
+                    @test late.header.ec == UInt32(REPE.EC_TIMEOUT)
+                    @test time() - started < 1.5
+                    # A cancel from another thread stops a call in progress
+                    if Threads.nthreads() > 1
+                        sleeper = Threads.@spawn REPE.handle(core, REPE.Message(id = 901, query = "/sleep",
+                                                                                body = Dict("ms" => 5000),
+                                                                                query_format = UInt16(REPE.QUERY_JSON_POINTER),
+                                                                                body_format = UInt16(REPE.BODY_JSON)))
+                        cancelled = false
+                        deadline = time() + 2
+                        while !cancelled && time() < deadline
+                            sleep(0.01)
+                            cancelled = REPE.send_request(core, "/cancel", Dict("id" => 901))["cancelled"]
+                        end
+                        @test cancelled
+                        @test fetch(sleeper).header.ec == UInt32(REPE.EC_CANCELLED)
+                    end
+                finally
+                    close(core)
+                end
+                @test !isopen(core)
+                # Closing while calls are in progress waits for them; later calls are refused
+                racing = REPE.EmbeddedServer(library)
+                tasks = [Threads.@spawn(REPE.send_request(racing, "/add", Dict("a" => 1.0, "b" => 2.0))) for _ in 1:8]
+                close(racing)
+                for task in tasks
+                    outcome = try
+                        fetch(task)["result"]
+                    catch
+                        :refused
+                    end
+                    @test outcome === :refused || outcome ≈ 3.0
+                end
+                @test_throws ErrorException REPE.send_request(racing, "/add", Dict("a" => 1.0, "b" => 2.0))
+                # In-process callers share one client's rate limit
+                limited = REPE.EmbeddedServer(library; options = ["--connection-rate", "1", "--rate-mode", "reject"])
+                try
+                    codes = [REPE.handle(limited, REPE.Message(id = n, query = "/add",
+                                                               body = Dict("a" => 1.0, "b" => 1.0),
+                                                               query_format = UInt16(REPE.QUERY_JSON_POINTER),
+                                                               body_format = UInt16(REPE.BODY_JSON))).header.ec
+                             for n in 1:4]
+                    @test first(codes) == UInt32(REPE.EC_OK)
+                    @test UInt32(REPE.EC_RATE_LIMITED) in codes
+                finally
+                    close(limited)
+                end
+                println("✓ In-process core: requests answered without a socket, with deadlines, cancel and rate limits")
+            else
+                @info "Skipping in-process core test: $library not built"
+            end
+        end
+
         println("\n✅ All Glaze integration tests passed!")
         
     finally
         REPE.disconnect(client)
         kill(server_process)
+        wait(server_process)
         println("Glaze C++ server stopped")
     end
 end
\ No newline at end of file
@@ -87,4 +87,63 @@
         )
         @test msg2.header.notify == 0x00
     end
-end
\ No newline at end of file
+    
+    @testset "Deadline Budget" begin
+        @test REPE.deadline_budget(2.5) == UInt32(2500)
+        @test REPE.deadline_budget(0.0001) == UInt32(1)
+        @test REPE.deadline_budget(1e12) == typemax(UInt32)
+        
+        msg = REPE.Message(query = "/slow", body = "data", reserved = REPE.deadline_budget(1.5))
+        @test msg.header.reserved == UInt32(1500)
+        decoded = REPE.deserialize_message(REPE.serialize_message(msg))
+        @test decoded.header.reserved == UInt32(1500)
+        @test REPE.validate_header(decoded.header)
+    end
+    
+    @testset "Compressed Body Formats" begin
+        @test REPE.compressed_format(:zstd, REPE.BODY_JSON) == 0x1202
+        @test REPE.compressed_format(:lz4, REPE.BODY_BEVE) == 0x1101
+        @test REPE.codec_of(0x1202) == :zstd
+        @test REPE.codec_of(0x1101) == :lz4
+        @test REPE.codec_of(REPE.BODY_MERGE_PATCH) == :none
+        @test REPE.inner_format(0x1203) == UInt16(REPE.BODY_UTF8)
+        @test REPE.inner_format(UInt16(REPE.BODY_JSON_PATCH)) == UInt16(REPE.BODY_JSON_PATCH)
+        @test_throws ArgumentError REPE.compressed_format(:zstd, REPE.BODY_MERGE_PATCH)
+        
+        # An empty compressed body is empty; parse_body sees the inner format
+        msg = REPE.Message(query = "/data", body = UInt8[], body_format = REPE.compressed_format(:zstd, REPE.BODY_JSON))
+        @test REPE.parse_body(msg) === nothing
+        
+        dictionary = vcat(reinterpret(UInt8, [htol(UInt32(0xEC30A437)), htol(UInt32(77))]), zeros(UInt8, 8))
+        @test REPE.zstd_dictionary_id(dictionary) == UInt32(77)
+        @test REPE.zstd_dictionary_id(zeros(UInt8, 16)) == 0
+        
+        if !REPE.codec_available(:lz4)
+            @test_throws ArgumentError REPE.compress_body(:lz4, UInt8[1, 2, 3])
+        end
+    end
+
+    @testset "Transcoding" begin
+        json = REPE.Message(query = "/data", body = Dict("values" => [1.5, 2.5]), body_format = UInt16(REPE.BODY_JSON))
+        beve = REPE.transcode_body(json, REPE.BODY_BEVE)
+        @test REPE.BEVEModule.from_beve(beve)["values"] == [1.5, 2.5]
+        @test REPE.transcode_body(json, REPE.BODY_JSON) == json.body
+        
+        # With the native codec built, large bodies go through glaze
+        library = REPE._default_codec_library()
+        if isfile(library)
+            REPE.load_native_codec!(library)
+            @test REPE.native_codec_available()
+            values = rand(REPE.NATIVE_CODEC_MIN_BYTES)
+            body = REPE.encode_body(values, REPE.BODY_JSON)
+            @test REPE.JSONLib.parse(body) == values
+            msg = REPE.Message(query = "/data", body = body, body_format = UInt16(REPE.BODY_JSON))
+            @test REPE.parse_body(msg, Vector{Float64}) == values
+            @test REPE.BEVEModule.from_beve(REPE.transcode_body(msg, REPE.BODY_BEVE)) == values
+            broken = copy(body)
+            broken[2] = UInt8('x')
+            bad = REPE.Message(query = "/data", body = broken, body_format = UInt16(REPE.BODY_JSON))
+            @test_throws ArgumentError REPE.parse_body(bad, Vector{Float64})
+        end
+    end
+end
@@ -312,6 +312,32 @@ using REPE
         @test r["config"]["timeout"] == 60
     end
 
+    @testset "Merge Patch" begin
+        config = Dict{String, Any}("timeout" => 30, "retries" => 3,
+                                   "limits" => Dict{String, Any}("rps" => 10, "burst" => 5))
+        result = REPE.apply_merge_patch!(config, Dict("timeout" => 60, "retries" => nothing,
+                                                      "limits" => Dict("rps" => 20)))
+        @test result === config
+        @test config["timeout"] == 60
+        @test !haskey(config, "retries")
+        @test config["limits"] == Dict("rps" => 20, "burst" => 5)
+
+        # Non-object patches replace the target (RFC 7386)
+        @test REPE.apply_merge_patch!(config, [1, 2]) == [1, 2]
+        @test REPE.apply_merge_patch!(5, Dict("a" => 1)) == Dict("a" => 1)
+
+        r = REPE.Registry("config" => Dict{String, Any}("timeout" => 30, "mode" => "fast"))
+        req = REPE.Message(
+            query="/config",
+            body=Dict("timeout" => 45),
+            query_format=UInt16(REPE.QUERY_JSON_POINTER),
+            body_format=UInt16(REPE.BODY_MERGE_PATCH)
+        )
+        resp = REPE.handle_registry_request(r, req)
+        @test resp.header.ec == UInt32(REPE.EC_OK)
+        @test r["config"] == Dict("timeout" => 45, "mode" => "fast")
+    end
+
     @testset "Registry Request Handling - Function Calls" begin
         r = REPE.Registry()
 